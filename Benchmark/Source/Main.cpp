@@ -0,0 +1,588 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Headless benchmark for AudioFilePlayerAudioProcessor.
+
+    Loads each test file through the processor's transportSourceCreator and
+    drives processBlock without an editor or audio device, for every
+    combination of the requested sample rates and block sizes.
+
+    With --resampler, measures the cost and accuracy of each resampling
+    quality instead, and with --search, the latency of library searches.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../Source/PluginProcessor.h"
+#include "../../Source/LibrarySearch.h"
+
+//==============================================================================
+struct BenchmarkOptions
+{
+    Array<double> sampleRates { 44100.0, 48000.0, 96000.0 };
+    Array<int> blockSizes { 64, 256, 1024 };
+    double secondsPerFile = 10.0;
+    //1.0 paces blocks like a real device would, 0.0 renders as fast as possible
+    double speed = 0.0;
+    int loadTimeoutMs = 10000;
+    Array<File> files;
+};
+
+struct RunResults
+{
+    std::vector<double> blockTimesMs;
+    //blocks rendered while waiting for a load, with nothing of the new file to play yet.  kept out of blockTimesMs
+    std::vector<double> loadingBlockTimesMs;
+    std::vector<double> loadLatenciesMs;
+    //blocks the processor found its source's read-ahead not ready for
+    uint64 numUnderruns = 0;
+    int numFailedLoads = 0;
+};
+
+//==============================================================================
+static double getPercentile(const std::vector<double>& sortedValues, double percentile)
+{
+    if( sortedValues.empty() )
+        return 0.0;
+
+    auto index = (size_t) jlimit(0.0,
+                                 (double) sortedValues.size() - 1.0,
+                                 std::ceil(percentile / 100.0 * (double) sortedValues.size()) - 1.0);
+    return sortedValues[index];
+}
+
+class ProcessorBenchmark
+{
+public:
+    ProcessorBenchmark(const BenchmarkOptions& o, double sr, int bs) :
+        options(o),
+        sampleRate(sr),
+        blockSize(bs),
+        blockDurationMs(1000.0 * bs / sr)
+    {
+        processor.setPlayConfigDetails(2, 2, sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+        buffer.setSize(jmax(processor.getTotalNumInputChannels(),
+                            processor.getTotalNumOutputChannels()),
+                       blockSize);
+
+        //new sources start playing as soon as they are published
+        processor.startTransport();
+    }
+
+    ~ProcessorBenchmark()
+    {
+        processor.stopTransport();
+        processor.releaseResources();
+    }
+
+    RunResults run()
+    {
+        RunResults results;
+        nextBlockDeadline = Time::getMillisecondCounterHiRes();
+        auto underrunsBefore = processor.telemetry.numUnderruns.load();
+
+        for( auto& file : options.files )
+            runFile(file, results);
+
+        //counted by processBlock itself, so a partly silent block isn't missed and a quiet file isn't mistaken for one
+        results.numUnderruns = processor.telemetry.numUnderruns.load() - underrunsBefore;
+        return results;
+    }
+
+private:
+    const BenchmarkOptions& options;
+    const double sampleRate;
+    const int blockSize;
+    const double blockDurationMs;
+
+    AudioFilePlayerAudioProcessor processor;
+    AudioBuffer<float> buffer;
+    MidiBuffer midi;
+    double nextBlockDeadline = 0.0;
+
+    void runFile(const File& file, RunResults& results)
+    {
+        URL url(file);
+        auto requestTime = Time::getMillisecondCounterHiRes();
+        processor.transportSourceCreator.requestTransportForURL(url);
+
+        //the first sample of the new file is rendered by the first block
+        //that runs after the creator has published its source
+        while( ! sourceIsPublishedFor(url) )
+        {
+            if( Time::getMillisecondCounterHiRes() - requestTime > options.loadTimeoutMs )
+            {
+                std::cerr << "  timed out loading " << file.getFullPathName() << std::endl;
+                ++results.numFailedLoads;
+                return;
+            }
+
+            renderBlock(results.loadingBlockTimesMs);
+
+            if( options.speed <= 0.0 )
+                Thread::yield();
+        }
+
+        renderBlock(results.blockTimesMs);
+        results.loadLatenciesMs.push_back(Time::getMillisecondCounterHiRes() - requestTime);
+
+        auto lastFullBlockStart = processor.getLengthInSeconds() - blockSize / sampleRate;
+        auto numBlocks = roundToInt(jmin(options.secondsPerFile, lastFullBlockStart) * sampleRate / blockSize);
+
+        for( int i = 0; i < numBlocks; ++i )
+            renderBlock(results.blockTimesMs);
+    }
+
+    bool sourceIsPublishedFor(const URL& url) const
+    {
+        auto src = processor.getCurrentSource();
+        return src != nullptr && src->currentAudioFile == url;
+    }
+
+    void renderBlock(std::vector<double>& blockTimesMs)
+    {
+        if( options.speed > 0.0 )
+        {
+            nextBlockDeadline += blockDurationMs / options.speed;
+            auto now = Time::getMillisecondCounterHiRes();
+            if( nextBlockDeadline > now )
+                Time::waitForMillisecondCounter((uint32) nextBlockDeadline);
+            else
+                nextBlockDeadline = now;
+        }
+
+        //the processor is a player, so the input is silence
+        buffer.clear();
+
+        auto start = Time::getHighResolutionTicks();
+        processor.processBlock(buffer, midi);
+        auto end = Time::getHighResolutionTicks();
+
+        blockTimesMs.push_back(Time::highResolutionTicksToSeconds(end - start) * 1000.0);
+    }
+};
+
+//==============================================================================
+static void printResults(RunResults& results, double sampleRate, int blockSize)
+{
+    auto blockDurationMs = 1000.0 * blockSize / sampleRate;
+
+    std::sort(results.blockTimesMs.begin(), results.blockTimesMs.end());
+    std::sort(results.loadingBlockTimesMs.begin(), results.loadingBlockTimesMs.end());
+    std::sort(results.loadLatenciesMs.begin(), results.loadLatenciesMs.end());
+
+    auto formatBlockTime = [&](double ms)
+    {
+        return String(ms * 1000.0, 1) + "us (" + String(100.0 * ms / blockDurationMs, 2) + "%)";
+    };
+
+    std::cout << String(sampleRate, 0) << " Hz, " << blockSize << " samples, "
+              << (int) results.blockTimesMs.size() << " blocks" << std::endl;
+
+    for( auto percentile : { 50.0, 90.0, 99.0, 99.9 } )
+        std::cout << "  block p" << String(percentile, percentile < 99.5 ? 0 : 1) << ": "
+                  << formatBlockTime(getPercentile(results.blockTimesMs, percentile)) << std::endl;
+
+    std::cout << "  block worst: "
+              << formatBlockTime(results.blockTimesMs.empty() ? 0.0 : results.blockTimesMs.back()) << std::endl;
+
+    std::cout << "  while loading: " << (int) results.loadingBlockTimesMs.size() << " blocks, p50 "
+              << formatBlockTime(getPercentile(results.loadingBlockTimesMs, 50.0)) << std::endl;
+
+    std::cout << "  load-to-first-sample p50/worst: "
+              << String(getPercentile(results.loadLatenciesMs, 50.0), 2) << "ms / "
+              << String(results.loadLatenciesMs.empty() ? 0.0 : results.loadLatenciesMs.back(), 2) << "ms"
+              << std::endl;
+
+    std::cout << "  underruns: " << (int64) results.numUnderruns << std::endl;
+
+    if( results.numFailedLoads > 0 )
+        std::cout << "  failed loads: " << results.numFailedLoads << std::endl;
+}
+
+//==============================================================================
+/*
+ Every resampling quality, and JUCE's ResamplingAudioSource for comparison, converting sines
+ between common pairs of rates.  SNR is a tone against everything else that comes out with it,
+ found by fitting a sine to the output.  The alias level is what comes out of a tone the output
+ rate can't represent, relative to what went in: ideally nothing at all.
+ */
+namespace ResamplerBenchmark
+{
+enum class Kind { browsing, playback, offline, juceResamplingAudioSource };
+
+static constexpr int blockSize = 512;
+
+static String getName(Kind kind)
+{
+    switch( kind )
+    {
+        case Kind::browsing: return "browsing";
+        case Kind::playback: return "playback";
+        case Kind::offline: return "offline";
+        case Kind::juceResamplingAudioSource: return "juce::ResamplingAudioSource";
+    }
+
+    return {};
+}
+
+static AudioBuffer<float> makeSine(double frequency, double sampleRate, int numSamples)
+{
+    AudioBuffer<float> sine(2, numSamples);
+    for( int i = 0; i < numSamples; ++i )
+    {
+        auto value = (float) (0.5 * std::sin(MathConstants<double>::twoPi * frequency * i / sampleRate));
+        sine.setSample(0, i, value);
+        sine.setSample(1, i, value);
+    }
+
+    return sine;
+}
+
+//the output for the whole of input, converted one block at a time, timing each block
+static AudioBuffer<float> render(Kind kind, AudioBuffer<float>& input, double inputRate, double outputRate, std::vector<double>& blockTimesMs)
+{
+    auto step = inputRate / outputRate;
+    auto numOutputSamples = (int) (input.getNumSamples() / step);
+    AudioBuffer<float> output(2, numOutputSamples);
+
+    std::unique_ptr<ResamplingKernel> offlineKernel;
+    MemoryAudioSource memorySource(input, false);
+    std::unique_ptr<AudioSource> realtimeSource;
+
+    if( kind == Kind::offline )
+    {
+        offlineKernel = std::make_unique<ResamplingKernel>(ResamplingQuality::offline, inputRate, outputRate);
+    }
+    else if( kind == Kind::juceResamplingAudioSource )
+    {
+        auto resampler = std::make_unique<ResamplingAudioSource>(&memorySource, false, 2);
+        resampler->setResamplingRatio(step);
+        realtimeSource = std::move(resampler);
+    }
+    else
+    {
+        auto quality = kind == Kind::browsing ? ResamplingQuality::browsing : ResamplingQuality::playback;
+        realtimeSource = std::make_unique<PolyphaseResamplingSource>(&memorySource, inputRate, quality);
+    }
+
+    if( realtimeSource != nullptr )
+        realtimeSource->prepareToPlay(blockSize, outputRate);
+
+    for( int position = 0; position < numOutputSamples; position += blockSize )
+    {
+        auto numSamples = jmin(blockSize, numOutputSamples - position);
+        auto start = Time::getHighResolutionTicks();
+
+        if( offlineKernel != nullptr )
+            offlineKernel->resample(input, step, output, position, numSamples);
+        else
+            realtimeSource->getNextAudioBlock(AudioSourceChannelInfo(&output, position, numSamples));
+
+        blockTimesMs.push_back(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1000.0);
+    }
+
+    return output;
+}
+
+//in dB.  the first and last few milliseconds are left out, where the filters are still filling
+static double measureSNR(const AudioBuffer<float>& output, double frequency, double sampleRate)
+{
+    auto margin = (int) (sampleRate * 0.01);
+    auto* samples = output.getReadPointer(0);
+    auto w = MathConstants<double>::twoPi * frequency / sampleRate;
+
+    //least squares fit of a * sin + b * cos
+    double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+    for( int i = margin; i < output.getNumSamples() - margin; ++i )
+    {
+        auto s = std::sin(w * i), c = std::cos(w * i);
+        ss += s * s; cc += c * c; sc += s * c;
+        ys += samples[i] * s; yc += samples[i] * c;
+    }
+
+    auto determinant = ss * cc - sc * sc;
+    auto a = (ys * cc - yc * sc) / determinant;
+    auto b = (yc * ss - ys * sc) / determinant;
+
+    double signal = 0, noise = 0;
+    for( int i = margin; i < output.getNumSamples() - margin; ++i )
+    {
+        auto fit = a * std::sin(w * i) + b * std::cos(w * i);
+        signal += fit * fit;
+        noise += (samples[i] - fit) * (samples[i] - fit);
+    }
+
+    return 10.0 * std::log10(signal / jmax(noise, 1.0e-30));
+}
+
+static double measureLevel(const AudioBuffer<float>& buffer, double sampleRate)
+{
+    auto margin = (int) (sampleRate * 0.01);
+    auto rms = buffer.getRMSLevel(0, margin, buffer.getNumSamples() - 2 * margin);
+    return Decibels::gainToDecibels((double) rms, -200.0);
+}
+
+static void run()
+{
+    const std::pair<double, double> conversions[] = { { 44100.0, 48000.0 }, { 48000.0, 44100.0 }, { 96000.0, 44100.0 }, { 44100.0, 96000.0 } };
+    const double inputSeconds = 2.0;
+
+    for( auto [inputRate, outputRate] : conversions )
+    {
+        auto blockDurationMs = 1000.0 * blockSize / outputRate;
+        auto topFrequency = 0.45 * jmin(inputRate, outputRate);
+        auto numInputSamples = (int) (inputRate * inputSeconds);
+
+        std::cout << String(inputRate, 0) << " Hz -> " << String(outputRate, 0) << " Hz, "
+                  << blockSize << " sample blocks" << std::endl;
+
+        for( auto kind : { Kind::browsing, Kind::playback, Kind::offline, Kind::juceResamplingAudioSource } )
+        {
+            std::vector<double> blockTimesMs;
+            String snrs;
+
+            for( auto frequency : { 1000.0, 10000.0, topFrequency } )
+            {
+                auto input = makeSine(frequency, inputRate, numInputSamples);
+                auto output = render(kind, input, inputRate, outputRate, blockTimesMs);
+                snrs << String(measureSNR(output, frequency, outputRate), 1) << " ";
+            }
+
+            //halfway between the two Nyquist frequencies, so only converting down can alias it
+            String aliasLevel = "n/a";
+            if( inputRate > outputRate )
+            {
+                auto input = makeSine(0.25 * (inputRate + outputRate), inputRate, numInputSamples);
+                std::vector<double> unused;
+                auto output = render(kind, input, inputRate, outputRate, unused);
+                aliasLevel = String(measureLevel(output, outputRate) - measureLevel(input, inputRate), 1) + " dB";
+            }
+
+            std::sort(blockTimesMs.begin(), blockTimesMs.end());
+            auto medianMs = getPercentile(blockTimesMs, 50.0);
+
+            std::cout << "  " << getName(kind).paddedRight(' ', 28)
+                      << " block p50: " << String(medianMs * 1000.0, 2) << "us (" << String(100.0 * medianMs / blockDurationMs, 3) << "%)"
+                      << "  SNR at 1k/10k/" << String(topFrequency / 1000.0, 1) << "k: " << snrs << "dB"
+                      << "  alias: " << aliasLevel << std::endl;
+        }
+    }
+}
+}
+
+//==============================================================================
+/*
+ Query latency over a synthetic library of numEntries files.  Their names are made of a small
+ vocabulary of sample library words, so a common word matches tens of thousands of them, as it
+ would in a real library.
+ */
+namespace SearchBenchmark
+{
+static constexpr int numEntries = 500000;
+static constexpr int numEntriesPerDirectory = 500;
+static constexpr int numRepeats = 20;
+
+static std::vector<LibraryIndex::Entry> makeEntries()
+{
+    const StringArray directoryWords { "drums", "vocals", "bass", "synth", "fx", "loops", "one shots", "foley", "keys", "guitar" };
+    const StringArray nameWords { "kick", "snare", "hat", "clap", "tom", "crash", "ride", "perc", "808", "909",
+                                  "vox", "pad", "lead", "pluck", "stab", "riser", "impact", "hit", "dry", "wet",
+                                  "tight", "punchy", "deep", "bright", "dark", "soft", "hard", "long", "short", "vintage" };
+
+    //nothing is read from it, so it doesn't have to exist
+    auto root = File::getCurrentWorkingDirectory().getChildFile("synthetic library");
+    Random random(1);
+    std::vector<LibraryIndex::Entry> entries((size_t) numEntries);
+
+    for( int i = 0; i < numEntries; ++i )
+    {
+        auto directory = directoryWords[random.nextInt(directoryWords.size())] + " " + String(i / numEntriesPerDirectory);
+        String name;
+        for( int numWords = 2 + random.nextInt(3); --numWords >= 0; )
+            name << nameWords[random.nextInt(nameWords.size())] << "_";
+
+        auto& entry = entries[(size_t) i];
+        entry.file = root.getChildFile(directory).getChildFile(name + String(i % numEntriesPerDirectory).paddedLeft('0', 3) + ".wav");
+        entry.formatName = "WAV file";
+        entry.sampleRate = random.nextBool() ? 44100.0 : 48000.0;
+        entry.numChannels = 1 + random.nextInt(2);
+        entry.lengthInSamples = (int64) (entry.sampleRate * (0.1 + 30.0 * random.nextDouble()));
+        entry.peakLevel = 1.0f;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.file.getFullPathName() < b.file.getFullPathName(); });
+    return entries;
+}
+
+static int run()
+{
+    auto buildStart = Time::getHighResolutionTicks();
+    LibrarySearch search(makeEntries());
+    auto buildMs = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - buildStart) * 1000.0;
+
+    std::cout << search.getNumFilesSearched() << " synthetic files, built and indexed in "
+              << String(buildMs, 0) << "ms" << std::endl;
+
+    //as typed, a character at a time, then some with conditions and typos
+    const char* queries[] = { "k", "ki", "kic", "kick", "kick 8", "kick 808", "punchy kick ch:1", "snare len:<1",
+                              "v", "vo", "vocals", "kikc", "snarw", "brigth", "xyzzy" };
+    double worstMs = 0;
+
+    for( auto* query : queries )
+    {
+        std::vector<double> timesMs;
+        size_t numResults = 0;
+        for( int i = 0; i < numRepeats; ++i )
+        {
+            auto start = Time::getHighResolutionTicks();
+            numResults = search.search(query).size();
+            timesMs.push_back(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1000.0);
+        }
+
+        std::sort(timesMs.begin(), timesMs.end());
+        worstMs = jmax(worstMs, timesMs.back());
+
+        std::cout << "  " << String(query).quoted().paddedRight(' ', 20)
+                  << " p50: " << String(getPercentile(timesMs, 50.0), 3) << "ms"
+                  << "  worst: " << String(timesMs.back(), 3) << "ms"
+                  << "  " << (int) numResults << " results" << std::endl;
+    }
+
+    std::cout << "worst query: " << String(worstMs, 3) << "ms" << std::endl;
+
+    //queries whose best result must be in a directory or have a name containing the second string
+    const std::pair<const char*, const char*> expectedResults[] = { { "kicj", "kick" }, { "lick", "kick" },
+                                                                    { "snarw", "snare" }, { "brighy", "bright" },
+                                                                    { "fo", "foley" }, { "gu", "guitar" } };
+    int numFailed = 0;
+
+    for( auto& [query, expected] : expectedResults )
+    {
+        auto results = search.search(query);
+        auto best = results.empty() ? File() : results.front().entry.file;
+
+        if( ! (best.getParentDirectory().getFileName() + "/" + best.getFileName()).toLowerCase().contains(expected) )
+        {
+            std::cout << "FAILED: " << String(query).quoted() << " didn't find " << String(expected).quoted() << std::endl;
+            ++numFailed;
+        }
+    }
+
+    return numFailed > 0 ? 1 : 0;
+}
+}
+
+template<typename T>
+static Array<T> parseList(const String& text)
+{
+    Array<T> values;
+    for( auto& token : StringArray::fromTokens(text, ",", {}) )
+    {
+        if( std::is_integral<T>::value )
+            values.add((T) token.getIntValue());
+        else
+            values.add((T) token.getDoubleValue());
+    }
+
+    return values;
+}
+
+static void printUsage()
+{
+    std::cout << "usage: AudioFilePlayerBenchmark [options] <audio files...>" << std::endl
+              << "  --sample-rates=44100,48000,96000" << std::endl
+              << "  --block-sizes=64,256,1024" << std::endl
+              << "  --seconds=10      audio rendered per file" << std::endl
+              << "  --speed=0         0 = offline, 1 = real time, 2 = twice real time..." << std::endl
+              << "  --load-timeout=10000" << std::endl
+              << "  --resampler       benchmarks the resampling qualities instead, in 512 sample blocks.  takes no files" << std::endl
+              << "  --search          times library searches over 500k synthetic files instead.  takes no files" << std::endl
+              << "exits with 1 if any file failed to load or any search missed, 2 if the read-ahead ever underran." << std::endl;
+}
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    ArgumentList args(argc, argv);
+
+    if( args.size() == 0 || args.containsOption("--help|-h") )
+    {
+        printUsage();
+        return 0;
+    }
+
+    if( args.containsOption("--resampler") )
+    {
+        ResamplerBenchmark::run();
+        return 0;
+    }
+
+    if( args.containsOption("--search") )
+    {
+        //the search's ChangeBroadcaster needs a MessageManager, like the processor's
+        ScopedJuceInitialiser_GUI juceInitialiser;
+        return SearchBenchmark::run();
+    }
+
+    BenchmarkOptions options;
+
+    if( args.containsOption("--sample-rates") )
+        options.sampleRates = parseList<double>(args.getValueForOption("--sample-rates"));
+    if( args.containsOption("--block-sizes") )
+        options.blockSizes = parseList<int>(args.getValueForOption("--block-sizes"));
+    if( args.containsOption("--seconds") )
+        options.secondsPerFile = args.getValueForOption("--seconds").getDoubleValue();
+    if( args.containsOption("--speed") )
+        options.speed = args.getValueForOption("--speed").getDoubleValue();
+    if( args.containsOption("--load-timeout") )
+        options.loadTimeoutMs = args.getValueForOption("--load-timeout").getIntValue();
+
+    for( auto& arg : args.arguments )
+    {
+        if( arg.isOption() )
+            continue;
+
+        auto file = arg.resolveAsFile();
+        if( file.existsAsFile() )
+            options.files.add(file);
+        else
+            std::cerr << "skipping " << file.getFullPathName() << ": no such file" << std::endl;
+    }
+
+    if( options.files.isEmpty() )
+    {
+        printUsage();
+        return 0;
+    }
+
+    //the processor's ChangeBroadcasters and AsyncUpdaters need a MessageManager
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    int numFailedLoads = 0;
+    uint64 numUnderruns = 0;
+
+    for( auto sampleRate : options.sampleRates )
+    {
+        for( auto blockSize : options.blockSizes )
+        {
+            RunResults results;
+            {
+                ProcessorBenchmark benchmark(options, sampleRate, blockSize);
+                results = benchmark.run();
+            }
+
+            printResults(results, sampleRate, blockSize);
+            numFailedLoads += results.numFailedLoads;
+            numUnderruns += results.numUnderruns;
+        }
+    }
+
+    if( numFailedLoads > 0 )
+        return 1;
+
+    return numUnderruns > 0 ? 2 : 0;
+}
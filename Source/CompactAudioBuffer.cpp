@@ -0,0 +1,348 @@
+/*
+  ==============================================================================
+
+    CompactAudioBuffer.cpp
+
+  ==============================================================================
+*/
+
+#include "CompactAudioBuffer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <immintrin.h>
+ #define COMPACT_AUDIO_USE_SSE 1
+ //the SSSE3 and F16C loops are compiled for those on their own, and only called if the CPU has them
+ #if JUCE_MSVC
+  #define COMPACT_AUDIO_SSSE3
+  #define COMPACT_AUDIO_F16C
+ #else
+  #define COMPACT_AUDIO_SSSE3 __attribute__((target("ssse3")))
+  #define COMPACT_AUDIO_F16C __attribute__((target("f16c")))
+ #endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+ #include <arm_neon.h>
+ #define COMPACT_AUDIO_USE_NEON 1
+#endif
+
+namespace
+{
+    //AudioFormatReader's own scaling: a 16 bit sample is its value over 2^15, a 24 bit one over 2^23
+    constexpr float int16Scale = 32768.0f;
+    constexpr float int24Scale = 8388608.0f;
+    
+    int toInteger(float sample, float scale) noexcept
+    {
+        return (int) std::lrint(jlimit(-scale, scale - 1.0f, sample * scale));
+    }
+    
+    //rounds to nearest, ties to even, the same as F16C does
+    uint16 floatToHalf(float value) noexcept
+    {
+        uint32 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        
+        auto sign = (uint32) ((bits >> 16) & 0x8000);
+        auto magnitude = bits & 0x7fffffff;
+        
+        //infinity and NaN, then anything that rounds past the largest half
+        if( magnitude >= 0x7f800000 )
+            return (uint16) (sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+        if( magnitude >= 0x477ff000 )
+            return (uint16) (sign | 0x7c00);
+        
+        //below the smallest normal half: a multiple of 2^-24, which may round up into the normals
+        if( magnitude < 0x38800000 )
+        {
+            float absolute;
+            std::memcpy(&absolute, &magnitude, sizeof(absolute));
+            return (uint16) (sign | (uint32) std::lrint(absolute * 16777216.0f));
+        }
+        
+        //rebias the exponent, and let a round up carry into it
+        auto half = (((magnitude >> 23) - 112) << 10) | ((magnitude >> 13) & 0x3ff);
+        auto dropped = magnitude & 0x1fff;
+        if( dropped > 0x1000 || (dropped == 0x1000 && (half & 1) != 0) )
+            ++half;
+        
+        return (uint16) (sign | half);
+    }
+    
+    float halfToFloat(uint16 half) noexcept
+    {
+        auto sign = (uint32) (half & 0x8000) << 16;
+        auto exponent = (uint32) (half >> 10) & 0x1f;
+        auto mantissa = (uint32) half & 0x3ff;
+        
+        if( exponent == 0 )
+        {
+            auto value = (float) mantissa * (1.0f / 16777216.0f);
+            return sign != 0 ? -value : value;
+        }
+        
+        auto bits = sign | (mantissa << 13) | (exponent == 0x1f ? 0x7f800000 : (exponent + 112) << 23);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    
+    int readInt24(const uint8* bytes) noexcept
+    {
+        //assembled in the top three bytes, so shifting back down sign extends it
+        auto bits = ((uint32) bytes[0] << 8) | ((uint32) bytes[1] << 16) | ((uint32) bytes[2] << 24);
+        return (int) bits >> 8;
+    }
+    
+    void writeInt24(uint8* bytes, int value) noexcept
+    {
+        bytes[0] = (uint8) value;
+        bytes[1] = (uint8) (value >> 8);
+        bytes[2] = (uint8) (value >> 16);
+    }
+    
+    //---------- the realtime side: one loop per encoding, vectorised where it can be ----------
+   #if COMPACT_AUDIO_USE_SSE
+    const bool cpuHasSSSE3 = SystemStats::hasSSSE3();
+    //F16C is VEX encoded, so it needs the OS to have enabled AVX too
+    const bool cpuHasF16C = SystemStats::hasAVX() && SystemStats::hasF16C();
+    
+    //these return how many samples they did, leaving the rest to the scalar loop
+    COMPACT_AUDIO_SSSE3 int readInt24sSSSE3(const uint8* source, float* dest, int numSamples, float scale) noexcept
+    {
+        //4 samples from each 16 byte load, so stop while the load still ends inside the buffer
+        const auto scales = _mm_set1_ps(scale);
+        const auto toTopBytes = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        int i = 0;
+        for( ; i + 6 <= numSamples; i += 4 )
+        {
+            auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 3 * i));
+            auto ints = _mm_srai_epi32(_mm_shuffle_epi8(bytes, toTopBytes), 8);
+            _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(ints), scales));
+        }
+        
+        return i;
+    }
+    
+    COMPACT_AUDIO_F16C int readHalvesF16C(const uint16* source, float* dest, int numSamples) noexcept
+    {
+        int i = 0;
+        for( ; i + 4 <= numSamples; i += 4 )
+            _mm_storeu_ps(dest + i, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i))));
+        
+        return i;
+    }
+    
+    COMPACT_AUDIO_F16C int writeHalvesF16C(const float* source, uint16* dest, int numSamples) noexcept
+    {
+        int i = 0;
+        for( ; i + 4 <= numSamples; i += 4 )
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + i), _mm_cvtps_ph(_mm_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT));
+        
+        return i;
+    }
+   #endif
+   
+    void readInt16(const int16* source, float* dest, int numSamples) noexcept
+    {
+        constexpr auto scale = 1.0f / int16Scale;
+        int i = 0;
+       
+       #if COMPACT_AUDIO_USE_SSE
+        const auto scales = _mm_set1_ps(scale);
+        for( ; i + 8 <= numSamples; i += 8 )
+        {
+            //each 16 bit sample doubled up to 32 bits, then shifted back down to sign extend it
+            auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            auto low = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+            auto high = _mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16);
+            _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scales));
+            _mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scales));
+        }
+       #elif COMPACT_AUDIO_USE_NEON
+        for( ; i + 8 <= numSamples; i += 8 )
+        {
+            auto packed = vld1q_s16(source + i);
+            vst1q_f32(dest + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(packed))), scale));
+            vst1q_f32(dest + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(packed))), scale));
+        }
+       #endif
+       
+        for( ; i < numSamples; ++i )
+            dest[i] = (float) source[i] * scale;
+    }
+    
+    void readInt24s(const uint8* source, float* dest, int numSamples) noexcept
+    {
+        constexpr auto scale = 1.0f / int24Scale;
+        int i = 0;
+       
+       #if COMPACT_AUDIO_USE_SSE
+        if( cpuHasSSSE3 )
+            i = readInt24sSSSE3(source, dest, numSamples, scale);
+       #elif COMPACT_AUDIO_USE_NEON
+        for( ; i + 8 <= numSamples; i += 8 )
+        {
+            //de-interleaves 8 samples into their low, middle and high bytes
+            auto bytes = vld3_u8(source + 3 * i);
+            auto low = vmovl_u8(bytes.val[0]);
+            auto middle = vmovl_u8(bytes.val[1]);
+            auto high = vmovl_u8(bytes.val[2]);
+            
+            auto assemble = [](uint16x4_t l, uint16x4_t m, uint16x4_t h)
+            {
+                auto bits = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(l), 8),
+                                                vshlq_n_u32(vmovl_u16(m), 16)),
+                                      vshlq_n_u32(vmovl_u16(h), 24));
+                return vcvtq_f32_s32(vshrq_n_s32(vreinterpretq_s32_u32(bits), 8));
+            };
+            
+            vst1q_f32(dest + i, vmulq_n_f32(assemble(vget_low_u16(low), vget_low_u16(middle), vget_low_u16(high)), scale));
+            vst1q_f32(dest + i + 4, vmulq_n_f32(assemble(vget_high_u16(low), vget_high_u16(middle), vget_high_u16(high)), scale));
+        }
+       #endif
+       
+        for( ; i < numSamples; ++i )
+            dest[i] = (float) readInt24(source + 3 * i) * scale;
+    }
+    
+    void readHalves(const uint16* source, float* dest, int numSamples) noexcept
+    {
+        int i = 0;
+       
+       #if COMPACT_AUDIO_USE_SSE
+        if( cpuHasF16C )
+            i = readHalvesF16C(source, dest, numSamples);
+       #elif COMPACT_AUDIO_USE_NEON && (defined(__aarch64__) || defined(_M_ARM64))
+        for( ; i + 4 <= numSamples; i += 4 )
+            vst1q_f32(dest + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(source + i))));
+       #endif
+       
+        for( ; i < numSamples; ++i )
+            dest[i] = halfToFloat(source[i]);
+    }
+}
+
+//==============================================================================
+void CompactAudioBuffer::setSize(int newNumChannels, int newNumSamples, SampleEncoding newEncoding)
+{
+    numChannels = jmax(0, newNumChannels);
+    numSamples = jmax(0, newNumSamples);
+    encoding = newEncoding;
+    data.calloc(jmax((size_t) 1, getSizeInBytes()));
+}
+
+int CompactAudioBuffer::getBytesPerSample(SampleEncoding encoding) noexcept
+{
+    switch( encoding )
+    {
+        case SampleEncoding::int16:
+        case SampleEncoding::float16:
+            return 2;
+        case SampleEncoding::int24:
+            return 3;
+        case SampleEncoding::float32:
+        default:
+            return 4;
+    }
+}
+
+size_t CompactAudioBuffer::getSizeInBytes(int numChannels, int64 numSamples, SampleEncoding encoding) noexcept
+{
+    return (size_t) jmax(0, numChannels) * (size_t) jmax((int64) 0, numSamples) * (size_t) getBytesPerSample(encoding);
+}
+
+SampleEncoding CompactAudioBuffer::chooseFor(const AudioFormatReader& reader, bool allowLossy) noexcept
+{
+    if( ! reader.usesFloatingPointData && reader.bitsPerSample <= 16 )
+        return SampleEncoding::int16;
+    
+    if( ! reader.usesFloatingPointData && reader.bitsPerSample <= 24 )
+        return SampleEncoding::int24;
+    
+    return allowLossy ? SampleEncoding::float16 : SampleEncoding::float32;
+}
+
+const char* CompactAudioBuffer::getChannel(int channel) const noexcept
+{
+    jassert(isPositiveAndBelow(channel, numChannels));
+    return data.get() + (size_t) channel * (size_t) numSamples * (size_t) getBytesPerSample(encoding);
+}
+
+char* CompactAudioBuffer::getChannel(int channel) noexcept
+{
+    return const_cast<char*>(static_cast<const CompactAudioBuffer&>(*this).getChannel(channel));
+}
+
+void CompactAudioBuffer::write(const AudioBuffer<float>& source, int sourceStartSample, int destStartSample, int numSamplesToWrite)
+{
+    jassert(destStartSample >= 0 && destStartSample + numSamplesToWrite <= numSamples);
+    jassert(sourceStartSample >= 0 && sourceStartSample + numSamplesToWrite <= source.getNumSamples());
+    
+    for( int ch = 0; ch < jmin(numChannels, source.getNumChannels()); ++ch )
+    {
+        auto* in = source.getReadPointer(ch, sourceStartSample);
+        auto* out = getChannel(ch);
+        
+        switch( encoding )
+        {
+            case SampleEncoding::int16:
+            {
+                auto* samples = reinterpret_cast<int16*>(out) + destStartSample;
+                for( int i = 0; i < numSamplesToWrite; ++i )
+                    samples[i] = (int16) toInteger(in[i], int16Scale);
+                break;
+            }
+            case SampleEncoding::int24:
+            {
+                auto* bytes = reinterpret_cast<uint8*>(out) + 3 * (size_t) destStartSample;
+                for( int i = 0; i < numSamplesToWrite; ++i )
+                    writeInt24(bytes + 3 * i, toInteger(in[i], int24Scale));
+                break;
+            }
+            case SampleEncoding::float16:
+            {
+                auto* samples = reinterpret_cast<uint16*>(out) + destStartSample;
+                int i = 0;
+               #if COMPACT_AUDIO_USE_SSE
+                if( cpuHasF16C )
+                    i = writeHalvesF16C(in, samples, numSamplesToWrite);
+               #endif
+                for( ; i < numSamplesToWrite; ++i )
+                    samples[i] = floatToHalf(in[i]);
+                break;
+            }
+            case SampleEncoding::float32:
+            default:
+                std::memcpy(reinterpret_cast<float*>(out) + destStartSample, in, (size_t) numSamplesToWrite * sizeof(float));
+                break;
+        }
+    }
+}
+
+void CompactAudioBuffer::read(int channel, int startSample, float* dest, int numSamplesToRead) const noexcept
+{
+    jassert(startSample >= 0 && startSample + numSamplesToRead <= numSamples);
+    auto* in = getChannel(channel);
+    
+    switch( encoding )
+    {
+        case SampleEncoding::int16:
+            readInt16(reinterpret_cast<const int16*>(in) + startSample, dest, numSamplesToRead);
+            break;
+        case SampleEncoding::int24:
+            readInt24s(reinterpret_cast<const uint8*>(in) + 3 * (size_t) startSample, dest, numSamplesToRead);
+            break;
+        case SampleEncoding::float16:
+            readHalves(reinterpret_cast<const uint16*>(in) + startSample, dest, numSamplesToRead);
+            break;
+        case SampleEncoding::float32:
+        default:
+            std::memcpy(dest, reinterpret_cast<const float*>(in) + startSample, (size_t) numSamplesToRead * sizeof(float));
+            break;
+    }
+}
+
+void CompactAudioBuffer::read(AudioBuffer<float>& dest, int destStartSample, int startSample, int numSamplesToRead) const noexcept
+{
+    for( int ch = 0; ch < jmin(numChannels, dest.getNumChannels()); ++ch )
+        read(ch, startSample, dest.getWritePointer(ch, destStartSample), numSamplesToRead);
+}
@@ -0,0 +1,71 @@
+/*
+  ==============================================================================
+
+    CompactAudioBuffer.h
+    Audio held in memory as 16 or 24 bit integers or half floats, and turned
+    back into floats as it is read.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+//==============================================================================
+enum class SampleEncoding
+{
+    float32,
+    //exact for files of up to 16 bits.  half the size of float32
+    int16,
+    //exact for files of up to 24 bits, packed into 3 bytes
+    int24,
+    //about 66 dB below each sample.  good enough to audition a lossy file, but not exact
+    float16
+};
+
+/*
+ A fixed size block of samples in one of the SampleEncodings, each channel stored contiguously.
+ 
+ Integers are scaled the same way AudioFormatReader turns them into floats, so a file decoded to
+ float and written as the integers it came from reads back bit for bit the same.
+ 
+ read() is realtime safe, and converts with SSE2 or NEON where the build has them, and with
+ SSSE3 and F16C when the CPU has those.
+ write() is for whoever fills the buffer before anyone reads it, and isn't.
+ */
+struct CompactAudioBuffer
+{
+    CompactAudioBuffer() = default;
+    
+    //clears it to silence
+    void setSize(int numChannels, int numSamples, SampleEncoding encoding);
+    
+    int getNumChannels() const noexcept { return numChannels; }
+    int getNumSamples() const noexcept { return numSamples; }
+    SampleEncoding getEncoding() const noexcept { return encoding; }
+    size_t getSizeInBytes() const noexcept { return getSizeInBytes(numChannels, numSamples, encoding); }
+    
+    //samples outside -1..1 are clipped in the integer encodings
+    void write(const AudioBuffer<float>& source, int sourceStartSample, int destStartSample, int numSamplesToWrite);
+    
+    void read(int channel, int startSample, float* dest, int numSamplesToRead) const noexcept;
+    //every channel they both have
+    void read(AudioBuffer<float>& dest, int destStartSample, int startSample, int numSamplesToRead) const noexcept;
+    
+    static int getBytesPerSample(SampleEncoding encoding) noexcept;
+    static size_t getSizeInBytes(int numChannels, int64 numSamples, SampleEncoding encoding) noexcept;
+    
+    //the smallest encoding that holds what the reader decodes exactly, or half floats if allowLossy and nothing smaller would be exact
+    static SampleEncoding chooseFor(const AudioFormatReader& reader, bool allowLossy) noexcept;
+private:
+    int numChannels { 0 }, numSamples { 0 };
+    SampleEncoding encoding { SampleEncoding::float32 };
+    HeapBlock<char> data;
+    
+    const char* getChannel(int channel) const noexcept;
+    char* getChannel(int channel) noexcept;
+    
+    JUCE_DECLARE_NON_COPYABLE(CompactAudioBuffer)
+};
@@ -0,0 +1,338 @@
+/*
+  ==============================================================================
+
+    DecodedAudioCache.cpp
+
+  ==============================================================================
+*/
+
+#include "DecodedAudioCache.h"
+
+void DecodedAudioSource::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    auto& samples = audio->samples;
+    auto totalLength = (int64) samples.getNumSamples();
+    auto numSourceChannels = samples.getNumChannels();
+    auto& dest = *info.buffer;
+    
+    auto pos = nextPlayPos.load();
+    int numDone = 0;
+    
+    while( numDone < info.numSamples )
+    {
+        if( looping && totalLength > 0 )
+            pos %= totalLength;
+        
+        auto numRemaining = info.numSamples - numDone;
+        
+        //before the start or past the end: silence
+        if( pos < 0 || pos >= totalLength || numSourceChannels == 0 )
+        {
+            auto numSilent = pos < 0 ? (int) jmin((int64) numRemaining, -pos) : numRemaining;
+            for( int ch = 0; ch < dest.getNumChannels(); ++ch )
+                dest.clear(ch, info.startSample + numDone, numSilent);
+            
+            numDone += numSilent;
+            pos += numSilent;
+            continue;
+        }
+        
+        auto numToCopy = (int) jmin((int64) numRemaining, totalLength - pos);
+        for( int ch = 0; ch < dest.getNumChannels(); ++ch )
+        {
+            samples.read(jmin(ch, numSourceChannels - 1),
+                         (int) pos,
+                         dest.getWritePointer(ch, info.startSample + numDone),
+                         numToCopy);
+        }
+        
+        numDone += numToCopy;
+        pos += numToCopy;
+    }
+    
+    nextPlayPos.store(pos);
+}
+//==============================================================================
+
+DecodedAudioCache::DecodedAudioCache(size_t maxSizeInBytes) : maxBytes(maxSizeInBytes)
+{
+    memoryGovernor->addHolder(this);
+}
+
+DecodedAudioCache::~DecodedAudioCache()
+{
+    memoryGovernor->removeHolder(this);
+}
+
+void DecodedAudioCache::setMaxSizeInBytes(size_t newMaxSize)
+{
+    const ScopedLock sl(lock);
+    maxBytes = newMaxSize;
+    evictUntilThereIsRoomFor(0);
+}
+
+size_t DecodedAudioCache::getMaxSizeInBytes() const
+{
+    const ScopedLock sl(lock);
+    return maxBytes;
+}
+
+size_t DecodedAudioCache::getSizeInBytes() const
+{
+    const ScopedLock sl(lock);
+    return currentBytes;
+}
+
+DecodedAudio::Ptr DecodedAudioCache::find(const File& file)
+{
+    auto path = getCanonicalPath(file);
+    auto modificationTime = file.getLastModificationTime();
+    auto fileSize = file.getSize();
+    
+    const ScopedLock sl(lock);
+    auto it = findEntry(path);
+    if( it == entries.end() )
+        return nullptr;
+    
+    //the file has been rewritten since it was decoded
+    if( it->modificationTime != modificationTime || it->fileSize != fileSize )
+    {
+        removeEntry(it);
+        return nullptr;
+    }
+    
+    entries.splice(entries.begin(), entries, it);
+    return entries.front().audio;
+}
+
+void DecodedAudioCache::add(const File& file, DecodedAudio::Ptr audio)
+{
+    if( audio == nullptr )
+        return;
+    
+    Entry entry;
+    entry.path = getCanonicalPath(file);
+    entry.modificationTime = file.getLastModificationTime();
+    entry.fileSize = file.getSize();
+    entry.audio = audio;
+    
+    const ScopedLock sl(lock);
+    auto numBytes = audio->getSizeInBytes();
+    if( numBytes > maxBytes )
+        return;
+    
+    auto existing = findEntry(entry.path);
+    if( existing != entries.end() )
+        removeEntry(existing);
+    
+    evictUntilThereIsRoomFor(numBytes);
+    entries.push_front(std::move(entry));
+    currentBytes += numBytes;
+}
+
+std::unique_ptr<DecodedAudioCache::DecodeClaim> DecodedAudioCache::claimDecode(const File& file)
+{
+    auto path = getCanonicalPath(file);
+    
+    const ScopedLock sl(lock);
+    if( decodesInProgress.contains(path) || findEntry(path) != entries.end() )
+        return nullptr;
+    
+    decodesInProgress.add(path);
+    return std::make_unique<DecodeClaim>(*this, path);
+}
+
+String DecodedAudioCache::getCanonicalPath(const File& file)
+{
+    return file.getLinkedTarget().getFullPathName();
+}
+
+bool DecodedAudioCache::canHold(size_t numBytes) const
+{
+    if( memoryGovernor->isUnderPressure() )
+        return false;
+    
+    const ScopedLock sl(lock);
+    return numBytes <= maxBytes;
+}
+
+void DecodedAudioCache::clear()
+{
+    const ScopedLock sl(lock);
+    entries.clear();
+    currentBytes = 0;
+}
+
+std::list<DecodedAudioCache::Entry>::iterator DecodedAudioCache::findEntry(const String& canonicalPath)
+{
+    return std::find_if(entries.begin(),
+                        entries.end(),
+                        [&canonicalPath](const auto& entry)
+                        {
+                            return entry.path == canonicalPath;
+                        });
+}
+
+void DecodedAudioCache::removeEntry(std::list<Entry>::iterator it)
+{
+    currentBytes -= it->audio->getSizeInBytes();
+    entries.erase(it);
+}
+
+void DecodedAudioCache::evictUntilThereIsRoomFor(size_t numBytes)
+{
+    while( ! entries.empty() && currentBytes + numBytes > maxBytes )
+        removeEntry(std::prev(entries.end()));
+}
+
+void DecodedAudioCache::addUsage(MemoryGovernor::Report& report) const
+{
+    //shared by every instance, so it isn't anyone's in particular
+    const ScopedLock sl(lock);
+    report.add(MemoryUse::decodedCache, currentBytes);
+}
+
+void DecodedAudioCache::freeMemory(MemoryUse use, size_t numBytes)
+{
+    if( use != MemoryUse::decodedCache )
+        return;
+    
+    //evicting audio that is still being played frees nothing, so those entries are left alone
+    std::vector<DecodedAudio::Ptr> evicted;
+    size_t numFreed = 0;
+    {
+        const ScopedLock sl(lock);
+        for( auto it = entries.end(); it != entries.begin() && numFreed < numBytes; )
+        {
+            --it;
+            if( it->audio->getReferenceCount() > 1 )
+                continue;
+            
+            numFreed += it->audio->getSizeInBytes();
+            evicted.push_back(it->audio);
+            
+            auto next = std::next(it);
+            removeEntry(it);
+            it = next;
+        }
+    }
+    
+    //deleted outside the lock, so finds aren't held up by it
+    evicted.clear();
+}
+
+void DecodedAudioCache::releaseClaim(const String& canonicalPath)
+{
+    const ScopedLock sl(lock);
+    decodesInProgress.removeString(canonicalPath);
+}
+//==============================================================================
+DecodedAudioFill::Ptr DecodedAudioFill::start(const File& file, const AudioFormatReader& reader, DecodedAudioCache& cache, size_t maxNumBytes)
+{
+    auto numChannels = (int) reader.numChannels;
+    auto length = reader.lengthInSamples;
+    auto encoding = CompactAudioBuffer::chooseFor(reader, cache.allowsLossyEncoding());
+    auto numBytes = CompactAudioBuffer::getSizeInBytes(numChannels, length, encoding);
+    
+    if( numChannels <= 0 || length <= 0 || length > std::numeric_limits<int>::max() || numBytes > maxNumBytes
+        || ! cache.canHold(numBytes) || ! SharedResourcePointer<MemoryGovernor>()->canFit(numBytes) )
+        return nullptr;
+    
+    auto claim = cache.claimDecode(file);
+    if( claim == nullptr )
+        return nullptr;
+    
+    DecodedAudio::Ptr decoded = new DecodedAudio();
+    decoded->sampleRate = reader.sampleRate;
+    decoded->fileSampleRate = reader.sampleRate;
+    decoded->fileLengthInSamples = length;
+    decoded->samples.setSize(numChannels, (int) length, encoding);
+    
+    return new DecodedAudioFill(cache, file, std::move(claim), decoded);
+}
+
+DecodedAudioFill::DecodedAudioFill(DecodedAudioCache& c, const File& f, std::unique_ptr<DecodedAudioCache::DecodeClaim> decodeClaim, DecodedAudio::Ptr d) :
+cache(c),
+file(f),
+claim(std::move(decodeClaim)),
+decoded(d),
+numRegions((int) ((decoded->fileLengthInSamples + regionSizeInSamples - 1) / regionSizeInSamples)),
+regionIsClaimed(new std::atomic<bool>[(size_t) numRegions]),
+regionSamplesAdded(new std::atomic<int64>[(size_t) numRegions])
+{
+    for( int i = 0; i < numRegions; ++i )
+    {
+        regionIsClaimed[(size_t) i].store(false);
+        regionSamplesAdded[(size_t) i].store(0);
+    }
+    
+    numBytesCounted = decoded->getSizeInBytes();
+    memoryGovernor->addCountedBytes(MemoryUse::decoding, numBytesCounted);
+}
+
+DecodedAudioFill::~DecodedAudioFill()
+{
+    memoryGovernor->removeCountedBytes(MemoryUse::decoding, numBytesCounted);
+}
+
+Range<int64> DecodedAudioFill::getRegionRange(int region) const noexcept
+{
+    auto start = (int64) region * regionSizeInSamples;
+    return { start, jmin(start + regionSizeInSamples, decoded->fileLengthInSamples) };
+}
+
+bool DecodedAudioFill::tryClaimRegion(int region) noexcept
+{
+    if( region < 0 || region >= numRegions || isAbandoned() )
+        return false;
+    
+    return ! regionIsClaimed[(size_t) region].exchange(true);
+}
+
+void DecodedAudioFill::abandonRegion(int region) noexcept
+{
+    if( region < 0 || region >= numRegions )
+        return;
+    
+    //a finished region stays claimed, so nobody fills it again
+    if( regionSamplesAdded[(size_t) region].load() == getRegionRange(region).getLength() )
+        return;
+    
+    regionSamplesAdded[(size_t) region].store(0);
+    regionIsClaimed[(size_t) region].store(false);
+}
+
+void DecodedAudioFill::abandon()
+{
+    const ScopedLock sl(lock);
+    abandoned.store(true);
+    claim.reset();
+}
+
+void DecodedAudioFill::addSamples(const AudioBuffer<float>& source, int sourceStartSample, int64 startSample, int numSamples)
+{
+    if( isAbandoned() || numSamples <= 0 )
+        return;
+    
+    auto region = getRegionContaining(startSample);
+    auto range = getRegionRange(region);
+    auto& numAdded = regionSamplesAdded[(size_t) region];
+    jassert(regionIsClaimed[(size_t) region].load());
+    jassert(startSample == range.getStart() + numAdded.load() && startSample + numSamples <= range.getEnd());
+    
+    decoded->samples.write(source, sourceStartSample, (int) startSample, numSamples);
+    numAdded.store(numAdded.load() + numSamples);
+    
+    if( numAdded.load() < range.getLength() || numRegionsComplete.fetch_add(1) + 1 < numRegions )
+        return;
+    
+    //the last region.  only one writer ever gets here, and only once
+    const ScopedLock sl(lock);
+    if( isAbandoned() )
+        return;
+    
+    cache.add(file, decoded);
+    claim.reset();
+    memoryGovernor->removeCountedBytes(MemoryUse::decoding, numBytesCounted);
+    numBytesCounted = 0;
+}
@@ -0,0 +1,216 @@
+/*
+  ==============================================================================
+
+    DecodedAudioCache.h
+    An in-RAM, byte-bounded LRU cache of fully decoded audio files.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MemoryGovernor.h"
+#include "CompactAudioBuffer.h"
+
+using namespace juce;
+//==============================================================================
+struct DecodedAudio : juce::ReferenceCountedObject
+{
+    using Ptr = juce::ReferenceCountedObjectPtr<DecodedAudio>;
+    
+    //never modified once it has been added to the cache.  as small as the file's bit depth allows
+    CompactAudioBuffer samples;
+    double sampleRate { 0 };
+    
+    //the file's own.  different from the above when it was converted to the host's rate as it was cached
+    double fileSampleRate { 0 };
+    int64 fileLengthInSamples { 0 };
+    
+    bool isAtFileRate() const { return sampleRate == fileSampleRate; }
+    
+    size_t getSizeInBytes() const { return samples.getSizeInBytes(); }
+};
+//==============================================================================
+/*
+ Plays a DecodedAudio without copying it.  Each instance has its own playhead, so any number of
+ these can share the same decoded samples, which are turned back into floats as they are played.
+ Mono files are copied to every output channel, the same way AudioFormatReader::read does.
+ */
+struct DecodedAudioSource : PositionableAudioSource
+{
+    explicit DecodedAudioSource(DecodedAudio::Ptr audioToPlay) : audio(audioToPlay) { jassert(audio != nullptr); }
+    
+    void prepareToPlay(int, double) override {}
+    void releaseResources() override {}
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+    
+    void setNextReadPosition(int64 newPosition) override { nextPlayPos.store(newPosition); }
+    int64 getNextReadPosition() const override { return nextPlayPos.load(); }
+    int64 getTotalLength() const override { return audio->samples.getNumSamples(); }
+    bool isLooping() const override { return looping; }
+    void setLooping(bool shouldLoop) override { looping = shouldLoop; }
+private:
+    DecodedAudio::Ptr audio;
+    std::atomic<int64> nextPlayPos { 0 };
+    bool looping { false };
+};
+//==============================================================================
+/*
+ Shared by every plugin instance in the process (use it through a SharedResourcePointer), so a
+ file that several instances play is decoded and held in memory only once.  Each instance plays
+ the shared samples through its own DecodedAudioSource.
+ 
+ Entries are keyed by canonical path (symlinks resolved) and invalidated as soon as the file's
+ modification time or size no longer matches what was decoded.  Thread safe.
+ 
+ Samples are stored as compactly as they can be exactly: 16 and 24 bit files as the integers they
+ were, so they take a half or three quarters of the space.  Allowing lossy encoding stores
+ everything else (floating point and lossy files, and audio converted to the host's rate) as half
+ floats, which is plenty for auditioning and halves their size too.
+ 
+ Counts towards the MemoryGovernor's cap.  Over it, entries nothing is playing are evicted, least
+ recently used first, and nothing new is decoded into the cache until it is back under.
+ */
+struct DecodedAudioCache : private MemoryGovernor::Holder
+{
+    DecodedAudioCache() : DecodedAudioCache(defaultMaxSizeInBytes) { }
+    explicit DecodedAudioCache(size_t maxSizeInBytes);
+    ~DecodedAudioCache() override;
+    
+    static constexpr size_t defaultMaxSizeInBytes = 512 * 1024 * 1024;
+    
+    void setMaxSizeInBytes(size_t newMaxSize);
+    size_t getMaxSizeInBytes() const;
+    size_t getSizeInBytes() const;
+    
+    //returns nullptr on a miss.  a hit becomes the most recently used entry.
+    DecodedAudio::Ptr find(const File& file);
+    
+    //evicts least recently used entries until the new one fits
+    void add(const File& file, DecodedAudio::Ptr audio);
+    
+    //false for anything while the process is over its memory cap
+    bool canHold(size_t numBytes) const;
+    
+    //only applies to what is decoded from now on
+    void setAllowsLossyEncoding(bool shouldAllow) { lossyEncodingAllowed.store(shouldAllow); }
+    bool allowsLossyEncoding() const { return lossyEncodingAllowed.load(); }
+    
+    void clear();
+    
+    /*
+     Held by whoever is decoding a file into the cache, so other instances don't decode it too.
+     Released when it is deleted, whether or not the decode finished.
+     */
+    struct DecodeClaim
+    {
+        DecodeClaim(DecodedAudioCache& c, const String& path) : cache(c), canonicalPath(path) { }
+        ~DecodeClaim() { cache.releaseClaim(canonicalPath); }
+    private:
+        DecodedAudioCache& cache;
+        String canonicalPath;
+        JUCE_DECLARE_NON_COPYABLE(DecodeClaim)
+    };
+    
+    //nullptr if the file is already cached, or another instance is already decoding it
+    std::unique_ptr<DecodeClaim> claimDecode(const File& file);
+    
+    static String getCanonicalPath(const File& file);
+private:
+    struct Entry
+    {
+        String path;
+        Time modificationTime;
+        int64 fileSize { 0 };
+        DecodedAudio::Ptr audio;
+    };
+    
+    CriticalSection lock;
+    std::list<Entry> entries; //most recently used at the front
+    StringArray decodesInProgress;
+    size_t maxBytes { 0 }, currentBytes { 0 };
+    std::atomic<bool> lossyEncodingAllowed { false };
+    
+    SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    
+    void addUsage(MemoryGovernor::Report& report) const override;
+    void freeMemory(MemoryUse use, size_t numBytes) override;
+    
+    std::list<Entry>::iterator findEntry(const String& canonicalPath);
+    void removeEntry(std::list<Entry>::iterator it);
+    void evictUntilThereIsRoomFor(size_t numBytes);
+    void releaseClaim(const String& canonicalPath);
+    
+    JUCE_DECLARE_NON_COPYABLE(DecodedAudioCache)
+};
+//==============================================================================
+/*
+ A long file's DecodedAudio, filled a region at a time by whatever decodes that part of the file
+ anyway: its StreamingDecoderSource as it plays, and a background decode for the rest (see
+ AudioFormatReaderSourceCreator).  Each region is filled front to back by whichever of them claims
+ it first, so no part of the file is decoded twice for the cache.  Samples are packed into the
+ cache's encoding as they are added, so the file is never held as floats.
+ 
+ It holds the file's DecodeClaim, and is counted as MemoryUse::decoding, until its last region is
+ complete.  Then it is added to the cache, on whichever thread completed it.
+ */
+struct DecodedAudioFill : juce::ReferenceCountedObject
+{
+    using Ptr = juce::ReferenceCountedObjectPtr<DecodedAudioFill>;
+    
+    /*
+     nullptr if the file is already cached or being decoded, if it would pack to more than maxNumBytes,
+     or if the cache or the governor has no room for it.  reader must be reading file.
+     */
+    static Ptr start(const File& file, const AudioFormatReader& reader, DecodedAudioCache& cache, size_t maxNumBytes);
+    ~DecodedAudioFill() override;
+    
+    const File& getFile() const noexcept { return file; }
+    int getNumChannels() const noexcept { return decoded->samples.getNumChannels(); }
+    int getNumRegions() const noexcept { return numRegions; }
+    Range<int64> getRegionRange(int region) const noexcept;
+    int getRegionContaining(int64 sample) const noexcept { return (int) (sample / regionSizeInSamples); }
+    
+    //---------- writers ----------
+    //only the writer that claimed a region may add its samples
+    bool tryClaimRegion(int region) noexcept;
+    //for a writer that stops part way through a region, so someone else can start it again
+    void abandonRegion(int region) noexcept;
+    
+    /*
+     packs numSamples of source, starting at sourceStartSample, as the file's samples from startSample.
+     they must carry on from whatever was last added to the region, and not run past its end.
+     different threads may add different regions at the same time.
+     */
+    void addSamples(const AudioBuffer<float>& source, int sourceStartSample, int64 startSample, int numSamples);
+    
+    bool isComplete() const noexcept { return numRegionsComplete.load() >= numRegions; }
+    //any thread.  nothing more is added and it is never cached, so its writers can let go of it.
+    //the claim goes straight away, so the file can be decoded again without waiting for them
+    void abandon();
+    bool isAbandoned() const noexcept { return abandoned.load(); }
+    
+    //the same as a WaveformPyramid's, so a writer can feed both a region at a time
+    static constexpr int64 regionSizeInSamples = 64 * 4096;
+private:
+    DecodedAudioFill(DecodedAudioCache& cache, const File& file, std::unique_ptr<DecodedAudioCache::DecodeClaim> claim, DecodedAudio::Ptr decoded);
+    
+    DecodedAudioCache& cache;
+    const File file;
+    std::unique_ptr<DecodedAudioCache::DecodeClaim> claim;
+    const DecodedAudio::Ptr decoded;
+    const int numRegions;
+    
+    std::unique_ptr<std::atomic<bool>[]> regionIsClaimed;
+    std::unique_ptr<std::atomic<int64>[]> regionSamplesAdded;
+    std::atomic<int> numRegionsComplete { 0 };
+    //guards claim, and the last region being added against abandon()
+    CriticalSection lock;
+    std::atomic<bool> abandoned { false };
+    
+    SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    size_t numBytesCounted { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE(DecodedAudioFill)
+};
@@ -0,0 +1,392 @@
+/*
+  ==============================================================================
+
+    LibraryBrowser.cpp
+
+  ==============================================================================
+*/
+
+#include "LibraryBrowser.h"
+
+struct LibraryBrowser::Node
+{
+    File file;
+    bool isDirectory = false;
+    //the root's children are at depth 0
+    int depth = -1;
+    bool isOpen = false;
+    //from asking the Lister for a listing until it arrives
+    bool isBeingListed = false;
+    //children are from an actual listing, not from the index
+    bool hasBeenListed = false;
+    //kept when the directory is closed, so opening it again shows them straight away
+    std::vector<std::unique_ptr<Node>> children;
+};
+
+struct LibraryBrowser::Listing
+{
+    File directory;
+    Array<File> subdirectories, files;
+};
+
+//lists up to maxEntriesPerSlice entries per time slice, so a huge directory doesn't hold up the
+//release pool, the memory governor and the other clients of the scan thread
+struct LibraryBrowser::Lister : TimeSliceClient
+{
+    Lister (LibraryBrowser& o, TimeSliceThread& t) : owner (o), thread (t)
+    {
+        thread.addTimeSliceClient (this);
+    }
+    
+    //waits for a listing in progress
+    ~Lister() override
+    {
+        thread.removeTimeSliceClient (this);
+    }
+    
+    void list (const File& directory)
+    {
+        {
+            const ScopedLock sl (lock);
+            pending.addIfNotAlreadyThere (directory);
+        }
+        
+        thread.moveToFrontOfQueue (this);
+    }
+    
+    std::vector<Listing> takeFinished()
+    {
+        const ScopedLock sl (lock);
+        std::vector<Listing> listings;
+        std::swap (listings, finished);
+        return listings;
+    }
+    
+    int useTimeSlice() override
+    {
+        if (current == nullptr)
+        {
+            const ScopedLock sl (lock);
+            if (pending.isEmpty())
+                return idleIntervalMs;
+            
+            current = std::make_unique<Listing>();
+            current->directory = pending.removeAndReturn (0);
+            iterator = RangedDirectoryIterator (current->directory, false, "*", File::findFilesAndDirectories | File::ignoreHiddenFiles);
+        }
+        
+        for (int i = 0; i < maxEntriesPerSlice && iterator != RangedDirectoryIterator(); ++i, ++iterator)
+        {
+            auto& entry = *iterator;
+            if (entry.isDirectory())
+                current->subdirectories.add (entry.getFile());
+            else if (owner.audioFileFilter.isFileSuitable (entry.getFile()))
+                current->files.add (entry.getFile());
+        }
+        
+        if (iterator != RangedDirectoryIterator())
+            return busyIntervalMs;
+        
+        {
+            const ScopedLock sl (lock);
+            finished.push_back (std::move (*current));
+        }
+        
+        current.reset();
+        owner.triggerAsyncUpdate();
+        return 0;
+    }
+    
+    static constexpr int idleIntervalMs = 200;
+    static constexpr int maxEntriesPerSlice = 1000;
+    static constexpr int busyIntervalMs = 1;
+private:
+    LibraryBrowser& owner;
+    TimeSliceThread& thread;
+    
+    CriticalSection lock;
+    Array<File> pending;
+    std::vector<Listing> finished;
+    
+    //the listing in progress, only touched on the scan thread
+    std::unique_ptr<Listing> current;
+    RangedDirectoryIterator iterator;
+};
+
+//==============================================================================
+LibraryBrowser::LibraryBrowser (const File& rootDirectory, const String& audioFileWildcard)
+: audioFileFilter (audioFileWildcard, "*", "audio files"),
+  root (std::make_unique<Node>())
+{
+    root->file = rootDirectory;
+    root->isDirectory = true;
+    
+    lister = std::make_unique<Lister> (*this, ioScheduler->getDirectoryScanThread());
+    libraryIndex->changes.addChangeListener (this);
+    
+    addAndMakeVisible (listBox);
+    listBox.setRowHeight (20);
+    listBox.setColour (ListBox::backgroundColourId, Colours::lightgrey.withAlpha (0.6f));
+    
+    setOpen (*root, true);
+}
+
+LibraryBrowser::~LibraryBrowser()
+{
+    lister.reset();
+    cancelPendingUpdate();
+    libraryIndex->changes.removeChangeListener (this);
+}
+
+File LibraryBrowser::getSelectedFile() const
+{
+    auto row = listBox.getSelectedRow();
+    if (! isPositiveAndBelow (row, (int) rows.size()))
+        return {};
+    
+    return rows[(size_t) row]->file;
+}
+
+Array<URL> LibraryBrowser::getFilesNextToSelection (int maxDistance) const
+{
+    Array<URL> neighbours;
+    auto row = listBox.getSelectedRow();
+    if (! isPositiveAndBelow (row, (int) rows.size()))
+        return neighbours;
+    
+    for (int distance = 1; distance <= maxDistance; ++distance)
+    {
+        for (auto neighbourRow : { row - distance, row + distance })
+        {
+            if (isPositiveAndBelow (neighbourRow, (int) rows.size()) && ! rows[(size_t) neighbourRow]->isDirectory)
+                neighbours.add (URL (rows[(size_t) neighbourRow]->file));
+        }
+    }
+    
+    return neighbours;
+}
+
+void LibraryBrowser::resized()
+{
+    listBox.setBounds (getLocalBounds());
+}
+
+//==============================================================================
+void LibraryBrowser::setOpen (Node& node, bool shouldBeOpen)
+{
+    auto selectedFile = getSelectedFile();
+    node.isOpen = shouldBeOpen;
+    
+    //what is already known shows now, and is replaced when the listing arrives
+    if (shouldBeOpen)
+    {
+        if (! node.hasBeenListed)
+            showIndexedContents (node);
+        
+        node.isBeingListed = true;
+        lister->list (node.file);
+    }
+    
+    updateRows (selectedFile);
+}
+
+void LibraryBrowser::showIndexedContents (Node& directory)
+{
+    std::vector<LibraryIndex::Entry> files;
+    Listing indexed { directory.file, {}, {} };
+    libraryIndex->getDirectoryContents (directory.file, files, indexed.subdirectories);
+    
+    for (auto& entry : files)
+        indexed.files.add (entry.file);
+    
+    applyListing (directory, std::move (indexed));
+}
+
+void LibraryBrowser::applyListing (Node& directory, Listing&& listing)
+{
+    //children that are still there keep their nodes, so anything open inside them stays open
+    std::unordered_map<String, std::unique_ptr<Node>> previousChildren;
+    for (auto& child : directory.children)
+        previousChildren.emplace (child->file.getFullPathName(), std::move (child));
+    
+    directory.children.clear();
+    directory.children.reserve ((size_t) (listing.subdirectories.size() + listing.files.size()));
+    
+    auto byName = [] (const File& a, const File& b) { return a.getFileName().compareNatural (b.getFileName()) < 0; };
+    std::sort (listing.subdirectories.begin(), listing.subdirectories.end(), byName);
+    std::sort (listing.files.begin(), listing.files.end(), byName);
+    
+    auto addChild = [&] (const File& file, bool isDirectory)
+    {
+        auto previous = previousChildren.find (file.getFullPathName());
+        auto child = previous != previousChildren.end() ? std::move (previous->second) : std::make_unique<Node>();
+        child->file = file;
+        child->isDirectory = isDirectory;
+        child->depth = directory.depth + 1;
+        directory.children.push_back (std::move (child));
+    };
+    
+    for (auto& subdirectory : listing.subdirectories)
+        addChild (subdirectory, true);
+    
+    for (auto& file : listing.files)
+        addChild (file, false);
+}
+
+LibraryBrowser::Node* LibraryBrowser::findDirectoryNode (const File& directory) const
+{
+    auto* node = root.get();
+    while (node != nullptr && node->file != directory)
+    {
+        Node* next = nullptr;
+        for (auto& child : node->children)
+        {
+            if (child->isDirectory && (child->file == directory || directory.isAChildOf (child->file)))
+            {
+                next = child.get();
+                break;
+            }
+        }
+        
+        node = next;
+    }
+    
+    return node;
+}
+
+void LibraryBrowser::updateRows (const File& selectedFile)
+{
+    rows.clear();
+    std::function<void (Node&)> addOpenChildren = [&] (Node& node)
+    {
+        for (auto& child : node.children)
+        {
+            rows.push_back (child.get());
+            if (child->isOpen)
+                addOpenChildren (*child);
+        }
+    };
+    
+    addOpenChildren (*root);
+    
+    const ScopedValueSetter<bool> updating (isUpdatingRows, true);
+    listBox.updateContent();
+    
+    auto selectedRow = std::find_if (rows.begin(), rows.end(), [&] (Node* node) { return node->file == selectedFile; });
+    if (selectedFile != File() && selectedRow != rows.end())
+        listBox.selectRow ((int) std::distance (rows.begin(), selectedRow), true, true);
+    else
+        listBox.deselectAllRows();
+    
+    listBox.repaint();
+}
+
+//==============================================================================
+int LibraryBrowser::getNumRows()
+{
+    return (int) rows.size();
+}
+
+void LibraryBrowser::paintListBoxItem (int row, Graphics& g, int width, int height, bool rowIsSelected)
+{
+    if (! isPositiveAndBelow (row, (int) rows.size()))
+        return;
+    
+    auto& node = *rows[(size_t) row];
+    if (rowIsSelected)
+        g.fillAll (findColour (TextEditor::highlightColourId));
+    
+    auto r = Rectangle<int> (width, height).withTrimmedLeft (node.depth * indentPerLevel + 2);
+    auto openCloseArea = r.removeFromLeft (height);
+    
+    if (node.isDirectory)
+        getLookAndFeel().drawTreeviewPlusMinusBox (g, openCloseArea.reduced (4).toFloat(), Colours::white, node.isOpen, false);
+    
+    g.setColour (Colours::black);
+    g.setFont (Font (14.0f, Font::plain));
+    g.drawText (node.file.getFileName(), r, Justification::centredLeft, true);
+    
+    if (node.isOpen && node.isBeingListed)
+    {
+        g.setColour (Colours::black.withAlpha (0.4f));
+        g.setFont (Font (12.0f, Font::italic));
+        g.drawText ("listing...", r.reduced (4, 0), Justification::centredRight, false);
+    }
+}
+
+void LibraryBrowser::listBoxItemClicked (int row, const MouseEvent& e)
+{
+    if (! isPositiveAndBelow (row, (int) rows.size()))
+        return;
+    
+    //only the plus/minus box opens and closes with a single click, as in a TreeView
+    auto& node = *rows[(size_t) row];
+    if (node.isDirectory && e.x < node.depth * indentPerLevel + 2 + listBox.getRowHeight())
+        setOpen (node, ! node.isOpen);
+}
+
+void LibraryBrowser::listBoxItemDoubleClicked (int row, const MouseEvent&)
+{
+    returnKeyPressed (row);
+}
+
+void LibraryBrowser::returnKeyPressed (int lastRowSelected)
+{
+    if (isPositiveAndBelow (lastRowSelected, (int) rows.size()) && rows[(size_t) lastRowSelected]->isDirectory)
+        setOpen (*rows[(size_t) lastRowSelected], ! rows[(size_t) lastRowSelected]->isOpen);
+}
+
+void LibraryBrowser::selectedRowsChanged (int lastRowSelected)
+{
+    if (isUpdatingRows || ! isPositiveAndBelow (lastRowSelected, (int) rows.size()))
+        return;
+    
+    auto& node = *rows[(size_t) lastRowSelected];
+    if (! node.isDirectory && onFileChosen != nullptr)
+        onFileChosen (node.file);
+}
+
+void LibraryBrowser::handleAsyncUpdate()
+{
+    auto selectedFile = getSelectedFile();
+    
+    for (auto& listing : lister->takeFinished())
+    {
+        //it may have gone from a newer listing of its parent in the meantime
+        if (auto* node = findDirectoryNode (listing.directory))
+        {
+            node->isBeingListed = false;
+            node->hasBeenListed = true;
+            applyListing (*node, std::move (listing));
+        }
+    }
+    
+    updateRows (selectedFile);
+}
+
+void LibraryBrowser::changeListenerCallback (ChangeBroadcaster*)
+{
+    //the index is still being read back or built, and something open hasn't been listed yet.
+    //by file, since showing one directory's contents can replace the nodes inside it
+    Array<File> directoriesToShow;
+    if (! root->hasBeenListed)
+        directoriesToShow.add (root->file);
+    
+    for (auto* node : rows)
+    {
+        if (node->isDirectory && node->isOpen && ! node->hasBeenListed)
+            directoriesToShow.add (node->file);
+    }
+    
+    if (directoriesToShow.isEmpty())
+        return;
+    
+    auto selectedFile = getSelectedFile();
+    for (auto& directory : directoriesToShow)
+    {
+        if (auto* node = findDirectoryNode (directory))
+            showIndexedContents (*node);
+    }
+    
+    updateRows (selectedFile);
+}
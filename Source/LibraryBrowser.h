@@ -0,0 +1,93 @@
+/*
+  ==============================================================================
+
+    LibraryBrowser.h
+    A file tree that only lists a directory when it is opened, and only ever
+    has components for the rows on screen.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "LibraryIndex.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ The tree is flattened into a ListBox, so a directory with a hundred thousand files in it costs a
+ hundred thousand pointers, and a screenful of row components.
+ 
+ Opening a directory shows whatever is already known about it straight away: the listing from the
+ last time it was open, or failing that what the LibraryIndex has for it.  It is then listed
+ again on the shared directory scan thread, and the rows are updated when that finishes, so a
+ slow network mount never holds up the message thread.  Nothing is listed until it is opened.
+ 
+ Only directories and files matching audioFileWildcard are shown.
+ */
+class LibraryBrowser : public Component,
+private ListBoxModel,
+private AsyncUpdater,
+private ChangeListener
+{
+public:
+    LibraryBrowser (const File& rootDirectory, const String& audioFileWildcard);
+    
+    ~LibraryBrowser() override;
+    
+    File getSelectedFile() const;
+    
+    //the files either side of the selected one, nearest first.  directories are skipped
+    Array<URL> getFilesNextToSelection (int maxDistance) const;
+    
+    //called when the user selects a file
+    std::function<void (const File&)> onFileChosen;
+    
+    void resized() override;
+private:
+    struct Node;
+    struct Listing;
+    struct Lister;
+    
+    SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    SharedResourcePointer<LibraryIndex> libraryIndex;
+    WildcardFileFilter audioFileFilter;
+    
+    std::unique_ptr<Node> root;
+    //the nodes that are showing, in order.  rebuilt whenever a directory opens, closes or is relisted
+    std::vector<Node*> rows;
+    ListBox listBox { {}, this };
+    //set while rows are rebuilt, so reselecting the same file doesn't load it again
+    bool isUpdatingRows = false;
+    
+    std::unique_ptr<Lister> lister;
+    
+    void setOpen (Node& node, bool shouldBeOpen);
+    //until a directory has been listed, it shows what the index has for it
+    void showIndexedContents (Node& directory);
+    void applyListing (Node& directory, Listing&& listing);
+    Node* findDirectoryNode (const File& directory) const;
+    //the selection has to be taken before any nodes are replaced, since rows may point at them
+    void updateRows (const File& selectedFile);
+    
+    int getNumRows() override;
+    
+    void paintListBoxItem (int row, Graphics& g, int width, int height, bool rowIsSelected) override;
+    
+    void listBoxItemClicked (int row, const MouseEvent& e) override;
+    
+    void listBoxItemDoubleClicked (int row, const MouseEvent&) override;
+    
+    void returnKeyPressed (int lastRowSelected) override;
+    
+    void selectedRowsChanged (int lastRowSelected) override;
+    
+    void handleAsyncUpdate() override;
+    
+    void changeListenerCallback (ChangeBroadcaster*) override;
+    
+    static constexpr int indentPerLevel = 14;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LibraryBrowser)
+};
@@ -0,0 +1,642 @@
+/*
+  ==============================================================================
+
+    LibraryIndex.cpp
+
+  ==============================================================================
+*/
+
+#include "LibraryIndex.h"
+#include "PersistentThumbnailCache.h"
+
+#if JUCE_LINUX
+ #include <sys/inotify.h>
+ #include <poll.h>
+ #include <unistd.h>
+#endif
+
+#if JUCE_LINUX
+/*
+ one inotify watch per directory, since inotify doesn't do recursive watches.  if it runs out of
+ watches, or events are dropped because the queue overflowed, it stops watching and the index
+ falls back to walking the tree every so often.
+ */
+struct LibraryIndex::Watcher
+{
+    Watcher() : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) { }
+    ~Watcher()
+    {
+        if( fd >= 0 )
+            close(fd);
+    }
+    
+    bool isWatching() const noexcept { return fd >= 0 && ! hasFailed; }
+    
+    void addDirectory(const File& directory)
+    {
+        if( ! isWatching() )
+            return;
+        
+        auto wd = inotify_add_watch(fd,
+                                    directory.getFullPathName().toRawUTF8(),
+                                    IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR);
+        if( wd < 0 )
+            hasFailed = true; //usually ENOSPC: out of watches
+        else
+            directories[wd] = directory;
+    }
+    
+    //blocks for up to timeoutMs, and returns the files and directories that have changed since the last call
+    Array<File> waitForChanges(int timeoutMs)
+    {
+        Array<File> changed;
+        if( ! isWatching() )
+            return changed;
+        
+        pollfd pfd { fd, POLLIN, 0 };
+        if( poll(&pfd, 1, timeoutMs) <= 0 )
+            return changed;
+        
+        alignas(inotify_event) char buffer[16384];
+        for( ;; )
+        {
+            auto numRead = read(fd, buffer, sizeof(buffer));
+            if( numRead <= 0 )
+                break;
+            
+            for( auto* p = buffer; p < buffer + numRead; )
+            {
+                auto* event = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + event->len;
+                
+                if( event->mask & IN_Q_OVERFLOW )
+                {
+                    hasFailed = true;
+                    continue;
+                }
+                
+                auto found = directories.find(event->wd);
+                if( found == directories.end() )
+                    continue;
+                
+                if( event->mask & IN_IGNORED )
+                {
+                    directories.erase(found);
+                    continue;
+                }
+                
+                changed.addIfNotAlreadyThere(event->len > 0 ? found->second.getChildFile(event->name) : found->second);
+            }
+        }
+        
+        return changed;
+    }
+private:
+    const int fd;
+    bool hasFailed { false };
+    std::map<int, File> directories;
+};
+#else
+//no watching: the index thread rescans every rescanIntervalSeconds instead
+struct LibraryIndex::Watcher
+{
+    bool isWatching() const noexcept { return false; }
+    void addDirectory(const File&) { }
+    Array<File> waitForChanges(int) { return {}; }
+};
+#endif
+//==============================================================================
+struct LibraryIndex::IndexThread : Thread
+{
+    IndexThread(LibraryIndex& o, const File& root) : Thread("LibraryIndex"), owner(o), rootDirectory(root) { }
+    
+    void run() override
+    {
+        owner.load();
+        
+        Watcher watcher;
+        auto lastSaveTime = Time::getMillisecondCounter();
+        
+        owner.reconcile(rootDirectory, *this, watcher);
+        
+        while( ! threadShouldExit() )
+        {
+            if( watcher.isWatching() )
+            {
+                for( auto& changed : watcher.waitForChanges(watchPollIntervalMs) )
+                    owner.handleChangedPath(changed, *this, watcher);
+                
+                //events were dropped, or there are no watches left: one walk to catch up, then rescans from here on
+                if( ! watcher.isWatching() )
+                    owner.reconcile(rootDirectory, *this, watcher);
+            }
+            else
+            {
+                wait(rescanIntervalSeconds * 1000);
+                if( ! threadShouldExit() )
+                    owner.reconcile(rootDirectory, *this, watcher);
+            }
+            
+            if( Time::getMillisecondCounter() - lastSaveTime >= (uint32) saveIntervalSeconds * 1000 )
+            {
+                owner.save();
+                lastSaveTime = Time::getMillisecondCounter();
+            }
+        }
+    }
+    
+    //how often a thread waiting for inotify events checks whether it should stop
+    static constexpr int watchPollIntervalMs = 250;
+private:
+    LibraryIndex& owner;
+    const File rootDirectory;
+};
+
+struct LibraryIndex::AnalysisJob : ThreadPoolJob
+{
+    explicit AnalysisJob(LibraryIndex& o) : ThreadPoolJob("LibraryIndex analysis"), owner(o) { }
+    
+    //one batch per run, then to the back of the queue so waveform jobs get a turn
+    JobStatus runJob() override
+    {
+        return owner.analyseNextBatch(*this) ? jobNeedsRunningAgain : jobHasFinished;
+    }
+    
+    LibraryIndex& owner;
+};
+
+struct LibraryIndex::OwnJobsSelector : ThreadPool::JobSelector
+{
+    explicit OwnJobsSelector(LibraryIndex& o) : owner(o) { }
+    bool isJobSuitable(ThreadPoolJob* job) override
+    {
+        auto* analysisJob = dynamic_cast<AnalysisJob*>(job);
+        return analysisJob != nullptr && &analysisJob->owner == &owner;
+    }
+    LibraryIndex& owner;
+};
+//==============================================================================
+LibraryIndex::LibraryIndex() : indexFile(getDefaultIndexFile())
+{
+    formatManager.registerBasicFormats();
+    
+    for( auto wildcard : StringArray::fromTokens(formatManager.getWildcardForAllFormats(), ";", {}) )
+        audioFileExtensions.addIfNotAlreadyThere(wildcard.trim().fromLastOccurrenceOf("*", false, false).toLowerCase());
+    
+    audioFileExtensions.removeEmptyStrings();
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    if( indexThread != nullptr )
+        indexThread->stopThread(5000);
+    
+    {
+        const ScopedLock sl(pendingLock);
+        pendingAnalysis.clear();
+    }
+    
+    OwnJobsSelector ownJobs { *this };
+    ioScheduler->getAnalysisPool().removeAllJobs(true, 5000, &ownJobs);
+    
+    save();
+}
+
+File LibraryIndex::getDefaultIndexFile()
+{
+    //next to the thumbnails: it can always be rebuilt, so it belongs with the caches
+    return PersistentThumbnailCache::getDefaultDirectory().getSiblingFile("Library.index");
+}
+
+void LibraryIndex::setRootDirectory(const File& directory)
+{
+    if( indexThread != nullptr )
+    {
+        if( directory == getRootDirectory() )
+            return;
+        
+        indexThread->stopThread(5000);
+    }
+    
+    bool removedAny = false;
+    {
+        const ScopedWriteLock sl(entriesLock);
+        rootDirectory = directory;
+        
+        auto prefix = directory.getFullPathName() + File::getSeparatorString();
+        for( auto it = entries.begin(); it != entries.end(); )
+        {
+            if( it->first.startsWith(prefix) )
+            {
+                ++it;
+            }
+            else
+            {
+                it = entries.erase(it);
+                removedAny = true;
+            }
+        }
+    }
+    
+    if( removedAny )
+        entriesChanged();
+    
+    indexThread = std::make_unique<IndexThread>(*this, directory);
+    indexThread->startThread(Thread::Priority::background);
+}
+
+File LibraryIndex::getRootDirectory() const
+{
+    const ScopedReadLock sl(entriesLock);
+    return rootDirectory;
+}
+
+int LibraryIndex::getNumEntries() const
+{
+    const ScopedReadLock sl(entriesLock);
+    return (int) entries.size();
+}
+
+bool LibraryIndex::findEntry(const File& file, Entry& result) const
+{
+    const ScopedReadLock sl(entriesLock);
+    auto found = entries.find(file.getFullPathName());
+    if( found == entries.end() )
+        return false;
+    
+    result = found->second;
+    return true;
+}
+
+std::vector<LibraryIndex::Entry> LibraryIndex::getEntries(const std::function<bool(const Entry&)>& filter,
+                                                          size_t maxNumResults) const
+{
+    std::vector<Entry> results;
+    
+    const ScopedReadLock sl(entriesLock);
+    for( auto& [path, entry] : entries )
+    {
+        if( results.size() >= maxNumResults )
+            break;
+        
+        if( entry.isReadable() && (filter == nullptr || filter(entry)) )
+            results.push_back(entry);
+    }
+    
+    return results;
+}
+
+void LibraryIndex::getDirectoryContents(const File& directory, std::vector<Entry>& files, Array<File>& subdirectories) const
+{
+    auto prefix = directory.getFullPathName() + File::getSeparatorString();
+    
+    const ScopedReadLock sl(entriesLock);
+    auto it = entries.lower_bound(prefix);
+    while( it != entries.end() && it->first.startsWith(prefix) )
+    {
+        auto relativePath = it->first.substring(prefix.length());
+        auto separator = relativePath.indexOfChar(File::getSeparatorChar());
+        
+        if( separator < 0 )
+        {
+            if( it->second.isReadable() )
+                files.push_back(it->second);
+            
+            ++it;
+            continue;
+        }
+        
+        //everything in a subdirectory sorts together, so skip straight past it
+        auto subdirectoryPath = prefix + relativePath.substring(0, separator);
+        subdirectories.add(File(subdirectoryPath));
+        it = entries.lower_bound(subdirectoryPath + String::charToString((juce_wchar) (File::getSeparatorChar() + 1)));
+    }
+}
+
+//==============================================================================
+bool LibraryIndex::isAudioFile(const File& file) const
+{
+    return audioFileExtensions.contains(file.getFileExtension().toLowerCase());
+}
+
+bool LibraryIndex::needsAnalysis(const File& file, int64 fileSize, int64 modificationTime) const
+{
+    const ScopedReadLock sl(entriesLock);
+    auto found = entries.find(file.getFullPathName());
+    return found == entries.end()
+        || found->second.fileSize != fileSize
+        || found->second.modificationTime != modificationTime;
+}
+
+/*
+ only looks at names, sizes and dates.  files are queued for analysis as they are found, so the
+ pool starts on them while the walk carries on.
+ */
+void LibraryIndex::reconcile(const File& directory, Thread& thread, Watcher& watcher)
+{
+    std::unordered_set<String> pathsFound;
+    Array<File> toAnalyse;
+    
+    watcher.addDirectory(directory);
+    
+    for( auto& item : RangedDirectoryIterator(directory,
+                                              true,
+                                              "*",
+                                              File::findFilesAndDirectories | File::ignoreHiddenFiles,
+                                              File::FollowSymlinks::noCycles) )
+    {
+        //a partial walk can't tell what has gone, so nothing is removed
+        if( thread.threadShouldExit() )
+            return;
+        
+        auto file = item.getFile();
+        if( item.isDirectory() )
+        {
+            watcher.addDirectory(file);
+            continue;
+        }
+        
+        if( ! isAudioFile(file) )
+            continue;
+        
+        pathsFound.insert(file.getFullPathName());
+        
+        if( needsAnalysis(file, item.getFileSize(), item.getModificationTime().toMilliseconds()) )
+            toAnalyse.add(file);
+        
+        if( toAnalyse.size() >= analysisBatchSize * 16 )
+        {
+            queueForAnalysis(toAnalyse);
+            toAnalyse.clear();
+        }
+    }
+    
+    queueForAnalysis(toAnalyse);
+    removeEntriesNotIn(directory, pathsFound);
+}
+
+void LibraryIndex::handleChangedPath(const File& fileOrDirectory, Thread& thread, Watcher& watcher)
+{
+    if( fileOrDirectory.isHidden() )
+        return;
+    
+    //created, or moved in from somewhere else
+    if( fileOrDirectory.isDirectory() )
+    {
+        reconcile(fileOrDirectory, thread, watcher);
+        return;
+    }
+    
+    //deleted or moved away
+    if( ! fileOrDirectory.existsAsFile() )
+    {
+        removeEntries(fileOrDirectory);
+        return;
+    }
+    
+    if( isAudioFile(fileOrDirectory)
+       && needsAnalysis(fileOrDirectory, fileOrDirectory.getSize(), fileOrDirectory.getLastModificationTime().toMilliseconds()) )
+    {
+        queueForAnalysis({ fileOrDirectory });
+    }
+}
+
+//==============================================================================
+void LibraryIndex::queueForAnalysis(const Array<File>& files)
+{
+    if( files.isEmpty() )
+        return;
+    
+    auto& pool = ioScheduler->getAnalysisPool();
+    
+    const ScopedLock sl(pendingLock);
+    pendingAnalysis.addArray(files);
+    
+    while( numAnalysisJobs < pool.getNumThreads() && numAnalysisJobs * analysisBatchSize < pendingAnalysis.size() )
+    {
+        ++numAnalysisJobs;
+        pool.addJob(new AnalysisJob(*this), true);
+    }
+}
+
+bool LibraryIndex::analyseNextBatch(ThreadPoolJob& job)
+{
+    Array<File> batch;
+    {
+        const ScopedLock sl(pendingLock);
+        if( pendingAnalysis.isEmpty() || job.shouldExit() )
+        {
+            //counted under the same lock queueForAnalysis() adds under, so no file is left without a job
+            --numAnalysisJobs;
+            return false;
+        }
+        
+        auto numToTake = jmin(analysisBatchSize, pendingAnalysis.size());
+        batch.addArray(pendingAnalysis, 0, numToTake);
+        pendingAnalysis.removeRange(0, numToTake);
+    }
+    
+    for( auto& file : batch )
+    {
+        Entry entry;
+        if( analyse(file, entry, job) )
+            setEntry(std::move(entry));
+        else if( ! file.existsAsFile() )
+            removeEntries(file);
+    }
+    
+    return true;
+}
+
+//false if the file has gone, or the job was asked to stop part way through
+bool LibraryIndex::analyse(const File& file, Entry& result, ThreadPoolJob& job)
+{
+    if( ! file.existsAsFile() )
+        return false;
+    
+    result.file = file;
+    result.fileSize = file.getSize();
+    result.modificationTime = file.getLastModificationTime().toMilliseconds();
+    
+    std::unique_ptr<AudioFormatReader> reader (formatManager.createReaderFor(file));
+    if( reader == nullptr || reader->numChannels == 0 )
+        return true; //recorded as unreadable
+    
+    result.formatName = reader->getFormatName();
+    result.sampleRate = reader->sampleRate;
+    result.numChannels = (int) reader->numChannels;
+    result.lengthInSamples = reader->lengthInSamples;
+    
+    //a chunk at a time, so a long file doesn't hold up shutting down
+    auto chunkSize = (int64) jmax(1.0, reader->sampleRate * 10.0);
+    HeapBlock<Range<float>> levels ((size_t) result.numChannels);
+    
+    for( int64 pos = 0; pos < result.lengthInSamples; pos += chunkSize )
+    {
+        if( job.shouldExit() )
+            return false;
+        
+        reader->readMaxLevels(pos, jmin(chunkSize, result.lengthInSamples - pos), levels, result.numChannels);
+        
+        for( int ch = 0; ch < result.numChannels; ++ch )
+            result.peakLevel = jmax(result.peakLevel, std::abs(levels[ch].getStart()), std::abs(levels[ch].getEnd()));
+    }
+    
+    return true;
+}
+
+//==============================================================================
+void LibraryIndex::setEntry(Entry&& entry)
+{
+    {
+        const ScopedWriteLock sl(entriesLock);
+        auto path = entry.file.getFullPathName();
+        entries[path] = std::move(entry);
+    }
+    
+    entriesChanged();
+}
+
+void LibraryIndex::removeEntries(const File& fileOrDirectory)
+{
+    auto path = fileOrDirectory.getFullPathName();
+    auto prefix = path + File::getSeparatorString();
+    bool removedAny = false;
+    
+    {
+        const ScopedWriteLock sl(entriesLock);
+        removedAny = entries.erase(path) > 0;
+        
+        auto it = entries.lower_bound(prefix);
+        while( it != entries.end() && it->first.startsWith(prefix) )
+        {
+            it = entries.erase(it);
+            removedAny = true;
+        }
+    }
+    
+    if( removedAny )
+        entriesChanged();
+}
+
+void LibraryIndex::removeEntriesNotIn(const File& directory, const std::unordered_set<String>& pathsToKeep)
+{
+    bool removedAny = false;
+    
+    {
+        const ScopedWriteLock sl(entriesLock);
+        auto prefix = directory.getFullPathName() + File::getSeparatorString();
+        
+        //everything inside directory is next to each other
+        for( auto it = entries.lower_bound(prefix); it != entries.end() && it->first.startsWith(prefix); )
+        {
+            if( pathsToKeep.count(it->first) == 0 )
+            {
+                it = entries.erase(it);
+                removedAny = true;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    
+    if( removedAny )
+        entriesChanged();
+}
+
+void LibraryIndex::entriesChanged()
+{
+    ++version;
+    hasUnsavedChanges.store(true);
+    changes.sendChangeMessage();
+}
+
+//==============================================================================
+namespace
+{
+constexpr int indexFileMagic = 0x7864494c; //"LIdx"
+constexpr int indexFileVersion = 1;
+}
+
+void LibraryIndex::load()
+{
+    FileInputStream in(indexFile);
+    if( ! in.openedOk() || in.readInt() != indexFileMagic || in.readInt() != indexFileVersion )
+        return;
+    
+    std::map<String, Entry> loaded;
+    auto numEntries = in.readInt();
+    
+    for( int i = 0; i < numEntries && ! in.isExhausted(); ++i )
+    {
+        Entry entry;
+        auto path = in.readString();
+        entry.file = File(path);
+        entry.formatName = in.readString();
+        entry.sampleRate = in.readDouble();
+        entry.numChannels = in.readInt();
+        entry.lengthInSamples = in.readInt64();
+        entry.peakLevel = in.readFloat();
+        entry.fileSize = in.readInt64();
+        entry.modificationTime = in.readInt64();
+        loaded.emplace_hint(loaded.end(), path, std::move(entry));
+    }
+    
+    {
+        const ScopedWriteLock sl(entriesLock);
+        auto prefix = rootDirectory.getFullPathName() + File::getSeparatorString();
+        
+        //anything found since indexing started is newer than what was saved
+        for( auto& [path, entry] : loaded )
+        {
+            if( path.startsWith(prefix) )
+                entries.insert({ path, std::move(entry) });
+        }
+    }
+    
+    ++version;
+    changes.sendChangeMessage();
+}
+
+//written next to the index and moved into place, so a crash never leaves half an index behind
+void LibraryIndex::save()
+{
+    if( ! hasUnsavedChanges.exchange(false) )
+        return;
+    
+    if( ! indexFile.getParentDirectory().createDirectory() )
+        return;
+    
+    TemporaryFile temp(indexFile);
+    {
+        FileOutputStream out(temp.getFile());
+        if( ! out.openedOk() )
+            return;
+        
+        out.writeInt(indexFileMagic);
+        out.writeInt(indexFileVersion);
+        
+        const ScopedReadLock sl(entriesLock);
+        out.writeInt((int) entries.size());
+        
+        for( auto& [path, entry] : entries )
+        {
+            out.writeString(path);
+            out.writeString(entry.formatName);
+            out.writeDouble(entry.sampleRate);
+            out.writeInt(entry.numChannels);
+            out.writeInt64(entry.lengthInSamples);
+            out.writeFloat(entry.peakLevel);
+            out.writeInt64(entry.fileSize);
+            out.writeInt64(entry.modificationTime);
+        }
+        
+        out.flush();
+        if( out.getStatus().failed() )
+            return;
+    }
+    
+    temp.overwriteTargetFileWithTemporary();
+}
@@ -0,0 +1,126 @@
+/*
+  ==============================================================================
+
+    LibraryIndex.h
+    A persistent index of the audio files under a directory, with enough
+    metadata to browse and filter them without opening a single reader.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SharedIOScheduler.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ Use it through a juce::SharedResourcePointer<LibraryIndex>, so every instance in the process
+ shares one index and one set of threads.
+ 
+ The index is read back from disk as soon as indexing starts, so it can be browsed straight away,
+ and is then reconciled with the filesystem in the background.  The reconcile walks the tree
+ looking only at names, sizes and modification times; only files that are new or have changed
+ are opened, in parallel on the shared analysis pool.
+ 
+ After that it keeps itself up to date with inotify on Linux.  Elsewhere, or once the system has
+ run out of inotify watches, it walks the tree again every rescanIntervalSeconds.
+ 
+ Thread safe.  changes fires on the message thread whenever entries have been added, updated or
+ removed.
+ */
+struct LibraryIndex
+{
+    struct Entry
+    {
+        File file;
+        String formatName;
+        double sampleRate { 0 };
+        int numChannels { 0 };
+        int64 lengthInSamples { 0 };
+        //the largest absolute sample value in any channel
+        float peakLevel { 0 };
+        
+        //what the file looked like when it was analysed
+        int64 fileSize { 0 };
+        int64 modificationTime { 0 };
+        
+        //files no format could open are kept too, so they aren't opened again every time the tree is walked
+        bool isReadable() const noexcept { return numChannels > 0; }
+        double getLengthInSeconds() const noexcept { return sampleRate > 0 ? (double) lengthInSamples / sampleRate : 0.0; }
+    };
+    
+    LibraryIndex();
+    ~LibraryIndex();
+    
+    //starts indexing directory.  entries outside it are dropped.
+    void setRootDirectory(const File& directory);
+    File getRootDirectory() const;
+    
+    int getNumEntries() const;
+    //goes up every time an entry is added, updated or removed
+    int getVersion() const noexcept { return version.load(); }
+    
+    bool findEntry(const File& file, Entry& result) const;
+    
+    //readable entries that pass filter (all of them if there isn't one), in path order
+    std::vector<Entry> getEntries(const std::function<bool(const Entry&)>& filter = nullptr,
+                                  size_t maxNumResults = std::numeric_limits<size_t>::max()) const;
+    
+    //the readable files directly inside directory, and the directories inside it that lead to some
+    void getDirectoryContents(const File& directory, std::vector<Entry>& files, Array<File>& subdirectories) const;
+    
+    ChangeBroadcaster changes;
+    
+    static File getDefaultIndexFile();
+    
+    static constexpr int rescanIntervalSeconds = 60;
+    static constexpr int saveIntervalSeconds = 30;
+    static constexpr int analysisBatchSize = 16;
+private:
+    struct IndexThread;
+    struct Watcher;
+    struct AnalysisJob;
+    struct OwnJobsSelector;
+    
+    SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    AudioFormatManager formatManager;
+    //lower case, with the dot
+    StringArray audioFileExtensions;
+    const File indexFile;
+    
+    //keyed on full path, so everything in a directory is next to each other
+    mutable ReadWriteLock entriesLock;
+    std::map<String, Entry> entries;
+    File rootDirectory;
+    std::atomic<int> version { 0 };
+    std::atomic<bool> hasUnsavedChanges { false };
+    
+    CriticalSection pendingLock;
+    Array<File> pendingAnalysis;
+    int numAnalysisJobs { 0 };
+    
+    std::unique_ptr<IndexThread> indexThread;
+    
+    bool isAudioFile(const File& file) const;
+    bool needsAnalysis(const File& file, int64 fileSize, int64 modificationTime) const;
+    
+    void reconcile(const File& directory, Thread& thread, Watcher& watcher);
+    void handleChangedPath(const File& fileOrDirectory, Thread& thread, Watcher& watcher);
+    
+    void queueForAnalysis(const Array<File>& files);
+    bool analyseNextBatch(ThreadPoolJob& job);
+    bool analyse(const File& file, Entry& result, ThreadPoolJob& job);
+    
+    void setEntry(Entry&& entry);
+    //a file, or everything inside a directory
+    void removeEntries(const File& fileOrDirectory);
+    void removeEntriesNotIn(const File& directory, const std::unordered_set<String>& pathsToKeep);
+    void entriesChanged();
+    
+    void load();
+    void save();
+    
+    JUCE_DECLARE_NON_COPYABLE(LibraryIndex)
+};
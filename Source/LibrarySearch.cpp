@@ -0,0 +1,629 @@
+/*
+  ==============================================================================
+
+    LibrarySearch.cpp
+
+  ==============================================================================
+*/
+
+#include "LibrarySearch.h"
+
+namespace
+{
+//lower case, with every ASCII character that isn't a letter or a digit made a space, so "Kick_01" finds "kick 01"
+std::string normalise(const String& s)
+{
+    std::string text(s.toLowerCase().toRawUTF8());
+    for( auto& c : text )
+    {
+        auto byte = (unsigned char) c;
+        if( byte < 0x80 && ! std::isalnum(byte) )
+            c = ' ';
+    }
+    
+    return text;
+}
+
+bool isSeparator(char c) noexcept { return c == ' ' || c == '/'; }
+
+uint32 getTrigramKey(const char* p) noexcept
+{
+    return ((uint32) (uint8) p[0] << 16) | ((uint32) (uint8) p[1] << 8) | (uint32) (uint8) p[2];
+}
+
+//the first two bytes of a word, or its only byte and a zero
+uint32 getPrefixKey(std::string_view word) noexcept
+{
+    return ((uint32) (uint8) word[0] << 8) | (word.size() > 1 ? (uint32) (uint8) word[1] : 0);
+}
+
+//the trigrams of text that don't span a separator, sorted and without duplicates
+void getTrigrams(std::string_view text, std::vector<uint32>& trigrams)
+{
+    trigrams.clear();
+    for( size_t i = 0; i + 3 <= text.size(); ++i )
+    {
+        if( ! isSeparator(text[i]) && ! isSeparator(text[i + 1]) && ! isSeparator(text[i + 2]) )
+            trigrams.push_back(getTrigramKey(text.data() + i));
+    }
+    
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+}
+
+//a typo changes up to three trigrams, so the longer a word is the more of them it can miss.  a typo in
+//the first or last letter changes only one, which a word of four letters, and two trigrams, can miss
+int getNumTrigramsRequired(int numTrigrams) noexcept
+{
+    if( numTrigrams <= 1 )
+        return numTrigrams;
+    
+    return numTrigrams - jmax(1, (numTrigrams - 1) / 2);
+}
+
+void sortAndRemoveDuplicates(std::vector<uint32>& v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+//ranks, per word.  a word that fuzzily matches gets up to fuzzyMatchScore, depending on how many trigrams it shares
+constexpr float wholeWordScore = 100.0f;
+constexpr float wordStartScore = 80.0f;
+constexpr float inNameScore = 60.0f;
+constexpr float inDirectoryScore = 40.0f;
+constexpr float fuzzyMatchScore = 30.0f;
+//per byte of the file's name, so that of two equally good matches the shorter name comes first
+constexpr float nameLengthPenalty = 0.05f;
+}
+
+//==============================================================================
+struct LibrarySearch::Snapshot
+{
+    //in path order
+    std::vector<LibraryIndex::Entry> entries;
+    
+    //each entry's normalised directory name and name, as "directory/name", end to end
+    std::string text;
+    std::vector<uint32> textStart;
+    
+    //postings are indices into entries, in ascending order.  trigramKeys[i]'s start at trigramStart[i]
+    std::vector<uint32> trigramKeys, trigramStart, trigramPostings;
+    //the words in each directory name and name, by getPrefixKey(), so a key's postings are [prefixStart[key], prefixStart[key + 1])
+    std::vector<uint32> prefixStart, prefixPostings;
+    
+    static constexpr uint32 numPrefixKeys = 1 << 16;
+    
+    struct Postings
+    {
+        const uint32* first { nullptr };
+        const uint32* last { nullptr };
+        size_t size() const noexcept { return (size_t) (last - first); }
+    };
+    
+    std::string_view getText(size_t entry) const noexcept
+    {
+        return std::string_view(text).substr(textStart[entry], textStart[entry + 1] - textStart[entry]);
+    }
+    
+    //nullptr if job was asked to stop first
+    static std::shared_ptr<const Snapshot> build(std::vector<LibraryIndex::Entry>&& entries, ThreadPoolJob& job)
+    {
+        auto s = std::make_shared<Snapshot>();
+        s->entries = std::move(entries);
+        s->textStart.reserve(s->entries.size() + 1);
+        
+        //key in the top half, entry in the bottom, so sorting them puts each key's postings together and in order
+        std::vector<uint64> trigramPairs, prefixPairs;
+        std::vector<uint32> keys;
+        
+        for( size_t i = 0; i < s->entries.size(); ++i )
+        {
+            if( (i & 0xfff) == 0 && job.shouldExit() )
+                return nullptr;
+            
+            auto& file = s->entries[i].file;
+            auto start = s->text.size();
+            s->textStart.push_back((uint32) start);
+            s->text += normalise(file.getParentDirectory().getFileName());
+            s->text += '/';
+            s->text += normalise(file.getFileNameWithoutExtension());
+            
+            auto entryText = std::string_view(s->text).substr(start);
+            getTrigrams(entryText, keys);
+            for( auto key : keys )
+                trigramPairs.push_back(((uint64) key << 32) | i);
+            
+            //so that a two letter word finds the same files the longer words it is the start of would
+            keys.clear();
+            for( size_t pos = 0; pos < entryText.size(); ++pos )
+            {
+                if( ! isSeparator(entryText[pos]) && (pos == 0 || isSeparator(entryText[pos - 1])) )
+                    keys.push_back(getPrefixKey(entryText.substr(pos)));
+            }
+            
+            sortAndRemoveDuplicates(keys);
+            for( auto key : keys )
+                prefixPairs.push_back(((uint64) key << 32) | i);
+        }
+        
+        s->textStart.push_back((uint32) s->text.size());
+        
+        std::sort(trigramPairs.begin(), trigramPairs.end());
+        if( job.shouldExit() )
+            return nullptr;
+        
+        s->trigramPostings.reserve(trigramPairs.size());
+        for( auto pair : trigramPairs )
+        {
+            auto key = (uint32) (pair >> 32);
+            if( s->trigramKeys.empty() || s->trigramKeys.back() != key )
+            {
+                s->trigramKeys.push_back(key);
+                s->trigramStart.push_back((uint32) s->trigramPostings.size());
+            }
+            
+            s->trigramPostings.push_back((uint32) pair);
+        }
+        
+        s->trigramStart.push_back((uint32) s->trigramPostings.size());
+        
+        std::sort(prefixPairs.begin(), prefixPairs.end());
+        s->prefixStart.assign(numPrefixKeys + 1, 0);
+        s->prefixPostings.reserve(prefixPairs.size());
+        for( auto pair : prefixPairs )
+        {
+            ++s->prefixStart[(pair >> 32) + 1];
+            s->prefixPostings.push_back((uint32) pair);
+        }
+        
+        std::partial_sum(s->prefixStart.begin(), s->prefixStart.end(), s->prefixStart.begin());
+        return s;
+    }
+    
+    Postings getTrigramPostings(uint32 key) const noexcept
+    {
+        auto found = std::lower_bound(trigramKeys.begin(), trigramKeys.end(), key);
+        if( found == trigramKeys.end() || *found != key )
+            return {};
+        
+        auto index = (size_t) std::distance(trigramKeys.begin(), found);
+        return { trigramPostings.data() + trigramStart[index], trigramPostings.data() + trigramStart[index + 1] };
+    }
+    
+    //calls visit with each entry in lists once, in ascending order, until it returns false.  returns false if it did
+    template <typename Visitor>
+    static bool visitInOrder(std::vector<Postings> lists, Visitor&& visit)
+    {
+        auto isLater = [](const Postings& a, const Postings& b) { return *a.first > *b.first; };
+        lists.erase(std::remove_if(lists.begin(), lists.end(), [](auto& p) { return p.size() == 0; }), lists.end());
+        std::make_heap(lists.begin(), lists.end(), isLater);
+        
+        int64 lastEntry = -1;
+        while( ! lists.empty() )
+        {
+            std::pop_heap(lists.begin(), lists.end(), isLater);
+            auto entry = *lists.back().first++;
+            
+            if( lists.back().size() == 0 )
+                lists.pop_back();
+            else
+                std::push_heap(lists.begin(), lists.end(), isLater);
+            
+            if( entry != lastEntry )
+            {
+                lastEntry = entry;
+                if( ! visit(entry) )
+                    return false;
+            }
+        }
+        
+        return true;
+    }
+    
+    Postings getPrefixPostings(uint32 key) const noexcept
+    {
+        return { prefixPostings.data() + prefixStart[key], prefixPostings.data() + prefixStart[key + 1] };
+    }
+    
+    /*
+     a one letter word starts a word in most names, far too many to score on every keystroke.  so
+     this calls visit with the entries it starts a word in, in path order and those where it is a
+     whole word first, until visit returns false.
+     */
+    template <typename Visitor>
+    void visitOneLetterCandidates(std::string_view word, Visitor&& visit) const
+    {
+        jassert(word.size() == 1);
+        
+        //the letter on its own, at the end of a name or before a space or the end of a directory name
+        auto firstKey = getPrefixKey(word);
+        auto wholeWordKey = firstKey | (uint32) ' ';
+        auto wholeDirectoryWordKey = firstKey | (uint32) '/';
+        std::vector<Postings> wholeWords { getPrefixPostings(firstKey), getPrefixPostings(wholeWordKey),
+                                           getPrefixPostings(wholeDirectoryWordKey) };
+        if( ! visitInOrder(wholeWords, visit) )
+            return;
+        
+        std::vector<Postings> wordStarts;
+        for( auto key = firstKey + 1; key <= firstKey + 0xff; ++key )
+        {
+            if( key != wholeWordKey && key != wholeDirectoryWordKey )
+                wordStarts.push_back(getPrefixPostings(key));
+        }
+        
+        visitInOrder(wordStarts, [&](uint32 entry)
+        {
+            for( auto& p : wholeWords )
+            {
+                if( std::binary_search(p.first, p.last, entry) )
+                    return true;
+            }
+            
+            return visit(entry);
+        });
+    }
+    
+    /*
+     every entry that could match word, and usually not many more.  two letter words are looked up
+     by the start of the words in each name and directory name; longer ones by whichever trigrams are rarest, as many of
+     them as the word is allowed to miss plus one, since a match must have at least one of those.
+     */
+    std::vector<uint32> findCandidates(std::string_view word, const std::vector<uint32>& wordTrigrams) const
+    {
+        jassert(word.size() > 1);
+        
+        if( word.size() == 2 )
+        {
+            auto p = getPrefixPostings(getPrefixKey(word));
+            return { p.first, p.last };
+        }
+        
+        std::vector<uint32> candidates;
+        std::vector<Postings> postings;
+        for( auto key : wordTrigrams )
+            postings.push_back(getTrigramPostings(key));
+        
+        std::sort(postings.begin(), postings.end(), [](auto& a, auto& b) { return a.size() < b.size(); });
+        
+        auto numTrigrams = (int) wordTrigrams.size();
+        auto numToMerge = (size_t) (numTrigrams - getNumTrigramsRequired(numTrigrams) + 1);
+        for( size_t i = 0; i < numToMerge; ++i )
+            candidates.insert(candidates.end(), postings[i].first, postings[i].last);
+        
+        if( numToMerge > 1 )
+            sortAndRemoveDuplicates(candidates);
+        
+        return candidates;
+    }
+};
+
+//==============================================================================
+struct LibrarySearch::Query
+{
+    struct Condition
+    {
+        enum Field { channels, sampleRate, length } field;
+        //'<', '>' or '='
+        char comparison;
+        double value;
+        
+        bool matches(const LibraryIndex::Entry& entry) const noexcept
+        {
+            auto actual = field == channels ? (double) entry.numChannels
+                        : field == sampleRate ? entry.sampleRate
+                        : entry.getLengthInSeconds();
+            
+            if( comparison == '<' )
+                return actual < value;
+            if( comparison == '>' )
+                return actual > value;
+            
+            //lengths are compared to the nearest second, because nobody types them any closer
+            auto tolerance = field == length ? 0.5 : 0.01;
+            return std::abs(actual - value) < tolerance;
+        }
+    };
+    
+    struct Word
+    {
+        std::string text;
+        std::vector<uint32> trigrams;
+    };
+    
+    std::vector<Word> words;
+    std::vector<Condition> conditions;
+    
+    bool matchesConditions(const LibraryIndex::Entry& entry) const noexcept
+    {
+        for( auto& condition : conditions )
+        {
+            if( ! condition.matches(entry) )
+                return false;
+        }
+        
+        return true;
+    }
+    
+    static Query parse(const String& queryText)
+    {
+        Query query;
+        
+        for( auto& token : StringArray::fromTokens(queryText, false) )
+        {
+            if( parseCondition(token, query.conditions) )
+                continue;
+            
+            for( auto& word : StringArray::fromTokens(String(CharPointer_UTF8(normalise(token).c_str())), false) )
+            {
+                Word w;
+                w.text = word.toStdString();
+                getTrigrams(w.text, w.trigrams);
+                query.words.push_back(std::move(w));
+            }
+        }
+        
+        return query;
+    }
+    
+    //how well word matches an entry's text, or a negative number if it doesn't
+    static float scoreWord(std::string_view text, const Word& word) noexcept
+    {
+        auto nameStart = text.find('/') + 1;
+        auto name = text.substr(nameStart);
+        auto directory = text.substr(0, nameStart - 1);
+        
+        auto bestScore = -1.0f;
+        for( auto pos = name.find(word.text); pos != std::string_view::npos; pos = name.find(word.text, pos + 1) )
+        {
+            auto end = pos + word.text.size();
+            auto startsWord = pos == 0 || name[pos - 1] == ' ';
+            auto endsWord = end == name.size() || name[end] == ' ';
+            
+            bestScore = jmax(bestScore, startsWord ? (endsWord ? wholeWordScore : wordStartScore) : inNameScore);
+        }
+        
+        if( bestScore >= 0 )
+            return bestScore;
+        
+        if( directory.find(word.text) != std::string_view::npos )
+            return inDirectoryScore;
+        
+        if( word.trigrams.empty() )
+            return -1.0f;
+        
+        int numShared = 0;
+        for( auto key : word.trigrams )
+        {
+            const char trigram[] = { (char) (key >> 16), (char) (key >> 8), (char) key };
+            if( text.find(std::string_view(trigram, 3)) != std::string_view::npos )
+                ++numShared;
+        }
+        
+        auto numTrigrams = (int) word.trigrams.size();
+        if( numShared < getNumTrigramsRequired(numTrigrams) )
+            return -1.0f;
+        
+        return fuzzyMatchScore * (float) numShared / (float) numTrigrams;
+    }
+private:
+    static bool parseCondition(const String& token, std::vector<Condition>& conditions)
+    {
+        auto key = token.upToFirstOccurrenceOf(":", false, false).toLowerCase();
+        auto value = token.fromFirstOccurrenceOf(":", false, false).toLowerCase();
+        
+        Condition condition;
+        if( key == "ch" )
+            condition.field = Condition::channels;
+        else if( key == "sr" )
+            condition.field = Condition::sampleRate;
+        else if( key == "len" )
+            condition.field = Condition::length;
+        else
+            return false;
+        
+        condition.comparison = '=';
+        if( value.startsWithChar('<') || value.startsWithChar('>') )
+        {
+            condition.comparison = (char) value[0];
+            value = value.substring(1);
+        }
+        
+        if( value.isEmpty() || ! value.containsOnly("0123456789.km") )
+            return false;
+        
+        condition.value = value.getDoubleValue();
+        
+        //"sr:48" and "sr:48k" both mean 48000
+        if( condition.field == Condition::sampleRate && (value.endsWithChar('k') || condition.value < 1000.0) )
+            condition.value *= 1000.0;
+        
+        if( condition.field == Condition::length && value.endsWithChar('m') )
+            condition.value *= 60.0;
+        
+        conditions.push_back(condition);
+        return true;
+    }
+};
+
+//==============================================================================
+struct LibrarySearch::RebuildJob : ThreadPoolJob
+{
+    explicit RebuildJob(LibrarySearch& o) : ThreadPoolJob("LibrarySearch rebuild"), owner(o) { }
+    
+    JobStatus runJob() override
+    {
+        owner.rebuild(*this);
+        return jobHasFinished;
+    }
+    
+    LibrarySearch& owner;
+};
+
+struct LibrarySearch::OwnJobsSelector : ThreadPool::JobSelector
+{
+    explicit OwnJobsSelector(LibrarySearch& o) : owner(o) { }
+    bool isJobSuitable(ThreadPoolJob* job) override
+    {
+        auto* rebuildJob = dynamic_cast<RebuildJob*>(job);
+        return rebuildJob != nullptr && &rebuildJob->owner == &owner;
+    }
+    LibrarySearch& owner;
+};
+
+//==============================================================================
+LibrarySearch::LibrarySearch()
+{
+    libraryIndex->changes.addChangeListener(this);
+    timerCallback();
+}
+
+LibrarySearch::LibrarySearch(std::vector<LibraryIndex::Entry> entries)
+{
+    //never added to a pool, so it is never asked to stop
+    RebuildJob job(*this);
+    snapshot = Snapshot::build(std::move(entries), job);
+}
+
+LibrarySearch::~LibrarySearch()
+{
+    stopTimer();
+    libraryIndex->changes.removeChangeListener(this);
+    
+    OwnJobsSelector ownJobs { *this };
+    ioScheduler->getAnalysisPool().removeAllJobs(true, 5000, &ownJobs);
+}
+
+std::vector<LibrarySearch::Result> LibrarySearch::search(const String& queryText, int maxNumResults) const
+{
+    std::vector<Result> results;
+    auto s = getSnapshot();
+    auto query = Query::parse(queryText);
+    if( s == nullptr || (query.words.empty() && query.conditions.empty()) )
+        return results;
+    
+    //score, then index, so that equal scores stay in path order
+    std::vector<std::pair<float, uint32>> matches;
+    
+    if( query.words.empty() )
+    {
+        //nothing to rank by, so the first matches in path order will do
+        for( uint32 i = 0; i < (uint32) s->entries.size() && (int) matches.size() < maxNumResults; ++i )
+        {
+            if( query.matchesConditions(s->entries[i]) )
+                matches.emplace_back(0.0f, i);
+        }
+    }
+    else
+    {
+        //the longest word is the most selective, so it picks the candidates and the rest only check them
+        auto& longestWord = *std::max_element(query.words.begin(),
+                                              query.words.end(),
+                                              [](auto& a, auto& b) { return a.text.size() < b.text.size(); });
+        
+        auto scoreCandidate = [&](uint32 i)
+        {
+            if( ! query.matchesConditions(s->entries[i]) )
+                return;
+            
+            auto text = s->getText(i);
+            auto total = 0.0f;
+            for( auto& word : query.words )
+            {
+                auto score = Query::scoreWord(text, word);
+                if( score < 0 )
+                    return;
+                
+                total += score;
+            }
+            
+            matches.emplace_back(total - nameLengthPenalty * (float) (text.size() - text.find('/')), i);
+        };
+        
+        if( longestWord.text.size() == 1 )
+        {
+            //only the first maxNumResults that match are ranked
+            s->visitOneLetterCandidates(longestWord.text, [&](uint32 i)
+            {
+                scoreCandidate(i);
+                return (int) matches.size() < maxNumResults;
+            });
+        }
+        else
+        {
+            for( auto i : s->findCandidates(longestWord.text, longestWord.trigrams) )
+                scoreCandidate(i);
+        }
+    }
+    
+    auto numResults = jmin(matches.size(), (size_t) jmax(0, maxNumResults));
+    std::partial_sort(matches.begin(), matches.begin() + (std::ptrdiff_t) numResults, matches.end(), [](auto& a, auto& b)
+    {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    
+    results.reserve(numResults);
+    for( size_t i = 0; i < numResults; ++i )
+        results.push_back({ s->entries[matches[i].second], matches[i].first });
+    
+    return results;
+}
+
+int LibrarySearch::getNumFilesSearched() const
+{
+    auto s = getSnapshot();
+    return s != nullptr ? (int) s->entries.size() : 0;
+}
+
+bool LibrarySearch::isUpToDate() const
+{
+    return snapshotVersion.load() == libraryIndex->getVersion();
+}
+
+std::shared_ptr<const LibrarySearch::Snapshot> LibrarySearch::getSnapshot() const
+{
+    const ScopedLock sl(snapshotLock);
+    return snapshot;
+}
+
+void LibrarySearch::rebuild(ThreadPoolJob& job)
+{
+    //taken first, so changes made while the entries are copied still leave it out of date
+    auto version = libraryIndex->getVersion();
+    
+    if( auto newSnapshot = Snapshot::build(libraryIndex->getEntries(), job) )
+    {
+        {
+            const ScopedLock sl(snapshotLock);
+            snapshot = std::move(newSnapshot);
+        }
+        
+        snapshotVersion.store(version);
+        changes.sendChangeMessage();
+    }
+    
+    rebuildIsRunning.store(false);
+}
+
+void LibrarySearch::changeListenerCallback(ChangeBroadcaster*)
+{
+    //the library index changes a file at a time while it is analysing, so rebuilds are batched up
+    if( ! isTimerRunning() )
+        startTimer(minRebuildIntervalMs);
+}
+
+void LibrarySearch::timerCallback()
+{
+    //the one that is running will have missed the latest changes, so the timer keeps going until it's done
+    if( rebuildIsRunning.load() )
+        return;
+    
+    if( isUpToDate() )
+    {
+        stopTimer();
+        return;
+    }
+    
+    rebuildIsRunning.store(true);
+    ioScheduler->getAnalysisPool().addJob(new RebuildJob(*this), true);
+}
@@ -0,0 +1,91 @@
+/*
+  ==============================================================================
+
+    LibrarySearch.h
+    Ranked, typo tolerant search over the LibraryIndex, fast enough to run on
+    every keystroke.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "LibraryIndex.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ Use it through a juce::SharedResourcePointer<LibrarySearch>, like the LibraryIndex it searches.
+ 
+ Each file's name and the name of the directory it is in are indexed by trigram, and the words of
+ both by their first two characters.  A query looks up its longest word in those, which
+ narrows hundreds of thousands of files down to a few hundred candidates, and only the candidates
+ are checked against the rest of the query and ranked.
+ 
+ The search index is an immutable snapshot, rebuilt on the shared analysis pool when the library
+ index changes, at most once every minRebuildIntervalMs.  search() can be called from any thread,
+ and never waits for a rebuild.
+ */
+struct LibrarySearch : private ChangeListener,
+                       private Timer
+{
+    struct Result
+    {
+        LibraryIndex::Entry entry;
+        float score { 0 };
+    };
+    
+    LibrarySearch();
+    //searches entries, which must be in path order, instead of the library index, and is never rebuilt.  for benchmarks
+    explicit LibrarySearch(std::vector<LibraryIndex::Entry> entries);
+    ~LibrarySearch() override;
+    
+    /*
+     words match the start of a word in a file's name best, then anywhere in its name, then the
+     name of its directory.  words of four or more characters still match with a typo in their first
+     or last letter, and the longer a word is the further in, and the more, its typos can be.  words
+     of three characters or fewer only match as typed.
+     a query whose words are all one letter only ranks the first maxNumResults files, in path order,
+     that it matches, those where the letter is a whole word first, since it would match most of them.
+     these narrow the results down by metadata instead:
+        ch:2        channels
+        sr:48k      sample rate, in Hz or kHz
+        len:>30     length in seconds, or minutes with an m.  all three take an optional < or >
+     results are best first.
+     */
+    std::vector<Result> search(const String& query, int maxNumResults = defaultMaxNumResults) const;
+    
+    //the number of files the current snapshot covers
+    int getNumFilesSearched() const;
+    //false while the library index has changes the snapshot doesn't include yet
+    bool isUpToDate() const;
+    
+    //fires on the message thread whenever a rebuilt snapshot is swapped in
+    ChangeBroadcaster changes;
+    
+    static constexpr int defaultMaxNumResults = 200;
+    static constexpr int minRebuildIntervalMs = 1000;
+private:
+    struct Snapshot;
+    struct Query;
+    struct RebuildJob;
+    struct OwnJobsSelector;
+    
+    SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    SharedResourcePointer<LibraryIndex> libraryIndex;
+    
+    //swapped, never modified, so a search only holds the lock long enough to copy the pointer
+    mutable CriticalSection snapshotLock;
+    std::shared_ptr<const Snapshot> snapshot;
+    std::atomic<int> snapshotVersion { -1 };
+    std::atomic<bool> rebuildIsRunning { false };
+    
+    std::shared_ptr<const Snapshot> getSnapshot() const;
+    void rebuild(ThreadPoolJob& job);
+    
+    void changeListenerCallback(ChangeBroadcaster*) override;
+    void timerCallback() override;
+    
+    JUCE_DECLARE_NON_COPYABLE(LibrarySearch)
+};
@@ -0,0 +1,127 @@
+/*
+  ==============================================================================
+
+    MemoryGovernor.cpp
+
+  ==============================================================================
+*/
+
+#include "MemoryGovernor.h"
+
+size_t MemoryGovernor::Usage::getTotal() const noexcept
+{
+    return std::accumulate(bytes.begin(), bytes.end(), (size_t) 0);
+}
+
+void MemoryGovernor::Report::add(MemoryUse use, size_t numBytes, const void* instance)
+{
+    process.bytes[(size_t) use] += numBytes;
+    if( instance != nullptr )
+        byInstance[instance].bytes[(size_t) use] += numBytes;
+}
+
+MemoryGovernor::Usage MemoryGovernor::Report::getInstance(const void* instance) const
+{
+    auto found = byInstance.find(instance);
+    return found != byInstance.end() ? found->second : Usage();
+}
+
+//==============================================================================
+MemoryGovernor::MemoryGovernor()
+{
+    ioScheduler->getDirectoryScanThread().addTimeSliceClient(this);
+}
+
+MemoryGovernor::~MemoryGovernor()
+{
+    ioScheduler->getDirectoryScanThread().removeTimeSliceClient(this);
+    jassert(holders.isEmpty());
+}
+
+void MemoryGovernor::addHolder(Holder* holder)
+{
+    const ScopedLock sl(holdersLock);
+    holders.addIfNotAlreadyThere(holder);
+}
+
+void MemoryGovernor::removeHolder(Holder* holder)
+{
+    const ScopedLock sl(holdersLock);
+    holders.removeFirstMatchingValue(holder);
+}
+
+void MemoryGovernor::addCountedBytes(MemoryUse use, size_t numBytes) noexcept
+{
+    countedBytes[(size_t) use].fetch_add(numBytes, std::memory_order_relaxed);
+}
+
+void MemoryGovernor::removeCountedBytes(MemoryUse use, size_t numBytes) noexcept
+{
+    countedBytes[(size_t) use].fetch_sub(numBytes, std::memory_order_relaxed);
+}
+
+MemoryGovernor::Report MemoryGovernor::getReport() const
+{
+    Report report;
+    for( size_t i = 0; i < countedBytes.size(); ++i )
+        report.process.bytes[i] = countedBytes[i].load(std::memory_order_relaxed);
+    
+    const ScopedLock sl(holdersLock);
+    for( auto* holder : holders )
+        holder->addUsage(report);
+    
+    return report;
+}
+
+bool MemoryGovernor::canFit(size_t numBytes) const
+{
+    return getReport().process.getTotal() + numBytes <= maxBytes.load();
+}
+
+void MemoryGovernor::setMaxBytes(size_t newMaxBytes)
+{
+    maxBytes.store(newMaxBytes);
+    requestEnforce();
+}
+
+void MemoryGovernor::requestEnforce()
+{
+    ioScheduler->getDirectoryScanThread().moveToFrontOfQueue(this);
+}
+
+int MemoryGovernor::useTimeSlice()
+{
+    enforce();
+    return enforceIntervalMs;
+}
+
+void MemoryGovernor::enforce()
+{
+    auto cap = maxBytes.load();
+    auto total = getReport().process.getTotal();
+    
+    const ScopedLock sl(holdersLock);
+    
+    /*
+     freeing memory can destroy holders, and their destructors remove them on this thread, which the
+     lock doesn't stop.  so this goes through a copy, and skips any that are gone by their turn
+     */
+    auto forEachHolder = [this, toVisit = holders](auto&& call)
+    {
+        for( auto* holder : toVisit )
+        {
+            if( holders.contains(holder) )
+                call(*holder);
+        }
+    };
+    
+    auto isOver = total > cap;
+    if( underPressure.exchange(isOver) != isOver )
+        forEachHolder([isOver](Holder& holder) { holder.setUnderPressure(isOver); });
+    
+    for( int use = 0; use < (int) MemoryUse::numUses && total > cap; ++use )
+    {
+        forEachHolder([use, numBytes = total - cap](Holder& holder) { holder.freeMemory((MemoryUse) use, numBytes); });
+        total = getReport().process.getTotal();
+    }
+}
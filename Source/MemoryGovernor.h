@@ -0,0 +1,115 @@
+/*
+  ==============================================================================
+
+    MemoryGovernor.h
+    Accounts for the audio held in memory by every instance in the process,
+    and keeps it under one cap.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SharedIOScheduler.h"
+
+using namespace juce;
+//==============================================================================
+//in the order they are freed in when over the cap: retired sources go first, waveforms never
+enum class MemoryUse
+{
+    //read-ahead of sources the audio thread has let go of, waiting in the release pool
+    retiredSources,
+    //read-ahead of prefetched neighbours that haven't been played
+    warmSources,
+    //files being decoded into the cache, as floats or as they fill in.  freeing it abandons them, and the file streams instead
+    decoding,
+    decodedCache,
+    //read-ahead of sources that are playing, or about to.  can only shrink as new ones are sized
+    readAhead,
+    //waveform pyramids.  only held while something is showing or feeding them
+    waveforms,
+    numUses
+};
+
+/*
+ Use it through a juce::SharedResourcePointer<MemoryGovernor>.
+ 
+ Whatever holds audio memory registers a Holder, which reports what it holds (and which instance
+ it holds it for) and frees what it can when asked.  Memory that is only counted, never freed on
+ request, can be added with addCountedBytes() instead.
+ 
+ Every enforceIntervalMs, and straight after requestEnforce(), the total is checked against the
+ cap on the shared directory scan thread.  Over it, holders are asked to free memory one use at a
+ time, in MemoryUse order, until it is back under, and are told they are under pressure so they
+ hold back on anything new until it is.
+ */
+struct MemoryGovernor : private TimeSliceClient
+{
+    struct Usage
+    {
+        std::array<size_t, (size_t) MemoryUse::numUses> bytes {};
+        
+        size_t operator[](MemoryUse use) const noexcept { return bytes[(size_t) use]; }
+        size_t getTotal() const noexcept;
+    };
+    
+    struct Report
+    {
+        Usage process;
+        //keyed on whatever each instance registers its holders with.  shared memory is only in process
+        std::map<const void*, Usage> byInstance;
+        
+        void add(MemoryUse use, size_t numBytes, const void* instance = nullptr);
+        Usage getInstance(const void* instance) const;
+    };
+    
+    struct Holder
+    {
+        virtual ~Holder() = default;
+        //adds what it holds to report.  called under the governor's lock, so it mustn't call back into it
+        virtual void addUsage(Report& report) const { ignoreUnused(report); }
+        //frees up to numBytes of use, least valuable first.  called on the directory scan thread
+        virtual void freeMemory(MemoryUse use, size_t numBytes) { ignoreUnused(use, numBytes); }
+        //true from a check that finds the total over the cap, until one that finds it under
+        virtual void setUnderPressure(bool isUnderPressure) { ignoreUnused(isUnderPressure); }
+    };
+    
+    MemoryGovernor();
+    ~MemoryGovernor() override;
+    
+    void addHolder(Holder* holder);
+    //waits for a check that is using it to finish
+    void removeHolder(Holder* holder);
+    
+    //realtime safe
+    void addCountedBytes(MemoryUse use, size_t numBytes) noexcept;
+    void removeCountedBytes(MemoryUse use, size_t numBytes) noexcept;
+    
+    Report getReport() const;
+    //whether the total would still be under the cap with numBytes more
+    bool canFit(size_t numBytes) const;
+    
+    void setMaxBytes(size_t newMaxBytes);
+    size_t getMaxBytes() const noexcept { return maxBytes.load(); }
+    bool isUnderPressure() const noexcept { return underPressure.load(); }
+    
+    //checks the total soon, instead of at the next interval.  not realtime safe
+    void requestEnforce();
+    
+    static constexpr size_t defaultMaxBytes = (size_t) 1024 * 1024 * 1024;
+    static constexpr int enforceIntervalMs = 500;
+private:
+    SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    
+    mutable CriticalSection holdersLock;
+    Array<Holder*> holders;
+    std::array<std::atomic<size_t>, (size_t) MemoryUse::numUses> countedBytes {};
+    std::atomic<size_t> maxBytes { defaultMaxBytes };
+    std::atomic<bool> underPressure { false };
+    
+    int useTimeSlice() override;
+    void enforce();
+    
+    JUCE_DECLARE_NON_COPYABLE(MemoryGovernor)
+};
@@ -0,0 +1,168 @@
+/*
+  ==============================================================================
+
+    PerformanceTelemetry.h
+    Lock-free counters and histograms written by the audio and loader threads,
+    and read from anywhere.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+//==============================================================================
+/*
+ counts durations into power-of-two microsecond buckets: bucket 0 holds everything under 2us,
+ bucket n holds [2^n, 2^(n+1)) us and the last bucket holds everything longer.
+ record() is wait-free and never allocates, so it is safe on the audio thread.
+ */
+struct DurationHistogram
+{
+    static constexpr int numBuckets = 26; //the last bucket starts at ~33 seconds
+
+    struct Snapshot
+    {
+        std::array<uint64, numBuckets> counts {};
+        uint64 total { 0 };
+        uint64 maxMicroseconds { 0 };
+
+        //the upper edge of the bucket the percentile falls in, so this errs on the slow side
+        uint64 getPercentileMicroseconds(double percentile) const
+        {
+            if( total == 0 )
+                return 0;
+
+            auto target = (uint64) std::ceil(jlimit(0.0, 100.0, percentile) / 100.0 * (double) total);
+            uint64 seen = 0;
+            for( int i = 0; i < numBuckets; ++i )
+            {
+                seen += counts[(size_t) i];
+                if( seen >= jmax((uint64) 1, target) )
+                    return jmin(maxMicroseconds, (uint64) 1 << (i + 1));
+            }
+
+            return maxMicroseconds;
+        }
+    };
+
+    void record(uint64 microseconds) noexcept
+    {
+        counts[(size_t) getBucketFor(microseconds)].fetch_add(1, std::memory_order_relaxed);
+
+        auto currentMax = maxMicroseconds.load(std::memory_order_relaxed);
+        while( microseconds > currentMax
+              && ! maxMicroseconds.compare_exchange_weak(currentMax, microseconds, std::memory_order_relaxed) )
+        {
+        }
+    }
+
+    void recordTicks(int64 highResolutionTicks) noexcept
+    {
+        record((uint64) jmax(0.0, Time::highResolutionTicksToSeconds(highResolutionTicks) * 1.0e6));
+    }
+
+    Snapshot getSnapshot() const noexcept
+    {
+        Snapshot s;
+        for( size_t i = 0; i < counts.size(); ++i )
+        {
+            s.counts[i] = counts[i].load(std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+
+        s.maxMicroseconds = maxMicroseconds.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    //not atomic as a whole: a record() racing with this may survive it
+    void reset() noexcept
+    {
+        for( auto& c : counts )
+            c.store(0, std::memory_order_relaxed);
+        maxMicroseconds.store(0, std::memory_order_relaxed);
+    }
+private:
+    static int getBucketFor(uint64 microseconds) noexcept
+    {
+        int bucket = 0;
+        while( microseconds > 1 && bucket < numBuckets - 1 )
+        {
+            microseconds >>= 1;
+            ++bucket;
+        }
+
+        return bucket;
+    }
+
+    std::array<std::atomic<uint64>, numBuckets> counts {};
+    std::atomic<uint64> maxMicroseconds { 0 };
+
+    static_assert(std::atomic<uint64>::is_always_lock_free, "the audio thread must not take a lock to record a duration");
+};
+
+/*
+ one per processor instance.
+ the audio thread writes the block counters, the loader job writes the load counters, and the
+ editor (or anything else) reads a Snapshot whenever it likes.
+ */
+struct PerformanceTelemetry
+{
+    //the whole of processBlock, while something is playing
+    DurationHistogram blockTime;
+    //blocks with nothing playing: no source yet, or a stopped transport.  kept apart so they don't hide what playing costs
+    DurationHistogram idleBlockTime;
+    //just the active source's AudioTransportSource, i.e. reading the read-ahead buffer and resampling
+    DurationHistogram transportTime;
+    //blocks that are crossfading from one source to the next
+    DurationHistogram swapBlockTime;
+    //requestTransportForURL() until the new source is handed to the audio thread
+    DurationHistogram loadTime;
+
+    std::atomic<uint64> numBlocks { 0 };
+    //blocks where the source's read-ahead (decoder or buffering) hadn't caught up, so part of it was silence
+    std::atomic<uint64> numUnderruns { 0 };
+    //blocks where the file had to be resampled to the host's rate as it played
+    std::atomic<uint64> numResampledBlocks { 0 };
+    std::atomic<uint64> numSwaps { 0 };
+    //the duration of the host's block at the last prepareToPlay
+    std::atomic<uint64> blockBudgetMicroseconds { 0 };
+    //requests and neighbour prefetches this instance's loader job still has to get through
+    std::atomic<int> loaderQueueDepth { 0 };
+
+    struct Snapshot
+    {
+        DurationHistogram::Snapshot blockTime, idleBlockTime, transportTime, swapBlockTime, loadTime;
+        uint64 numBlocks { 0 }, numUnderruns { 0 }, numResampledBlocks { 0 }, numSwaps { 0 };
+        uint64 blockBudgetMicroseconds { 0 };
+        int loaderQueueDepth { 0 };
+    };
+
+    Snapshot getSnapshot() const noexcept
+    {
+        Snapshot s;
+        s.blockTime = blockTime.getSnapshot();
+        s.idleBlockTime = idleBlockTime.getSnapshot();
+        s.transportTime = transportTime.getSnapshot();
+        s.swapBlockTime = swapBlockTime.getSnapshot();
+        s.loadTime = loadTime.getSnapshot();
+        s.numBlocks = numBlocks.load(std::memory_order_relaxed);
+        s.numUnderruns = numUnderruns.load(std::memory_order_relaxed);
+        s.numResampledBlocks = numResampledBlocks.load(std::memory_order_relaxed);
+        s.numSwaps = numSwaps.load(std::memory_order_relaxed);
+        s.blockBudgetMicroseconds = blockBudgetMicroseconds.load(std::memory_order_relaxed);
+        s.loaderQueueDepth = loaderQueueDepth.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset() noexcept
+    {
+        for( auto* h : { &blockTime, &idleBlockTime, &transportTime, &swapBlockTime, &loadTime } )
+            h->reset();
+
+        for( auto* c : { &numBlocks, &numUnderruns, &numResampledBlocks, &numSwaps } )
+            c->store(0, std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,126 @@
+/*
+  ==============================================================================
+
+    PersistentThumbnailCache.cpp
+
+  ==============================================================================
+*/
+
+#include "PersistentThumbnailCache.h"
+
+//==============================================================================
+PersistentThumbnailCache::PersistentThumbnailCache(int maxNumThumbsInMemory,
+                                                   const File& cacheDirectory,
+                                                   int64 maxBytes) :
+AudioThumbnailCache(maxNumThumbsInMemory),
+directory(cacheDirectory),
+maxBytesOnDisk(maxBytes)
+{
+}
+
+File PersistentThumbnailCache::getDefaultDirectory()
+{
+    auto appData = File::getSpecialLocation(File::userApplicationDataDirectory);
+   #if JUCE_MAC
+    appData = appData.getChildFile("Caches");
+   #endif
+    return appData.getChildFile("AudioFilePlayer").getChildFile("Thumbnails");
+}
+
+int64 PersistentThumbnailCache::getHashFor(const File& file)
+{
+    auto hash = file.getFullPathName().hashCode64();
+    hash = hash * 101 + file.getSize();
+    hash = hash * 101 + file.getLastModificationTime().toMilliseconds();
+    return hash;
+}
+
+std::unique_ptr<InputStream> PersistentThumbnailCache::openCachedData(int64 hashCode, StringRef fileExtension)
+{
+    const ScopedLock sl(diskLock);
+    
+    auto file = getFileFor(hashCode, fileExtension);
+    auto in = std::make_unique<FileInputStream>(file);
+    if( ! in->openedOk() )
+        return nullptr;
+    
+    //trimToSize() evicts by last access
+    file.setLastAccessTime(Time::getCurrentTime());
+    return in;
+}
+
+bool PersistentThumbnailCache::storeCachedData(int64 hashCode,
+                                               StringRef fileExtension,
+                                               const std::function<void(OutputStream&)>& writer)
+{
+    const ScopedLock sl(diskLock);
+    
+    if( ! directory.createDirectory() )
+        return false;
+    
+    //written next to the target and moved into place, so a crash never leaves half an entry behind
+    TemporaryFile temp(getFileFor(hashCode, fileExtension));
+    {
+        FileOutputStream out(temp.getFile());
+        if( ! out.openedOk() )
+            return false;
+        
+        writer(out);
+        out.flush();
+        
+        if( out.getStatus().failed() )
+            return false;
+    }
+    
+    if( ! temp.overwriteTargetFileWithTemporary() )
+        return false;
+    
+    trimToSize();
+    return true;
+}
+
+bool PersistentThumbnailCache::loadNewThumb(AudioThumbnailBase& thumb, int64 hashCode)
+{
+    auto in = openCachedData(hashCode, thumbnailFileExtension);
+    return in != nullptr && thumb.loadFrom(*in);
+}
+
+void PersistentThumbnailCache::saveNewlyFinishedThumbnail(const AudioThumbnailBase& thumb, int64 hashCode)
+{
+    storeCachedData(hashCode, thumbnailFileExtension, [&thumb](OutputStream& out) { thumb.saveTo(out); });
+}
+
+File PersistentThumbnailCache::getFileFor(int64 hashCode, StringRef extension) const
+{
+    return directory.getChildFile(String::toHexString(hashCode) + extension);
+}
+
+//everything in the directory counts towards the limit, whatever kind of entry it is
+void PersistentThumbnailCache::trimToSize()
+{
+    auto files = directory.findChildFiles(File::findFiles, false);
+    
+    int64 totalBytes = 0;
+    for( auto& f : files )
+        totalBytes += f.getSize();
+    
+    if( totalBytes <= maxBytesOnDisk )
+        return;
+    
+    std::sort(files.begin(),
+              files.end(),
+              [](const File& a, const File& b)
+              {
+                  return a.getLastAccessTime() < b.getLastAccessTime();
+              });
+    
+    for( auto& f : files )
+    {
+        if( totalBytes <= maxBytesOnDisk )
+            break;
+        
+        auto size = f.getSize();
+        if( f.deleteFile() )
+            totalBytes -= size;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+  ==============================================================================
+
+    PersistentThumbnailCache.h
+    An AudioThumbnailCache that also keeps finished thumbnails, and any other
+    per-file analysis, on disk.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+//==============================================================================
+/*
+ Finished thumbnails are written to one file each in the cache directory, named after the
+ thumbnail's hash.  A thumbnail that isn't in memory is read back from there the next time it is
+ asked for, so it survives plugin reloads and host restarts.
+ 
+ Other data can be kept alongside them with storeCachedData() and openCachedData(), keyed on a
+ hash and a file extension.  For local files the key should come from getHashFor(), which changes
+ with the file's path, size and modification time, so an edited file never gets stale data back.
+ 
+ The directory is kept under maxBytesOnDisk by deleting the least recently used files whenever
+ something new is saved.  Thread safe.
+ */
+class PersistentThumbnailCache : public AudioThumbnailCache
+{
+public:
+    explicit PersistentThumbnailCache(int maxNumThumbsInMemory,
+                                      const File& cacheDirectory = getDefaultDirectory(),
+                                      int64 maxBytesOnDisk = defaultMaxBytesOnDisk);
+    
+    static constexpr int64 defaultMaxBytesOnDisk = 512 * 1024 * 1024;
+    
+    static File getDefaultDirectory();
+    
+    //keyed on path, size and modification time
+    static int64 getHashFor(const File& file);
+    
+    //nullptr if nothing has been stored under this key, or it has since been evicted
+    std::unique_ptr<InputStream> openCachedData(int64 hashCode, StringRef fileExtension);
+    //writer is called with a stream onto a temporary file, which replaces any previous entry if it succeeds
+    bool storeCachedData(int64 hashCode, StringRef fileExtension, const std::function<void(OutputStream&)>& writer);
+    
+    const File& getDirectory() const noexcept { return directory; }
+protected:
+    bool loadNewThumb(AudioThumbnailBase& thumb, int64 hashCode) override;
+    void saveNewlyFinishedThumbnail(const AudioThumbnailBase& thumb, int64 hashCode) override;
+private:
+    const File directory;
+    const int64 maxBytesOnDisk;
+    
+    //saves, loads and evictions from any thread, including AudioThumbnailCache's own
+    CriticalSection diskLock;
+    
+    File getFileFor(int64 hashCode, StringRef extension) const;
+    void trimToSize();
+    
+    static constexpr const char* thumbnailFileExtension = ".thumb";
+    
+    JUCE_DECLARE_NON_COPYABLE(PersistentThumbnailCache)
+};
@@ -9,14 +9,16 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
-DemoThumbnailComp::DemoThumbnailComp (AudioFormatManager& formatManager,
+DemoThumbnailComp::DemoThumbnailComp (AudioFormatManager& manager,
                                       Slider& slider,
-                                      AudioTransportSource& source)
-: transportSource (source),
+                                      AudioFilePlayerAudioProcessor& processor)
+: audioProcessor (processor),
+formatManager (manager),
 zoomSlider (slider),
-thumbnail (512, formatManager, thumbnailCache)
+thumbnail (512, formatManager, ioScheduler->getThumbnailCache())
 {
     thumbnail.addChangeListener (this);
+    audioProcessor.playerChanges.addChangeListener (this);
     
     addAndMakeVisible (scrollbar);
     scrollbar.setRangeLimits (visibleRange);
@@ -29,45 +31,47 @@ thumbnail (512, formatManager, thumbnailCache)
 
 DemoThumbnailComp::~DemoThumbnailComp()
 {
+    stopBuildingPyramid();
     scrollbar.removeListener (this);
     thumbnail.removeChangeListener (this);
+    audioProcessor.playerChanges.removeChangeListener (this);
 }
 
-void DemoThumbnailComp::setURL (const URL& url)
+void DemoThumbnailComp::setSource (ReferencedTransportSourceData::Ptr newSource)
 {
-    InputSource* inputSource = nullptr;
+    stopBuildingPyramid();
+    thumbnail.clear();
+    source = newSource;
     
-#if ! JUCE_IOS
-    if (url.isLocalFile())
+    if (source != nullptr && source->waveform != nullptr)
     {
-        inputSource = new FileInputSource (url.getLocalFile());
+        pyramid = source->waveform;
+        numPyramidRegionsPainted = 0;
+        waveformImage = {};
+        updatePyramidBuilder();
+        
+        if (getDecodedAudioAtFileRate() == nullptr)
+            openSampleReader (source->currentAudioFile.getLocalFile());
     }
-    else
-#endif
+    else if (source != nullptr)
     {
-        if (inputSource == nullptr)
-            inputSource = new URLInputSource (url);
+        thumbnail.setSource (new URLInputSource (source->currentAudioFile));
     }
     
-    if (inputSource != nullptr)
-    {
-        thumbnail.setSource (inputSource);
-        
-        Range<double> newRange (0.0, thumbnail.getTotalLength());
-        scrollbar.setRangeLimits (newRange);
-        setRange (newRange);
-        
-        startTimerHz (40);
-    }
+    Range<double> newRange (0.0, getTotalLength());
+    scrollbar.setRangeLimits (newRange);
+    setRange (newRange);
+    
+    updateRefreshRate();
 }
 
 URL DemoThumbnailComp::getLastDroppedFile() const noexcept { return lastFileDropped; }
 
 void DemoThumbnailComp::setZoomFactor (double amount)
 {
-    if (thumbnail.getTotalLength() > 0)
+    if (getTotalLength() > 0)
     {
-        auto newScale = jmax (0.001, thumbnail.getTotalLength() * (1.0 - jlimit (0.0, 0.99, amount)));
+        auto newScale = jmax (0.001, getTotalLength() * (1.0 - jlimit (0.0, 0.99, amount)));
         auto timeAtCentre = xToTime ((float) getWidth() / 2.0f);
         
         setRange ({ timeAtCentre - newScale * 0.5, timeAtCentre + newScale * 0.5 });
@@ -76,6 +80,9 @@ void DemoThumbnailComp::setZoomFactor (double amount)
 
 void DemoThumbnailComp::setRange (Range<double> newRange)
 {
+    if (newRange == visibleRange)
+        return;
+    
     visibleRange = newRange;
     scrollbar.setCurrentRange (visibleRange);
     updateCursorPosition();
@@ -92,13 +99,21 @@ void DemoThumbnailComp::paint (Graphics& g)
     g.fillAll (Colours::darkgrey);
     g.setColour (Colours::lightblue);
     
-    if (thumbnail.getTotalLength() > 0.0)
+    if (getTotalLength() > 0.0)
     {
         auto thumbArea = getLocalBounds();
         
         thumbArea.removeFromBottom (scrollbar.getHeight() + 4);
-        thumbnail.drawChannels (g, thumbArea.reduced (2),
-                                visibleRange.getStart(), visibleRange.getEnd(), 1.0f);
+        
+        if (pyramid != nullptr)
+        {
+            auto area = thumbArea.reduced (2);
+            updateWaveformImage (area, g.getInternalContext().getPhysicalPixelScaleFactor());
+            g.drawImage (waveformImage, area.toFloat());
+        }
+        else
+            thumbnail.drawChannels (g, thumbArea.reduced (2),
+                                    visibleRange.getStart(), visibleRange.getEnd(), 1.0f);
     }
     else
     {
@@ -112,10 +127,18 @@ void DemoThumbnailComp::resized()
     scrollbar.setBounds (getLocalBounds().removeFromBottom (14).reduced (2));
 }
 
-void DemoThumbnailComp::changeListenerCallback (ChangeBroadcaster*)
+void DemoThumbnailComp::changeListenerCallback (ChangeBroadcaster* source)
 {
     // this method is called by the thumbnail when it has changed, so we should repaint it..
-    repaint();
+    if (source == &thumbnail)
+    {
+        repaint();
+        return;
+    }
+    
+    //the transport started, stopped or jumped
+    updateCursorPosition();
+    updateRefreshRate();
 }
 
 bool DemoThumbnailComp::isInterestedInFileDrag (const StringArray& /*files*/)
@@ -137,20 +160,20 @@ void DemoThumbnailComp::mouseDown (const MouseEvent& e)
 void DemoThumbnailComp::mouseDrag (const MouseEvent& e)
 {
     if (canMoveTransport())
-        transportSource.setPosition (jmax (0.0, xToTime ((float) e.x)));
+        audioProcessor.setPosition (jmax (0.0, xToTime ((float) e.x)));
 }
 
 void DemoThumbnailComp::mouseUp (const MouseEvent&)
 {
-//    transportSource.start();
+//    audioProcessor.startTransport();
 }
 
 void DemoThumbnailComp::mouseWheelMove (const MouseEvent&, const MouseWheelDetails& wheel)
 {
-    if (thumbnail.getTotalLength() > 0.0)
+    if (getTotalLength() > 0.0)
     {
         auto newStart = visibleRange.getStart() - wheel.deltaX * (visibleRange.getLength()) / 10.0;
-        newStart = jlimit (0.0, jmax (0.0, thumbnail.getTotalLength() - (visibleRange.getLength())), newStart);
+        newStart = jlimit (0.0, jmax (0.0, getTotalLength() - (visibleRange.getLength())), newStart);
         
         if (canMoveTransport())
             setRange ({ newStart, newStart + visibleRange.getLength() });
@@ -177,7 +200,7 @@ double DemoThumbnailComp::xToTime (const float x) const
 
 bool DemoThumbnailComp::canMoveTransport() const noexcept
 {
-    return ! (isFollowingTransport && transportSource.isPlaying());
+    return ! (isFollowingTransport && audioProcessor.isTransportPlaying());
 }
 
 void DemoThumbnailComp::scrollBarMoved (ScrollBar* scrollBarThatHasMoved, double newRangeStart)
@@ -185,7 +208,7 @@ void DemoThumbnailComp::scrollBarMoved (ScrollBar* scrollBarThatHasMoved, double
     if (scrollBarThatHasMoved == &scrollbar)
     {
         if (! (isFollowingTransport &&
-               transportSource.isPlaying()))
+               audioProcessor.isTransportPlaying()))
         {
             setRange (visibleRange.movedToStartAt (newRangeStart));
         }
@@ -194,27 +217,534 @@ void DemoThumbnailComp::scrollBarMoved (ScrollBar* scrollBarThatHasMoved, double
 
 void DemoThumbnailComp::timerCallback()
 {
+    updatePyramidBuilder();
+    
+    if (pyramid != nullptr && pyramid->getNumRegionsReady() != numPyramidRegionsPainted)
+        repaint();
+    
     if (canMoveTransport())
     {
         updateCursorPosition();
     }
     else
     {
-        setRange (visibleRange.movedToStartAt (transportSource.getCurrentPosition() - (visibleRange.getLength() / 2.0)));
+        setRange (visibleRange.movedToStartAt (audioProcessor.getCurrentPosition() - (visibleRange.getLength() / 2.0)));
     }
+    
+    updateRefreshRate();
+}
+
+/*
+ the cursor only moves while the transport is playing, and the waveform only changes while the
+ pyramid is being built.  the rest of the time nothing needs polling: the processor's
+ playerChanges say when to start again.
+ */
+void DemoThumbnailComp::updateRefreshRate()
+{
+    auto hz = 0;
+    if (audioProcessor.isTransportPlaying())
+        hz = playingRefreshRateHz;
+    else if (pyramid != nullptr && ! pyramid->isComplete())
+        hz = buildingRefreshRateHz;
+    
+    if (hz == 0)
+        stopTimer();
+    else if (getTimerInterval() != 1000 / hz)
+        startTimerHz (hz);
 }
 
 void DemoThumbnailComp::updateCursorPosition()
 {
-    currentPositionMarker.setRectangle (Rectangle<float> (timeToX (transportSource.getCurrentPosition()) - 0.75f, 0,
+    currentPositionMarker.setRectangle (Rectangle<float> (timeToX (audioProcessor.getCurrentPosition()) - 0.75f, 0,
                                                           1.5f, (float) (getHeight() - scrollbar.getHeight())));
 }
+/*
+ a short file's decode fills the pyramid as it goes, and a compressed file's decoder fills the
+ regions it plays through.  anything neither of them does (a cached or mapped file, a region the
+ decoder hasn't reached, or a decode that was abandoned part way through) is built here.
+ */
+void DemoThumbnailComp::updatePyramidBuilder()
+{
+    if (pyramid == nullptr || pyramid->isComplete() || pyramid->isBeingFed())
+        return;
+    
+    //a region was given back after this builder had gone past it
+    if (pyramidBuilder != nullptr && pyramidBuilder->hasRunOutOfRegions() && pyramid->hasUnclaimedRegions())
+        pyramidBuilder.reset();
+    
+    if (pyramidBuilder == nullptr)
+        pyramidBuilder = std::make_unique<WaveformPyramidBuilder> (pyramid,
+                                                                   source->currentAudioFile.getLocalFile(),
+                                                                   getDecodedAudioAtFileRate(),
+                                                                   formatManager,
+                                                                   ioScheduler->getAnalysisPool(),
+                                                                   ioScheduler->getThumbnailCache());
+}
+
+DecodedAudio::Ptr DemoThumbnailComp::getDecodedAudioAtFileRate() const
+{
+    if (source == nullptr || source->decodedAudio == nullptr || ! source->decodedAudio->isAtFileRate())
+        return nullptr;
+    
+    return source->decodedAudio;
+}
+
+void DemoThumbnailComp::stopBuildingPyramid()
+{
+    //waits for any region that is half done
+    pyramidBuilder.reset();
+    pyramid = nullptr;
+    sampleReader.reset();
+}
+
+void DemoThumbnailComp::openSampleReader (const File& file)
+{
+    //uncompressed files are mapped, so reading the few samples a deep zoom shows is just a copy
+    if (auto* format = formatManager.findFormatForFileExtension (file.getFileExtension()))
+    {
+        std::unique_ptr<MemoryMappedAudioFormatReader> mapped (format->createMemoryMappedReader (file));
+        if (mapped != nullptr && mapped->mapEntireFile())
+            sampleReader = std::move (mapped);
+    }
+    
+    if (sampleReader == nullptr)
+        sampleReader.reset (formatManager.createReaderFor (file));
+}
+
+double DemoThumbnailComp::getTotalLength() const
+{
+    if (pyramid != nullptr)
+        return (double) pyramid->getLengthInSamples() / pyramid->getSampleRate();
+    
+    return thumbnail.getTotalLength();
+}
+
+/*
+ the image is laid out on a grid of whole columns, each samplesPerPixel long and counted from the
+ start of the file, so scrolling by a whole number of them only moves what is already there and
+ draws the strip that has been uncovered.  anything else (zooming, resizing, more of the pyramid
+ being ready) redraws all of it.
+ it is drawn at the display's resolution, so it stays sharp on high DPI screens.
+ */
+void DemoThumbnailComp::updateWaveformImage (Rectangle<int> area, float scale)
+{
+    auto width = roundToInt ((float) area.getWidth() * scale);
+    auto height = roundToInt ((float) area.getHeight() * scale);
+    if (width <= 0 || height <= 0 || visibleRange.getLength() <= 0)
+        return;
+    
+    auto samplesPerPixel = visibleRange.getLength() * pyramid->getSampleRate() / width;
+    auto numRegionsReady = pyramid->getNumRegionsReady();
+    
+    //scrolling moves both ends of the range, so its length can drift by a rounding error
+    auto canReuse = waveformImage.isValid()
+                 && waveformImage.getWidth() == width
+                 && waveformImage.getHeight() == height
+                 && numRegionsReady == numPyramidRegionsPainted
+                 && std::abs (samplesPerPixel - waveformImageSamplesPerPixel) <= waveformImageSamplesPerPixel * 1.0e-9;
+    
+    if (canReuse)
+        samplesPerPixel = waveformImageSamplesPerPixel;
+    
+    auto firstColumn = (int64) std::floor (visibleRange.getStart() * pyramid->getSampleRate() / samplesPerPixel);
+    auto shift = firstColumn - waveformImageFirstColumn;
+    
+    if (canReuse && shift == 0)
+        return;
+    
+    Rectangle<int> strip (0, 0, width, height);
+    
+    if (canReuse && std::abs (shift) < width)
+    {
+        auto numToKeep = width - (int) std::abs (shift);
+        if (shift > 0)
+        {
+            waveformImage.moveImageSection (0, 0, (int) shift, 0, numToKeep, height);
+            strip = strip.withLeft (numToKeep);
+        }
+        else
+        {
+            waveformImage.moveImageSection ((int) -shift, 0, 0, 0, numToKeep, height);
+            strip = strip.withWidth ((int) -shift);
+        }
+    }
+    else if (waveformImage.getWidth() != width || waveformImage.getHeight() != height)
+    {
+        waveformImage = Image (Image::ARGB, width, height, true);
+    }
+    
+    waveformImage.clear (strip);
+    waveformImageFirstColumn = firstColumn;
+    waveformImageSamplesPerPixel = samplesPerPixel;
+    numPyramidRegionsPainted = numRegionsReady;
+    
+    Graphics g (waveformImage);
+    g.reduceClipRegion (strip);
+    renderWaveform (g, strip, firstColumn, samplesPerPixel);
+}
+
+/*
+ one column per pixel, each taken from the pyramid level with the fewest points that still has at
+ least one per pixel, so this costs the same at any zoom and for any length of file.
+ closer in than the pyramid's finest level, the samples themselves are read.
+ columns whose regions haven't been analysed yet are left empty until they have.
+ */
+void DemoThumbnailComp::renderWaveform (Graphics& g, Rectangle<int> area, int64 firstColumn, double samplesPerPixel)
+{
+    auto numChannels = pyramid->getNumChannels();
+    auto width = area.getWidth();
+    if (numChannels <= 0 || width <= 0)
+        return;
+    
+    //x = 0 is column firstColumn, so area starts area.getX() columns after it
+    auto startSample = (double) (firstColumn + area.getX()) * samplesPerPixel;
+    auto level = pyramid->chooseLevelFor (samplesPerPixel);
+    
+    auto firstVisibleSample = jmax ((int64) 0, (int64) std::floor (startSample));
+    auto endVisibleSample = jmin (pyramid->getLengthInSamples(), (int64) std::ceil (startSample + samplesPerPixel * width) + 1);
+    auto numVisibleSamples = (int) jmax ((int64) 0, endVisibleSample - firstVisibleSample);
+    
+    auto decoded = getDecodedAudioAtFileRate();
+    auto useSamples = level < 0 && (decoded != nullptr || sampleReader != nullptr);
+    if (useSamples)
+    {
+        visibleSamples.setSize (numChannels, numVisibleSamples, false, false, true);
+        
+        if (decoded != nullptr)
+        {
+            decoded->samples.read (visibleSamples, 0, (int) firstVisibleSample, numVisibleSamples);
+        }
+        else
+        {
+            sampleReader->read (&visibleSamples, 0, numVisibleSamples, firstVisibleSample, true, true);
+        }
+    }
+    
+    auto getColumn = [&] (int channel, int64 start, int64 end)
+    {
+        if (! useSamples)
+            return pyramid->getColumn (channel, jmax (0, level), start, end);
+        
+        WaveformPyramid::Column column;
+        auto offset = (int) jlimit ((int64) 0, (int64) numVisibleSamples, start - firstVisibleSample);
+        auto num = (int) jlimit ((int64) 0, (int64) (numVisibleSamples - offset), end - start);
+        if (num <= 0)
+            return column;
+        
+        auto* samples = visibleSamples.getReadPointer (channel, offset);
+        auto range = FloatVectorOperations::findMinAndMax (samples, num);
+        double sumOfSquares = 0;
+        for (int i = 0; i < num; ++i)
+            sumOfSquares += (double) samples[i] * samples[i];
+        
+        column.min = range.getStart();
+        column.max = range.getEnd();
+        column.rms = (float) std::sqrt (sumOfSquares / num);
+        column.isEmpty = false;
+        return column;
+    };
+    
+    auto waveformColour = Colours::lightblue;
+    auto channelHeight = (float) area.getHeight() / (float) numChannels;
+    
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        auto halfHeight = channelHeight * 0.5f;
+        auto centreY = (float) area.getY() + channelHeight * (float) ch + halfHeight;
+        
+        //individual samples are further apart than a pixel: join them up
+        if (useSamples && samplesPerPixel < 1.0)
+        {
+            Path path;
+            auto* samples = visibleSamples.getReadPointer (ch);
+            for (int i = 0; i < numVisibleSamples; ++i)
+            {
+                auto x = (float) area.getX() + (float) ((double) firstVisibleSample + i - startSample) / (float) samplesPerPixel;
+                auto y = centreY - jlimit (-1.0f, 1.0f, samples[i]) * halfHeight;
+                
+                if (i == 0)
+                    path.startNewSubPath (x, y);
+                else
+                    path.lineTo (x, y);
+            }
+            
+            g.setColour (waveformColour);
+            g.strokePath (path, PathStrokeType (1.0f));
+            continue;
+        }
+        
+        RectangleList<float> peaks, rmsBands;
+        for (int x = 0; x < width; ++x)
+        {
+            auto start = (int64) (startSample + samplesPerPixel * x);
+            auto end = jmax (start + 1, (int64) (startSample + samplesPerPixel * (x + 1)));
+            auto column = getColumn (ch, start, end);
+            if (column.isEmpty)
+                continue;
+            
+            auto left = (float) (area.getX() + x);
+            auto top = centreY - jlimit (-1.0f, 1.0f, column.max) * halfHeight;
+            auto bottom = centreY - jlimit (-1.0f, 1.0f, column.min) * halfHeight;
+            peaks.addWithoutMerging ({ left, top, 1.0f, jmax (1.0f, bottom - top) });
+            
+            auto rmsHeight = jmin (1.0f, column.rms) * halfHeight;
+            rmsBands.addWithoutMerging ({ left, centreY - rmsHeight, 1.0f, rmsHeight * 2.0f });
+        }
+        
+        g.setColour (waveformColour.withAlpha (0.6f));
+        g.fillRectList (peaks);
+        g.setColour (waveformColour);
+        g.fillRectList (rmsBands);
+    }
+}
+//==============================================================================
+PerformanceOverlay::PerformanceOverlay (AudioFilePlayerAudioProcessor& processor)
+: audioProcessor (processor)
+{
+    setInterceptsMouseClicks (false, false);
+}
+
+void PerformanceOverlay::paint (Graphics& g)
+{
+    g.fillAll (Colours::black.withAlpha (0.7f));
+    g.setColour (Colours::white);
+    g.setFont (Font (Font::getDefaultMonospacedFontName(), 12.0f, Font::plain));
+    
+    auto r = getLocalBounds().reduced (6, 4);
+    for (auto& line : getLines())
+        g.drawText (line, r.removeFromTop (16), Justification::centredLeft, true);
+}
+
+void PerformanceOverlay::visibilityChanged()
+{
+    if (isVisible())
+    {
+        timerCallback();
+        startTimerHz (4);
+    }
+    else
+    {
+        stopTimer();
+    }
+}
+
+void PerformanceOverlay::timerCallback()
+{
+    snapshot = audioProcessor.telemetry.getSnapshot();
+    repaint();
+}
+
+StringArray PerformanceOverlay::getLines() const
+{
+    auto us = [] (uint64 microseconds) { return String ((int64) microseconds) + "us"; };
+    auto ms = [] (uint64 microseconds) { return String ((double) microseconds / 1000.0, 1) + "ms"; };
+    
+    auto& block = snapshot.blockTime;
+    auto& idle = snapshot.idleBlockTime;
+    auto& transport = snapshot.transportTime;
+    auto& swap = snapshot.swapBlockTime;
+    auto& load = snapshot.loadTime;
+    
+    auto resampledPercent = snapshot.numBlocks > 0 ? 100.0 * (double) snapshot.numResampledBlocks / (double) snapshot.numBlocks : 0.0;
+    
+    StringArray lines;
+    lines.add ("block      p50 " + us (block.getPercentileMicroseconds (50)) + "  p99 " + us (block.getPercentileMicroseconds (99))
+               + "  max " + us (block.maxMicroseconds) + "  budget " + us (snapshot.blockBudgetMicroseconds));
+    lines.add ("transport  p50 " + us (transport.getPercentileMicroseconds (50)) + "  p99 " + us (transport.getPercentileMicroseconds (99))
+               + "  max " + us (transport.maxMicroseconds) + "  resampling " + String (resampledPercent, 0) + "%");
+    lines.add ("underruns  " + String ((int64) snapshot.numUnderruns) + " of " + String ((int64) snapshot.numBlocks) + " blocks, "
+               + String ((int64) idle.total) + " idle (not in the block times, p99 " + us (idle.getPercentileMicroseconds (99)) + ")");
+    lines.add ("swaps      " + String ((int64) snapshot.numSwaps) + "  crossfade block p99 " + us (swap.getPercentileMicroseconds (99))
+               + "  max " + us (swap.maxMicroseconds));
+    lines.add ("loads      p50 " + ms (load.getPercentileMicroseconds (50)) + "  p99 " + ms (load.getPercentileMicroseconds (99))
+               + "  max " + ms (load.maxMicroseconds));
+    lines.add ("loader     " + String (snapshot.loaderQueueDepth) + " queued here, "
+               + String (ioScheduler->getLoaderPool().getNumJobs()) + " jobs in the shared pool");
+    
+    auto mb = [] (size_t bytes) { return String ((double) bytes / (1024.0 * 1024.0), 1) + "MB"; };
+    auto readAhead = audioProcessor.getReadAheadStatus();
+    auto readAheadHere = readAhead.numSamples > 0 ? String (readAhead.seconds, 2) + "s " + mb (readAhead.numBytes) : String ("none");
+    if (readAhead.storageRealtimeFactor > 0)
+        readAheadHere << ", storage " << String (readAhead.storageRealtimeFactor, 0) << "x real time";
+    
+    lines.add ("read-ahead " + readAheadHere + "  " + mb (readAhead.processBytesInUse) + " of " + mb (readAhead.processMaxBytes) + " in use");
+    
+    auto memoryHere = audioProcessor.getMemoryUsage (false);
+    auto memory = audioProcessor.getMemoryUsage (true);
+    lines.add ("memory     " + mb (memoryHere.getTotal()) + " here, " + mb (memory.getTotal()) + " of " + mb (audioProcessor.getMemoryCap())
+               + " in the process (cache " + mb (memory[MemoryUse::decodedCache]) + ", waveforms " + mb (memory[MemoryUse::waveforms]) + ")");
+    return lines;
+}
+//==============================================================================
+LibrarySearchComp::LibrarySearchComp()
+{
+    addAndMakeVisible (searchBox);
+    searchBox.setTextToShowWhenEmpty ("Search the library, e.g. kick ch:1 len:<2", Colours::grey);
+    searchBox.onTextChange = [this] { runQuery(); };
+    searchBox.onEscapeKey = [this] { searchBox.setText ({}, true); };
+    searchBox.onReturnKey = [this]
+    {
+        if (! results.empty())
+            resultsList.selectRow (0);
+    };
+    
+    addAndMakeVisible (statusLabel);
+    statusLabel.setFont (Font (12.0f, Font::plain));
+    statusLabel.setJustificationType (Justification::centredRight);
+    
+    addChildComponent (resultsList);
+    resultsList.setRowHeight (22);
+    resultsList.setColour (ListBox::backgroundColourId, Colours::lightgrey.withAlpha (0.6f));
+    
+    librarySearch->changes.addChangeListener (this);
+    updateStatus();
+}
+
+LibrarySearchComp::~LibrarySearchComp()
+{
+    librarySearch->changes.removeChangeListener (this);
+}
+
+bool LibrarySearchComp::hasQuery() const
+{
+    return searchBox.getText().trim().isNotEmpty();
+}
+
+File LibrarySearchComp::getResultFile (int row) const
+{
+    if (! isPositiveAndBelow (row, (int) results.size()))
+        return {};
+    
+    return results[(size_t) row].entry.file;
+}
+
+Array<URL> LibrarySearchComp::getResultsNextTo (int row, int maxDistance) const
+{
+    Array<URL> neighbours;
+    for (int distance = 1; distance <= maxDistance; ++distance)
+    {
+        for (auto neighbourRow : { row - distance, row + distance })
+        {
+            if (isPositiveAndBelow (neighbourRow, (int) results.size()))
+                neighbours.add (URL (getResultFile (neighbourRow)));
+        }
+    }
+    
+    return neighbours;
+}
+
+void LibrarySearchComp::resized()
+{
+    auto r = getLocalBounds();
+    auto top = r.removeFromTop (searchBoxHeight);
+    statusLabel.setBounds (top.removeFromRight (jmin (240, top.getWidth() / 2)));
+    searchBox.setBounds (top);
+    
+    r.removeFromTop (4);
+    resultsList.setBounds (r);
+}
+
+void LibrarySearchComp::runQuery()
+{
+    auto hadQuery = resultsList.isVisible();
+    auto selectedFile = getResultFile (resultsList.getSelectedRow());
+    
+    auto start = Time::getHighResolutionTicks();
+    results = hasQuery() ? librarySearch->search (searchBox.getText()) : std::vector<LibrarySearch::Result>();
+    lastSearchMilliseconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start) * 1000.0;
+    
+    {
+        const ScopedValueSetter<bool> updating (isUpdatingResults, true);
+        resultsList.deselectAllRows();
+        resultsList.updateContent();
+        
+        if (selectedFile != File())
+        {
+            for (size_t i = 0; i < results.size(); ++i)
+            {
+                if (results[i].entry.file == selectedFile)
+                {
+                    resultsList.selectRow ((int) i);
+                    break;
+                }
+            }
+        }
+    }
+    
+    resultsList.repaint();
+    resultsList.setVisible (hasQuery());
+    updateStatus();
+    
+    if (hadQuery != hasQuery() && onHasQueryChanged != nullptr)
+        onHasQueryChanged();
+}
+
+void LibrarySearchComp::updateStatus()
+{
+    String status = String (librarySearch->getNumFilesSearched()) + " files";
+    if (! librarySearch->isUpToDate())
+        status << ", indexing";
+    
+    if (hasQuery())
+        status = String ((int) results.size()) + " found in " + String (lastSearchMilliseconds, 1) + " ms, " + status;
+    
+    statusLabel.setText (status, dontSendNotification);
+}
+
+int LibrarySearchComp::getNumRows()
+{
+    return (int) results.size();
+}
+
+void LibrarySearchComp::paintListBoxItem (int row, Graphics& g, int width, int height, bool rowIsSelected)
+{
+    if (! isPositiveAndBelow (row, (int) results.size()))
+        return;
+    
+    auto& entry = results[(size_t) row].entry;
+    if (rowIsSelected)
+        g.fillAll (getUIColourIfAvailable (LookAndFeel_V4::ColourScheme::UIColour::highlightedFill));
+    
+    auto textColour = rowIsSelected ? getUIColourIfAvailable (LookAndFeel_V4::ColourScheme::UIColour::highlightedText, Colours::white)
+                                    : Colours::black;
+    auto r = Rectangle<int> (width, height).reduced (4, 0);
+    auto seconds = roundToInt (entry.getLengthInSeconds());
+    
+    g.setFont (Font (13.0f, Font::plain));
+    g.setColour (textColour.withAlpha (0.7f));
+    g.drawText (String (entry.numChannels) + "ch  " + String (entry.sampleRate / 1000.0, 1) + " kHz  "
+                + String::formatted ("%d:%02d", seconds / 60, seconds % 60),
+                r.removeFromRight (130), Justification::centredRight, true);
+    
+    auto name = entry.file.getFileName();
+    auto nameArea = r.removeFromLeft (jmin (r.getWidth(), g.getCurrentFont().getStringWidth (name) + 8));
+    g.setColour (textColour);
+    g.drawText (name, nameArea, Justification::centredLeft, true);
+    
+    g.setColour (textColour.withAlpha (0.5f));
+    g.drawText (entry.file.getParentDirectory().getFileName(), r, Justification::centredLeft, true);
+}
+
+void LibrarySearchComp::selectedRowsChanged (int lastRowSelected)
+{
+    if (isUpdatingResults || lastRowSelected < 0)
+        return;
+    
+    if (onResultChosen != nullptr)
+        onResultChosen (lastRowSelected);
+}
+
+void LibrarySearchComp::changeListenerCallback (ChangeBroadcaster*)
+{
+    //a rebuilt index may have new matches for the same query
+    runQuery();
+}
 //==============================================================================
 AudioFilePlayerAudioProcessorEditor::AudioFilePlayerAudioProcessorEditor(AudioFilePlayerAudioProcessor& p) :
 AudioProcessorEditor (&p),
 audioProcessor (p),
 //transportSource(p.transportSource)
-directoryList(nullptr, audioProcessor.directoryScannerBackgroundThread)
+libraryBrowser (File::getSpecialLocation (File::userHomeDirectory), p.formatManager.getWildcardForAllFormats())
 {
     addAndMakeVisible (zoomLabel);
     zoomLabel.setFont (Font (15.00f, Font::plain));
@@ -226,13 +756,41 @@ directoryList(nullptr, audioProcessor.directoryScannerBackgroundThread)
     addAndMakeVisible (followTransportButton);
     followTransportButton.onClick = [this] { updateFollowTransportState(); };
     
-    directoryList.setDirectory (File::getSpecialLocation (File::userHomeDirectory), true, true);
+    addAndMakeVisible (performanceButton);
+    performanceButton.onClick = [this] { performanceOverlay.setVisible (performanceButton.getToggleState()); };
+    
+    //item ids are the ResamplingQuality values, plus one
+    addAndMakeVisible (resamplingQualityBox);
+    resamplingQualityBox.addItem ("Browsing quality", (int) ResamplingQuality::browsing + 1);
+    resamplingQualityBox.addItem ("Playback quality", (int) ResamplingQuality::playback + 1);
+    resamplingQualityBox.addItem ("Offline quality (converted when cached)", (int) ResamplingQuality::offline + 1);
+    resamplingQualityBox.setTooltip ("How files that aren't at the host's sample rate are resampled");
+    resamplingQualityBox.setSelectedId ((int) audioProcessor.getResamplingQuality() + 1, dontSendNotification);
+    resamplingQualityBox.onChange = [this]
+    {
+        audioProcessor.setResamplingQuality ((ResamplingQuality) (resamplingQualityBox.getSelectedId() - 1));
+    };
     
-    addAndMakeVisible (fileTreeComp);
+    libraryIndex->setRootDirectory (File::getSpecialLocation (File::userHomeDirectory));
     
+    addAndMakeVisible (librarySearchComp);
+    librarySearchComp.onResultChosen = [this] (int row)
+    {
+        audioProcessor.transportSourceCreator.requestTransportForURL (URL (librarySearchComp.getResultFile (row)),
+                                                                      librarySearchComp.getResultsNextTo (row, numNeighboursToPrefetch));
+    };
+    librarySearchComp.onHasQueryChanged = [this]
+    {
+        libraryBrowser.setVisible (! librarySearchComp.hasQuery());
+        resized();
+    };
     
-    fileTreeComp.setColour (FileTreeComponent::backgroundColourId, Colours::lightgrey.withAlpha (0.6f));
-    fileTreeComp.addListener (this);
+    addAndMakeVisible (libraryBrowser);
+    libraryBrowser.onFileChosen = [this] (const File& file)
+    {
+        audioProcessor.transportSourceCreator.requestTransportForURL (URL (file),
+                                                                      libraryBrowser.getFilesNextToSelection (numNeighboursToPrefetch));
+    };
     
     addAndMakeVisible (explanation);
     explanation.setFont (Font (14.00f, Font::plain));
@@ -248,9 +806,12 @@ directoryList(nullptr, audioProcessor.directoryScannerBackgroundThread)
     
     thumbnail.reset (new DemoThumbnailComp (audioProcessor.formatManager,
                                             zoomSlider,
-                                            audioProcessor.transportSource));
+                                            audioProcessor));
     addAndMakeVisible (thumbnail.get());
     thumbnail->addChangeListener (this); //listen for dragAndDrop activities
+    audioProcessor.playerChanges.addChangeListener (this);
+    
+    addChildComponent (performanceOverlay);
     /*
      Problem:
         there is no means of refreshing the startStopButton when playback is started or stopped
@@ -261,17 +822,17 @@ directoryList(nullptr, audioProcessor.directoryScannerBackgroundThread)
      
      */
 //    audioProcessor.transportSource.addChangeListener(this);
-    
+
     startStopButton.setClickingTogglesState(true);
     addAndMakeVisible (startStopButton);
     startStopButton.setColour (TextButton::buttonColourId, Colour (0xff79ed7f));
     startStopButton.setColour (TextButton::textColourOffId, Colours::black);
     startStopButton.onClick = [this] { startOrStop(); };
 //    startStopButton.setEnabled( audioProcessor.transportSource.getTotalLength() > 0);
-    
-    
-    
-    startTimerHz(50);
+
+
+
+    updateFromProcessor();
     setOpaque (true);
     setSize (500, 500);
 }
@@ -280,10 +841,9 @@ AudioFilePlayerAudioProcessorEditor::~AudioFilePlayerAudioProcessorEditor()
 {
 //    audioProcessor.transportSource.removeChangeListener(this);
 //    transportSource  .setSource (nullptr); //TODO: figure out where this should go.
-    
-    fileTreeComp.removeListener (this);
-    
+
     thumbnail->removeChangeListener (this);
+    audioProcessor.playerChanges.removeChangeListener (this);
 }
 
 void AudioFilePlayerAudioProcessorEditor::paint (Graphics& g)
@@ -306,16 +866,31 @@ void AudioFilePlayerAudioProcessorEditor::resized()
     zoomLabel .setBounds (zoom.removeFromLeft (50));
     zoomSlider.setBounds (zoom);
     
-    followTransportButton.setBounds (controls.removeFromTop (25));
+    auto toggles = controls.removeFromTop (25);
+    followTransportButton.setBounds (toggles.removeFromLeft (toggles.getWidth() / 3));
+    performanceButton    .setBounds (toggles.removeFromLeft (toggles.getWidth() / 2));
+    resamplingQualityBox .setBounds (toggles.reduced (0, 1));
     startStopButton      .setBounds (controls);
     
     r.removeFromBottom (6);
     
     
     thumbnail->setBounds (r.removeFromBottom (140));
+    performanceOverlay.setBounds (thumbnail->getBounds());
     r.removeFromBottom (6);
     
-    fileTreeComp.setBounds (r);
+    //while there is a query, its results take the browser's place
+    if (librarySearchComp.hasQuery())
+    {
+        librarySearchComp.setBounds (r);
+    }
+    else
+    {
+        librarySearchComp.setBounds (r.removeFromTop (LibrarySearchComp::searchBoxHeight));
+        r.removeFromTop (4);
+    }
+    
+    libraryBrowser.setBounds (r);
 }
 
 //==============================================================================
@@ -324,11 +899,11 @@ void AudioFilePlayerAudioProcessorEditor::startOrStop()
     auto shouldPlay = startStopButton.getToggleState();
     if( shouldPlay )
     {
-        audioProcessor.transportSource.start();
+        audioProcessor.startTransport();
     }
     else
     {
-        audioProcessor.transportSource.stop();
+        audioProcessor.stopTransport();
     }
 }
 
@@ -337,51 +912,43 @@ void AudioFilePlayerAudioProcessorEditor::updateFollowTransportState()
     thumbnail->setFollowsTransport (followTransportButton.getToggleState());
 }
 
-void AudioFilePlayerAudioProcessorEditor::selectionChanged()
-{
-    audioProcessor.transportSourceCreator.requestTransportForURL(URL (fileTreeComp.getSelectedFile()));
-}
-
-void AudioFilePlayerAudioProcessorEditor::fileClicked (const File&, const MouseEvent&)          {}
-void AudioFilePlayerAudioProcessorEditor::fileDoubleClicked (const File&)                       {}
-void AudioFilePlayerAudioProcessorEditor::browserRootChanged (const File&)                      {}
-
 void AudioFilePlayerAudioProcessorEditor::changeListenerCallback (ChangeBroadcaster* source)
 {
     if (source == thumbnail.get())
     {
         audioProcessor.transportSourceCreator.requestTransportForURL(URL(thumbnail->getLastDroppedFile()));
     }
+    else if (source == &audioProcessor.playerChanges)
+    {
+        updateFromProcessor();
+    }
 }
 
-void AudioFilePlayerAudioProcessorEditor::timerCallback()
+void AudioFilePlayerAudioProcessorEditor::updateFromProcessor()
 {
-    if( audioProcessor.sourceHasChanged.compareAndSetBool(false, true) )
+    auto src = audioProcessor.getCurrentSource();
+    bool hasValidSource = src.get() != nullptr;
+    if( hasValidSource )
     {
-        auto& src = audioProcessor.activeSource; //a local copy.  causes a data race, which is weird because activeSource is reference counted, and the reference counting is atomic..
-        bool hasValidSource = src.get() != nullptr;
-        if( hasValidSource )
+        if( src.get() != activeSource.get() )
         {
-            if( src.get() != activeSource.get() )
-            {
-                //we have a new source!
-                //update the file path in the APVTS.
-                //update the thumbnail.
-                AudioFilePlayerAudioProcessor::refreshCurrentFileInAPVTS(audioProcessor.apvts, src->currentAudioFile);
-                activeSource = src;
-                
-                zoomSlider.setValue (0, dontSendNotification);
+            //we have a new source!
+            //update the file path in the APVTS.
+            //update the thumbnail.
+            AudioFilePlayerAudioProcessor::refreshCurrentFileInAPVTS(audioProcessor.apvts, src->currentAudioFile);
+            activeSource = src;
             
-                thumbnail->setURL (activeSource->currentAudioFile);
-            }
+            zoomSlider.setValue (0, dontSendNotification);
+            
+            thumbnail->setSource (activeSource);
         }
-
-        startStopButton.setEnabled( hasValidSource );
     }
     
+    startStopButton.setEnabled( hasValidSource );
+    
     //update the startStopButton
-    auto isPlaying = audioProcessor.transportSource.isPlaying();
-    if( audioProcessor.transportSource.getTotalLength() > 0 )
+    auto isPlaying = audioProcessor.isTransportPlaying();
+    if( audioProcessor.getLengthInSeconds() > 0 )
         startStopButton.setButtonText( ! isPlaying ? "Start" : "Stop" );
     
     startStopButton.setToggleState(isPlaying, dontSendNotification);
@@ -1,8 +1,8 @@
 /*
  ==============================================================================
- 
+
  This file contains the basic framework code for a JUCE plugin editor.
- 
+
  ==============================================================================
  */
 
@@ -10,6 +10,10 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "WaveformPyramid.h"
+#include "LibraryIndex.h"
+#include "LibrarySearch.h"
+#include "LibraryBrowser.h"
 
 using namespace juce;
 
@@ -31,11 +35,11 @@ private Timer
 public:
     DemoThumbnailComp (AudioFormatManager& formatManager,
                        Slider& slider,
-                       AudioTransportSource& source);
+                       AudioFilePlayerAudioProcessor& processor);
     
     ~DemoThumbnailComp() override;
     
-    void setURL (const URL& url);
+    void setSource (ReferencedTransportSourceData::Ptr newSource);
     
     URL getLastDroppedFile() const noexcept;
     
@@ -63,12 +67,27 @@ public:
     
     void mouseWheelMove (const MouseEvent&, const MouseWheelDetails& wheel) override;
 private:
-    AudioTransportSource& transportSource;
+    AudioFilePlayerAudioProcessor& audioProcessor;
+    AudioFormatManager& formatManager;
     Slider& zoomSlider;
     ScrollBar scrollbar  { false };
     
-    AudioThumbnailCache thumbnailCache  { 5 };
+    SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    ReferencedTransportSourceData::Ptr source;
+    //for remote files.  local files are drawn from the source's pyramid, which streams in a region at a time
     AudioThumbnail thumbnail;
+    
+    WaveformPyramid::Ptr pyramid;
+    //only for what decoding the file to play it doesn't fill
+    std::unique_ptr<WaveformPyramidBuilder> pyramidBuilder;
+    int numPyramidRegionsPainted = 0;
+    //for zoom levels finer than the pyramid's finest level, unless the source is already decoded
+    std::unique_ptr<AudioFormatReader> sampleReader;
+    AudioBuffer<float> visibleSamples;
+    //the visible part of the pyramid, at the display's resolution.  see updateWaveformImage()
+    Image waveformImage;
+    int64 waveformImageFirstColumn = 0;
+    double waveformImageSamplesPerPixel = 0;
     Range<double> visibleRange;
     bool isFollowingTransport = false;
     URL lastFileDropped;
@@ -86,12 +105,104 @@ private:
     void timerCallback() override;
     
     void updateCursorPosition();
+    
+    void updateRefreshRate();
+    static constexpr int playingRefreshRateHz = 40;
+    static constexpr int buildingRefreshRateHz = 10;
+    
+    void updatePyramidBuilder();
+    
+    void stopBuildingPyramid();
+    
+    void openSampleReader (const File& file);
+    
+    //the waveform is at the file's rate, so cached samples converted to the host's rate are no use to it
+    DecodedAudio::Ptr getDecodedAudioAtFileRate() const;
+    
+    double getTotalLength() const;
+    
+    void updateWaveformImage (Rectangle<int> area, float scale);
+    
+    void renderWaveform (Graphics& g, Rectangle<int> area, int64 firstColumn, double samplesPerPixel);
+};
+
+/*
+ draws the processor's PerformanceTelemetry over whatever is underneath it.
+ only polls while it is showing.
+ */
+class PerformanceOverlay : public Component,
+private Timer
+{
+public:
+    explicit PerformanceOverlay (AudioFilePlayerAudioProcessor& processor);
+    
+    void paint (Graphics& g) override;
+    
+    void visibilityChanged() override;
+private:
+    AudioFilePlayerAudioProcessor& audioProcessor;
+    SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    PerformanceTelemetry::Snapshot snapshot;
+    
+    void timerCallback() override;
+    
+    StringArray getLines() const;
+};
+
+/*
+ a search box over the library index.  while it has a query, the matching files are listed under
+ it, best first, and searched again on every keystroke and whenever the index is rebuilt.
+ */
+class LibrarySearchComp : public Component,
+private ListBoxModel,
+private ChangeListener
+{
+public:
+    LibrarySearchComp();
+    
+    ~LibrarySearchComp() override;
+    
+    bool hasQuery() const;
+    
+    File getResultFile (int row) const;
+    
+    //the results either side of row, nearest first
+    Array<URL> getResultsNextTo (int row, int maxDistance) const;
+    
+    //called with the row of the result the user picked
+    std::function<void (int row)> onResultChosen;
+    //called when the search box goes from empty to not, or back
+    std::function<void()> onHasQueryChanged;
+    
+    void resized() override;
+    
+    static constexpr int searchBoxHeight = 24;
+private:
+    SharedResourcePointer<LibrarySearch> librarySearch;
+    TextEditor searchBox;
+    Label statusLabel;
+    ListBox resultsList { {}, this };
+    
+    std::vector<LibrarySearch::Result> results;
+    double lastSearchMilliseconds = 0;
+    //set while the list is repopulated, so reselecting the same file doesn't load it again
+    bool isUpdatingResults = false;
+    
+    void runQuery();
+    
+    void updateStatus();
+    
+    int getNumRows() override;
+    
+    void paintListBoxItem (int row, Graphics& g, int width, int height, bool rowIsSelected) override;
+    
+    void selectedRowsChanged (int lastRowSelected) override;
+    
+    void changeListenerCallback (ChangeBroadcaster*) override;
 };
 
 class AudioFilePlayerAudioProcessorEditor  : public juce::AudioProcessorEditor,
-private FileBrowserListener,
-private ChangeListener,
-public Timer
+private ChangeListener
 {
 public:
     AudioFilePlayerAudioProcessorEditor(AudioFilePlayerAudioProcessor& p);
@@ -101,14 +212,14 @@ public:
     void paint (Graphics& g) override;
     
     void resized() override;
-    
-    void timerCallback() override;
 private:
     // if this PIP is running inside the demo runner, we'll use the shared device manager instead
     AudioFilePlayerAudioProcessor& audioProcessor;
+    //shared by every editor in the process, and kept up to date for as long as one is open
+    SharedResourcePointer<LibraryIndex> libraryIndex;
     
-    DirectoryContentsList directoryList;
-    FileTreeComponent fileTreeComp {directoryList};
+    LibrarySearchComp librarySearchComp;
+    LibraryBrowser libraryBrowser;
     Label explanation { {}, "Select an audio file in the treeview above, and this page will display its waveform, and let you play it.." };
     
     /*
@@ -116,11 +227,14 @@ private:
      */
 //    AudioTransportSource& transportSource;
 //    std::unique_ptr<AudioFormatReaderSource> currentAudioFileSource;
-    
+
     std::unique_ptr<DemoThumbnailComp> thumbnail;
     Label zoomLabel                     { {}, "zoom:" };
     Slider zoomSlider                   { Slider::LinearHorizontal, Slider::NoTextBox };
     ToggleButton followTransportButton  { "Follow Transport" };
+    ToggleButton performanceButton      { "Show Performance" };
+    ComboBox resamplingQualityBox;
+    PerformanceOverlay performanceOverlay { audioProcessor };
     TextButton startStopButton          { "Load an audio file first..." };
     
     ReferencedTransportSourceData::Ptr activeSource;
@@ -130,12 +244,11 @@ private:
     
     void updateFollowTransportState();
     
+    //called whenever the processor's playerChanges fire.  there is no polling
+    void updateFromProcessor();
     
-    void selectionChanged() override;
-    
-    void fileClicked (const File&, const MouseEvent&) override;
-    void fileDoubleClicked (const File&) override;
-    void browserRootChanged (const File&) override;
+    //how many files either side of a chosen one are prefetched
+    static constexpr int numNeighboursToPrefetch = 2;
     
     void changeListenerCallback (ChangeBroadcaster* source) override;
     
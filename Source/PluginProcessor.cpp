@@ -23,7 +23,6 @@ AudioFilePlayerAudioProcessor::AudioFilePlayerAudioProcessor()
 #endif
 {
     formatManager.registerBasicFormats();
-    directoryScannerBackgroundThread.startThread (juce::Thread::Priority::normal);
 }
 
 AudioFilePlayerAudioProcessor::~AudioFilePlayerAudioProcessor()
@@ -97,7 +96,14 @@ void AudioFilePlayerAudioProcessor::prepareToPlay (double sampleRate, int sample
 {
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
-    transportSource.prepareToPlay(samplesPerBlock, sampleRate);
+    crossfadeBuffer.setSize(getTotalNumOutputChannels(), samplesPerBlock);
+    crossfadeLengthInSamples = roundToInt(sampleRate * crossfadeLengthInSeconds);
+    crossfadeSamplesRemaining = 0;
+    fadingSource = nullptr;
+    
+    telemetry.blockBudgetMicroseconds.store((uint64) (1.0e6 * samplesPerBlock / sampleRate), std::memory_order_relaxed);
+    
+    transportSourceCreator.setPlaybackSpec(sampleRate, samplesPerBlock, activeSource.get());
 }
 
 void AudioFilePlayerAudioProcessor::releaseResources()
@@ -135,6 +141,7 @@ bool AudioFilePlayerAudioProcessor::isBusesLayoutSupported (const BusesLayout& l
 void AudioFilePlayerAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
+    auto blockStartTicks = Time::getHighResolutionTicks();
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
@@ -147,26 +154,213 @@ void AudioFilePlayerAudioProcessor::processBlock (juce::AudioBuffer<float>& buff
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
     
-    ReferencedTransportSourceData::Ptr ptr;
-    while( fifo.pull(ptr) )
+    //the creator has already built and prepared the new source, so this is just a pointer swap.
+    //sources that are no longer needed go to the release pool, so nothing is deleted here.
+    ReferencedTransportSourceData::Ptr incoming;
+    if( sourceMailbox.take(incoming) )
+    {
+        retire(fadingSource);
+        fadingSource = std::move(activeSource);
+        activeSource = std::move(incoming);
+        crossfadeSamplesRemaining = fadingSource != nullptr ? crossfadeLengthInSamples : 0;
+        telemetry.numSwaps.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    auto isSwapping = fadingSource != nullptr;
+    auto isPlaying = isSwapping || (activeSource != nullptr && activeSource->transportSource.isPlaying());
+    
+    if( activeSource != nullptr )
+    {
+        if( ! readAheadIsReady(*activeSource, buffer.getNumSamples()) )
+        {
+            telemetry.numUnderruns.fetch_add(1, std::memory_order_relaxed);
+            //the next source read from the same storage gets a bigger read-ahead.  mapped files have none
+            if( activeSource->readAhead != nullptr )
+                activeSource->readAhead->stats->recordUnderrun();
+        }
+        
+        if( activeSource->resamplingSource->isResampling() )
+            telemetry.numResampledBlocks.fetch_add(1, std::memory_order_relaxed);
+        
+        auto transportStartTicks = Time::getHighResolutionTicks();
+        AudioSourceChannelInfo asci(&buffer, 0, buffer.getNumSamples());
+        activeSource->transportSource.getNextAudioBlock(asci);
+        if( isPlaying )
+            telemetry.transportTime.recordTicks(Time::getHighResolutionTicks() - transportStartTicks);
+    }
+    else
+    {
+        buffer.clear();
+    }
+    
+    renderCrossfade(buffer);
+    
+    auto blockTicks = Time::getHighResolutionTicks() - blockStartTicks;
+    (isPlaying ? telemetry.blockTime : telemetry.idleBlockTime).recordTicks(blockTicks);
+    if( isSwapping )
+        telemetry.swapBlockTime.recordTicks(blockTicks);
+    
+    telemetry.numBlocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ Both read-aheads fill whatever they haven't got yet with silence.  The decoder's check is a
+ couple of atomic loads, and so is a memory-mapped file's, which isn't silent but would
+ page-fault.  For a BufferingAudioSource, a zero timeout makes it a non-blocking check of the
+ range the transport is about to read, which only takes the source's own buffer lock that
+ getNextAudioBlock takes straight afterwards anyway.
+ */
+bool AudioFilePlayerAudioProcessor::readAheadIsReady(const ReferencedTransportSourceData& rts, int numSamples) const
+{
+    //cached sources have nothing to wait for, and a stopped transport doesn't read
+    if( ! rts.transportSource.isPlaying() )
+        return true;
+    
+    //the resampler reads at the file's rate, not the host's
+    auto numSourceSamples = roundToInt(numSamples * rts.audioFileSourceSampleRate / getSampleRate());
+    
+    if( rts.decoderSource != nullptr )
+        return rts.decoderSource->isReadyFor(numSourceSamples);
+    
+    if( rts.touchAheadSource != nullptr )
+        return rts.touchAheadSource->isReadyFor(numSourceSamples);
+    
+    if( rts.bufferingSource != nullptr )
+    {
+        AudioSourceChannelInfo info;
+        info.numSamples = numSourceSamples;
+        return rts.bufferingSource->waitForNextAudioBlockReady(info, 0);
+    }
+    
+    return true;
+}
+
+void AudioFilePlayerAudioProcessor::renderCrossfade(juce::AudioBuffer<float>& buffer)
+{
+    if( fadingSource == nullptr )
+        return;
+    
+    auto numChannels = jmin(buffer.getNumChannels(), crossfadeBuffer.getNumChannels());
+    auto length = (float) crossfadeLengthInSamples;
+    
+    //a chunk at a time, since a host may send a bigger block than the crossfadeBuffer was prepared for
+    for( int start = 0; start < buffer.getNumSamples() && crossfadeSamplesRemaining > 0; )
     {
-        ;
+        auto numSamples = jmin(buffer.getNumSamples() - start,
+                               crossfadeBuffer.getNumSamples(),
+                               crossfadeSamplesRemaining);
+        if( numSamples <= 0 )
+            break;
+        
+        //refers to the preallocated crossfadeBuffer, so this doesn't allocate
+        AudioBuffer<float> fadeOut(crossfadeBuffer.getArrayOfWritePointers(), numChannels, numSamples);
+        AudioSourceChannelInfo asci(&fadeOut, 0, numSamples);
+        fadingSource->transportSource.getNextAudioBlock(asci);
+        
+        auto startGain = (float) crossfadeSamplesRemaining / length;
+        auto endGain = (float) (crossfadeSamplesRemaining - numSamples) / length;
+        
+        for( int ch = 0; ch < numChannels; ++ch )
+        {
+            buffer.applyGainRamp(ch, start, numSamples, 1.f - startGain, 1.f - endGain);
+            buffer.addFromWithRamp(ch, start, fadeOut.getReadPointer(ch), numSamples, startGain, endGain);
+        }
+        
+        crossfadeSamplesRemaining -= numSamples;
+        start += numSamples;
     }
     
-    if( ptr != nullptr )
+    if( crossfadeSamplesRemaining <= 0 || crossfadeBuffer.getNumSamples() == 0 )
     {
-        pool.add(activeSource);
-        activeSource = ptr;
-        transportSource.stop();
-        transportSource.setSource(activeSource->currentAudioFileSource.get(),
-                                  32768,
-                                  &directoryScannerBackgroundThread,
-                                  activeSource->audioFileSourceSampleRate);
-        sourceHasChanged.set(true);
+        crossfadeSamplesRemaining = 0;
+        retire(fadingSource);
     }
+}
+
+void AudioFilePlayerAudioProcessor::retire(ReferencedTransportSourceData::Ptr& ptr)
+{
+    //counted as retired until the pool lets go of it, and the first thing freed over the memory cap
+    if( ptr != nullptr && ptr->readAhead != nullptr )
+        ptr->readAhead->setUse(MemoryUse::retiredSources);
     
-    AudioSourceChannelInfo asci(&buffer, 0, buffer.getNumSamples());
-    transportSource.getNextAudioBlock(asci);
+    pool->add(ptr);
+    ptr = nullptr;
+}
+
+//==============================================================================
+void AudioFilePlayerAudioProcessor::startTransport()
+{
+    transportIsPlaying.set(true);
+    if( auto src = getCurrentSource() )
+        src->transportSource.start();
+    
+    playerChanges.sendChangeMessage();
+}
+
+void AudioFilePlayerAudioProcessor::stopTransport()
+{
+    transportIsPlaying.set(false);
+    if( auto src = getCurrentSource() )
+        src->transportSource.stop();
+    
+    playerChanges.sendChangeMessage();
+}
+
+bool AudioFilePlayerAudioProcessor::isTransportPlaying()
+{
+    auto src = getCurrentSource();
+    if( src == nullptr )
+        return false;
+    
+    auto isPlaying = src->transportSource.isPlaying();
+    
+    //the transport stops by itself when it reaches the end of the file
+    if( ! isPlaying && transportIsPlaying.compareAndSetBool(false, true) )
+        playerChanges.sendChangeMessage();
+    
+    return isPlaying;
+}
+
+double AudioFilePlayerAudioProcessor::getCurrentPosition() const
+{
+    if( auto src = getCurrentSource() )
+        return src->transportSource.getCurrentPosition();
+    
+    return 0.0;
+}
+
+void AudioFilePlayerAudioProcessor::setPosition(double newPosition)
+{
+    if( auto src = getCurrentSource() )
+        src->transportSource.setPosition(newPosition);
+    
+    playerChanges.sendChangeMessage();
+}
+
+double AudioFilePlayerAudioProcessor::getLengthInSeconds() const
+{
+    if( auto src = getCurrentSource() )
+        return src->transportSource.getLengthInSeconds();
+    
+    return 0.0;
+}
+
+ReadAheadPlanner::Status AudioFilePlayerAudioProcessor::getReadAheadStatus() const
+{
+    auto src = getCurrentSource();
+    return readAheadPlanner->getStatus(src != nullptr ? src->readAhead.get() : nullptr);
+}
+
+MemoryGovernor::Usage AudioFilePlayerAudioProcessor::getMemoryUsage(bool wholeProcess) const
+{
+    auto report = memoryGovernor->getReport();
+    return wholeProcess ? report.process : report.getInstance(&transportSourceCreator);
+}
+
+void AudioFilePlayerAudioProcessor::setResamplingQuality(ResamplingQuality newQuality)
+{
+    transportSourceCreator.setResamplingQuality(newQuality);
+    apvts.state.setProperty("ResamplingQuality", (int) newQuality, nullptr);
 }
 
 //==============================================================================
@@ -186,9 +380,9 @@ void AudioFilePlayerAudioProcessor::getStateInformation (juce::MemoryBlock& dest
     // You should use this method to store your parameters in the memory block.
     // You could do that either as raw data, or use the XML or ValueTree classes
     // as intermediaries to make it easy to save and load complex data.
-    if( activeSource != nullptr )
+    if( auto src = getCurrentSource() )
     {
-        refreshCurrentFileInAPVTS(apvts, activeSource->currentAudioFile);
+        refreshCurrentFileInAPVTS(apvts, src->currentAudioFile);
         
         juce::MemoryOutputStream mos(destData, true);
         apvts.state.writeToStream(mos);
@@ -203,6 +397,13 @@ void AudioFilePlayerAudioProcessor::setStateInformation (const void* data, int s
     if( tree.isValid() )
     {
         apvts.replaceState(tree);
+        if( auto quality = apvts.state.getProperty("ResamplingQuality", {});
+           quality != var() )
+        {
+            auto index = jlimit((int) ResamplingQuality::browsing, (int) ResamplingQuality::offline, (int) quality);
+            transportSourceCreator.setResamplingQuality((ResamplingQuality) index);
+        }
+        
         if( auto url = apvts.state.getProperty("CurrentFile", {});
            url != var() )
         {
@@ -9,6 +9,15 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "DecodedAudioCache.h"
+#include "SharedIOScheduler.h"
+#include "PerformanceTelemetry.h"
+#include "WaveformPyramid.h"
+#include "PolyphaseResampler.h"
+#include "ReadAheadPlanner.h"
+#include "MemoryGovernor.h"
+#include "StreamingDecoderSource.h"
+#include "TouchAheadSource.h"
 
 using namespace juce;
 //==============================================================================
@@ -28,226 +37,1224 @@ inline const std::map<Names, juce::String>& GetParamNames()
 }
 }
 //==============================================================================
-template<typename T, size_t Size = 30>
-struct Fifo
+/*
+ A single slot where the newest object wins.  Any number of threads can post(), and the consumer
+ gets the most recent object with one atomic exchange, however many were posted since it last
+ looked.  Whatever a post() overwrites is handed back to the poster, so it is never the consumer
+ (i.e. the audio thread) that lets go of it.
+ */
+template<typename ReferenceCountedType>
+struct LatestObjectMailbox
 {
-    size_t getSize() const noexcept { return Size; }
+    using Ptr = typename ReferenceCountedType::Ptr;
     
-    bool push(const T& t)
+    ~LatestObjectMailbox()
     {
-        auto write = fifo.write(1);
-        if( write.blockSize1 > 0 )
-        {
-            size_t index = static_cast<size_t>(write.startIndex1);
-            buffer[index] = t;
-            return true;
-        }
-        
-        return false;
+        adopt(slot.exchange(nullptr));
     }
     
-    bool pull(T& t)
+    //returns the object this replaced, if the consumer never took it
+    Ptr post(Ptr newObject)
     {
-        auto read = fifo.read(1);
-        if( read.blockSize1 > 0 )
-        {
-            t = buffer[static_cast<size_t>(read.startIndex1)];
-            return true;
-        }
+        if( auto* object = newObject.get() )
+            object->incReferenceCount();
         
-        return false;
+        return adopt(slot.exchange(newObject.get(), std::memory_order_acq_rel));
     }
     
-    int getNumAvailableForReading() const
+    //realtime safe
+    bool take(Ptr& result)
     {
-        return fifo.getNumReady();
+        auto* object = slot.exchange(nullptr, std::memory_order_acq_rel);
+        if( object == nullptr )
+            return false;
+        
+        result = adopt(object);
+        return true;
     }
+private:
+    std::atomic<ReferenceCountedType*> slot { nullptr };
     
-    int getAvailableSpace() const
+    //takes over the reference the slot was holding
+    static Ptr adopt(ReferenceCountedType* object)
     {
-        return fifo.getFreeSpace();
+        Ptr ptr (object);
+        if( object != nullptr )
+            object->decReferenceCountWithoutDeleting();
+        
+        return ptr;
     }
-private:
-    juce::AbstractFifo fifo { Size };
-    std::array<T, Size> buffer;
 };
 //==============================================================================
+/*
+ The bookkeeping ReleasePool needs inside each object it can release.  Keeping it in the object
+ means retiring never allocates and never has to search.
+ */
+template<typename ReferenceCountedType>
+struct ReleasePoolLink
+{
+    ReferenceCountedType* nextToRelease { nullptr };
+    std::atomic<bool> isWaitingForRelease { false };
+};
+
+/*
+ Lets the audio thread let go of reference counted objects without ever being the one that
+ deletes them.
+ 
+ add() hands the pool a reference and pushes the object onto a lock-free intrusive list: O(1),
+ no allocation, and it can't overflow.  Adding an object that is already waiting is a no-op, since
+ the pool's reference already keeps it alive.  The pool drops its references on the shared
+ background thread a few milliseconds later, and whichever holder lets go last deletes the object
+ there, or on its own (non-realtime) thread.
+ 
+ Shared by every instance in the process through a SharedResourcePointer.  When the process is
+ over its memory cap, the MemoryGovernor has it let go of everything waiting straight away.
+ */
 template<typename ReferenceCountedType>
-struct ReleasePool : juce::Timer
+struct ReleasePool : juce::TimeSliceClient,
+                     private MemoryGovernor::Holder
 {
     ReleasePool()
     {
-        deletionPool.reserve(5000);
-        
-        startTimer(1 * 1000);
+        ioScheduler->getDirectoryScanThread().addTimeSliceClient(this);
+        memoryGovernor->addHolder(this);
     }
     
     ~ReleasePool() override
     {
-        stopTimer();
+        memoryGovernor->removeHolder(this);
+        ioScheduler->getDirectoryScanThread().removeTimeSliceClient(this);
+        releaseWaitingObjects();
     }
     
     using Ptr = typename ReferenceCountedType::Ptr;
     
-    void add(Ptr ptr)
+    //realtime safe.  the caller's ptr can be cleared afterwards without deleting anything.
+    void add(const Ptr& ptr)
     {
-        if( ptr == nullptr )
+        auto* object = ptr.get();
+        if( object == nullptr || object->isWaitingForRelease.exchange(true) )
             return;
         
-        if( juce::MessageManager::getInstance()->isThisTheMessageThread() )
-        {
-            addIfNotAlreadyThere(ptr);
-        }
-        else
+        object->incReferenceCount();
+        
+        auto* head = waitingForRelease.load(std::memory_order_relaxed);
+        do
         {
-            if( fifo.push(ptr) )
-            {
-                successfullyAdded.set(true);
-            }
-            else
-            {
-                jassertfalse;
-            }
+            object->nextToRelease = head;
         }
+        while( ! waitingForRelease.compare_exchange_weak(head,
+                                                         object,
+                                                         std::memory_order_release,
+                                                         std::memory_order_relaxed) );
     }
     
-    void timerCallback() override
+    int useTimeSlice() override
     {
-        if( successfullyAdded.compareAndSetBool(false, true))
-        {
-            Ptr ptr;
-            while( fifo.pull(ptr) )
-            {
-                addIfNotAlreadyThere(ptr);
-                ptr = nullptr;
-            }
-        }
-        
-        deletionPool.erase(std::remove_if(deletionPool.begin(),
-                                          deletionPool.end(),
-                                          [](const auto& ptr)
-                                          {
-                                              return ptr->getReferenceCount() <= 1;
-                                          }),
-                           deletionPool.end());
+        return releaseWaitingObjects() ? busyIntervalMs : idleIntervalMs;
     }
+    
+    static constexpr int busyIntervalMs = 5;
+    static constexpr int idleIntervalMs = 100;
 private:
-    Fifo<Ptr, 512> fifo;
-    std::vector<Ptr> deletionPool;
-    juce::Atomic<bool> successfullyAdded { false };
+    juce::SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    juce::SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    std::atomic<ReferenceCountedType*> waitingForRelease { nullptr };
     
-    void addIfNotAlreadyThere(Ptr ptr)
+    //the governor calls this on the same thread as useTimeSlice, so the two never overlap
+    void freeMemory(MemoryUse use, size_t) override
     {
-        auto found = std::find_if(deletionPool.begin(),
-                                  deletionPool.end(),
-                                  [ptr](const auto& elem)
-                                  {
-                                      return elem.get() == ptr.get();
-                                  });
+        if( use == MemoryUse::retiredSources )
+            releaseWaitingObjects();
+    }
+    
+    bool releaseWaitingObjects()
+    {
+        //the whole list is taken at once, so this can't race with add()
+        auto* object = waitingForRelease.exchange(nullptr, std::memory_order_acquire);
+        if( object == nullptr )
+            return false;
         
-        if( found == deletionPool.end() )
-            deletionPool.push_back(ptr);
+        while( object != nullptr )
+        {
+            auto* next = object->nextToRelease;
+            object->nextToRelease = nullptr;
+            object->isWaitingForRelease.store(false);
+            object->decReferenceCount();
+            object = next;
+        }
+        
+        return true;
     }
 };
 //==============================================================================
-struct ReferencedTransportSourceData : juce::ReferenceCountedObject
+struct ReferencedTransportSourceData : juce::ReferenceCountedObject,
+                                       ReleasePoolLink<ReferencedTransportSourceData>
 {
     using Ptr = juce::ReferenceCountedObjectPtr<ReferencedTransportSourceData>;
     
-    std::unique_ptr<AudioFormatReaderSource> currentAudioFileSource;
+    //set when playing from the decoded audio cache.  declared first so it outlives the source reading it.
+    DecodedAudio::Ptr decodedAudio;
+    
+    std::unique_ptr<PositionableAudioSource> currentAudioFileSource;
+    //streamed sources only: times the reads, and holds the read-ahead's share of the budget
+    std::unique_ptr<ThroughputMeteringSource> meteringSource;
+    std::unique_ptr<ReadAheadPlanner::Reservation> readAhead;
+    //one or the other reads ahead: the decoder for local files, the buffering source for remote ones
+    std::unique_ptr<StreamingDecoderSource> decoderSource;
+    std::unique_ptr<BufferingAudioSource> bufferingSource;
+    //memory-mapped files only.  keeps the pages about to be played resident instead
+    std::unique_ptr<TouchAheadSource> touchAheadSource;
+    //converts from the file's rate to the host's.  the transport plays this, so it does no resampling of its own
+    std::unique_ptr<PolyphaseResamplingSource> resamplingSource;
+    //declared after the sources it reads from, so it is destroyed before them
+    AudioTransportSource transportSource;
+    
     juce::URL currentAudioFile;
     double audioFileSourceSampleRate { 0 };
+    
+    //local files only.  fed by the loader's cache decode, so drawing it doesn't decode the file again
+    WaveformPyramid::Ptr waveform;
+    
+    //the host settings transportSource was last prepared with.  only touched by the creator's loader job
+    //until it is published, and under the creator's prepareLock after that
+    double preparedSampleRate { 0 };
+    int preparedBlockSize { 0 };
+    //a prefetched neighbour's read-ahead only holds a few hundred milliseconds until it is published
+    bool isPrefillOnly { false };
 };
 
-struct AudioFormatReaderSourceCreator : juce::Thread
+/*
+ Builds the complete playback chain (reader -> read-ahead -> resampler -> transport) on a loader
+ thread, prepares it for the host's current settings and waits for the read-ahead to be filled
+ before handing it to the audio thread, so processBlock only has to swap a pointer.
+ Uncompressed local files are memory-mapped instead, and skip the read-ahead: their pages are
+ touched ahead of the play position on the playback threads.  Compressed local files are decoded
+ ahead on the shared decoder threads, and remote streams are buffered on the playback threads.  How
+ far either reads ahead is up to the shared ReadAheadPlanner.
+ 
+ The loader threads are shared with every other instance (see SharedIOScheduler).  Work is done
+ one step at a time, in this order: load the latest request, then prefetch its neighbours.  A new
+ request abandons whatever is left.  Prefetching a neighbour only opens it and starts pre-filling a
+ few hundred milliseconds of its read-ahead, without waiting for either, so a step never holds up a
+ new request, or the host's prepareToPlay, for long.
+ 
+ Whatever decodes a file also fills its waveform as it goes, so a file is only decoded once for
+ playing and drawing: the cache decode of a short file, or a compressed file's StreamingDecoderSource
+ as it plays.  Anything neither of them gets to is left to a WaveformPyramidBuilder.
+ 
+ A short file is decoded into the cache before it is played.  At offline resampling quality the
+ decode is converted to the host's rate before it is cached, so playing it from the cache needs no
+ resampling at all.  Either way it is decoded to floats, and only packed into the cache's compact
+ encoding once it is complete.
+ 
+ A long compressed file is cached as it plays instead, at the file's rate, through a
+ DecodedAudioFill: its StreamingDecoderSource fills the regions it reaches, and a CacheFillJob on the
+ low priority analysis threads decodes the rest, from the end backwards, so the two rarely decode
+ the same region.  Only formats that can seek cheaply get the job; any other is cached once it has
+ been played through.  At most maxNumCacheFills are filled at once, and none over the memory cap.
+ 
+ Its read-ahead is reported to the MemoryGovernor under the creator's address.  Warm sources are
+ the first thing to go when the process is over its memory cap, and none are prefetched until it
+ is back under.
+ */
+struct AudioFormatReaderSourceCreator : private MemoryGovernor::Holder
 {
-    AudioFormatReaderSourceCreator(Fifo<ReferencedTransportSourceData::Ptr>& fifo,
-                                   ReleasePool<ReferencedTransportSourceData>& pool,
-                                   TimeSliceThread& tst,
-                                   AudioFormatManager& afm) :
-    juce::Thread("TransportSourceCreator"),
-    transportSourceFifo(fifo),
-    releasePool(pool),
-    directoryScannerBackgroundThread(tst),
-    formatManager(afm)
+    AudioFormatReaderSourceCreator(LatestObjectMailbox<ReferencedTransportSourceData>& mailbox,
+                                   SharedIOScheduler& scheduler,
+                                   AudioFormatManager& afm,
+                                   DecodedAudioCache& cache,
+                                   PerformanceTelemetry& perf,
+                                   juce::Atomic<bool>& playingFlag,
+                                   ChangeBroadcaster& changes) :
+    sourceMailbox(mailbox),
+    ioScheduler(scheduler),
+    formatManager(afm),
+    decodedAudioCache(cache),
+    telemetry(perf),
+    transportIsPlaying(playingFlag),
+    playerChanges(changes)
+    {
+        memoryGovernor->addHolder(this);
+    }
+    
+    ~AudioFormatReaderSourceCreator() override
+    {
+        memoryGovernor->removeHolder(this);
+        shouldStop.set(true);
+        abandonCacheFills();
+        
+        OwnJobsSelector ownJobs { *this };
+        ioScheduler.getLoaderPool().removeAllJobs(true, 2000, &ownJobs);
+        ioScheduler.getAnalysisPool().removeAllJobs(true, 2000, &ownJobs);
+    }
+    
+    /*
+     supersedes any request that hasn't finished loading yet.
+     neighboursToPrefetch are warmed up in the background once url has been loaded, so that moving
+     the selection onto one of them is instant.
+     */
+    bool requestTransportForURL(juce::URL url, Array<juce::URL> neighboursToPrefetch = {})
+    {
+        {
+            const ScopedLock sl(requestLock);
+            pendingURL = url;
+            pendingNeighbours = neighboursToPrefetch;
+            pendingRequestTicks = Time::getHighResolutionTicks();
+            hasPendingRequest = true;
+            requestGeneration.set(requestGeneration.get() + 1);
+        }
+        
+        if( ! shouldStop.get() && jobIsScheduled.compareAndSetBool(true, false) )
+            ioScheduler.getLoaderPool().addJob(new LoaderJob(*this), true);
+        
+        return true;
+    }
+    
+    /*
+     called from the processor's prepareToPlay, while the audio thread is not running.
+     re-prepares the currently playing source and one still waiting in the mailbox.
+     */
+    void setPlaybackSpec(double sampleRate, int blockSize, ReferencedTransportSourceData* activeSource)
+    {
+        const ScopedLock sl(prepareLock);
+        hostSampleRate.set(sampleRate);
+        hostBlockSize.set(blockSize);
+        
+        if( activeSource != nullptr )
+            prepare(*activeSource);
+        
+        ReferencedTransportSourceData::Ptr pending;
+        if( sourceMailbox.take(pending) )
+        {
+            prepare(*pending);
+            sourceMailbox.post(pending);
+        }
+    }
+    
+    //message thread: the most recently created source, which is either audible or about to be
+    ReferencedTransportSourceData::Ptr getLatestSource() const
+    {
+        const ScopedLock sl(latestSourceLock);
+        return latestSource;
+    }
+    
+    //any thread.  applies to the source that is playing straight away, and to everything loaded after
+    void setResamplingQuality(ResamplingQuality newQuality)
+    {
+        resamplingQuality.store(newQuality);
+        
+        if( auto rts = getLatestSource() )
+            rts->resamplingSource->setQuality(newQuality);
+    }
+    
+    ResamplingQuality getResamplingQuality() const { return resamplingQuality.load(); }
+    
+    static constexpr int defaultHostBlockSize = 512;
+    static constexpr int decodeChunkSizeInSamples = 65536;
+    static constexpr uint32 decodeTimeSliceMs = 10;
+    static constexpr size_t maxBytesToDecodeBeforePlaying = 16 * 1024 * 1024;
+    //packed, so a long file's entry is never held as floats
+    static constexpr size_t maxBytesToCacheWhilePlaying = 256 * 1024 * 1024;
+    static constexpr int maxNumCacheFills = 2;
+private:
+    CriticalSection requestLock;
+    juce::URL pendingURL;
+    Array<juce::URL> pendingNeighbours;
+    bool hasPendingRequest { false };
+    int64 pendingRequestTicks { 0 };
+    juce::Atomic<int> requestGeneration { 0 };
+    
+    LatestObjectMailbox<ReferencedTransportSourceData>& sourceMailbox;
+    
+    SharedIOScheduler& ioScheduler;
+    juce::Atomic<bool> shouldStop { false };
+    juce::Atomic<bool> jobIsScheduled { false };
+    
+    AudioFormatManager& formatManager;
+    DecodedAudioCache& decodedAudioCache;
+    PerformanceTelemetry& telemetry;
+    
+    juce::Atomic<bool>& transportIsPlaying;
+    ChangeBroadcaster& playerChanges;
+    
+    SharedResourcePointer<ResamplingKernelCache> kernelCache;
+    SharedResourcePointer<ReadAheadPlanner> readAheadPlanner;
+    SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    
+    CriticalSection prepareLock;
+    juce::Atomic<double> hostSampleRate { 0 };
+    juce::Atomic<int> hostBlockSize { 0 };
+    std::atomic<ResamplingQuality> resamplingQuality { ResamplingQuality::playback };
+    
+    CriticalSection latestSourceLock;
+    ReferencedTransportSourceData::Ptr latestSource;
+    
+    /*
+     everything below is only touched by the loader job.  there is never more than one job per
+     creator, so no two threads ever run these at the same time.
+     */
+    int workGeneration { 0 };
+    int64 workRequestTicks { 0 };
+    
+    //prepared and pre-buffered, but not published.  the governor can empty it too, under warmLock
+    CriticalSection warmLock;
+    std::vector<ReferencedTransportSourceData::Ptr> warmSources;
+    Array<juce::URL> neighboursToPrefetch;
+    int nextNeighbourToPrefetch { 0 };
+    //set by the governor to make decodeShortFileNow give up, and play the file some other way
+    std::atomic<bool> shouldAbandonDecode { false };
+    
+    //long files being cached as they play, oldest first.  the governor and the destructor abandon them too, under cacheFillLock
+    CriticalSection cacheFillLock;
+    std::vector<DecodedAudioFill::Ptr> cacheFills;
+    
+    struct CacheDecode
+    {
+        explicit CacheDecode(MemoryGovernor& g) : governor(g) { }
+        
+        ~CacheDecode()
+        {
+            governor.removeCountedBytes(MemoryUse::decoding, numBytesCounted);
+            
+            if( waveform == nullptr )
+                return;
+            
+            //whatever is left is picked up by a builder.  a finished region isn't affected.
+            if( ownsCurrentRegion )
+                waveform->abandonRegion(currentRegion);
+            
+            waveform->setIsBeingFed(false);
+        }
+        
+        //pcm, converted and the packed samples are counted as MemoryUse::decoding until the cache has them
+        void updateCountedBytes(bool isCached = false)
+        {
+            auto numBytes = isCached ? (size_t) 0
+                                     : CompactAudioBuffer::getSizeInBytes(pcm.getNumChannels(), pcm.getNumSamples(), SampleEncoding::float32)
+                                       + CompactAudioBuffer::getSizeInBytes(converted.getNumChannels(), converted.getNumSamples(), SampleEncoding::float32)
+                                       + decoded->samples.getSizeInBytes();
+            
+            governor.addCountedBytes(MemoryUse::decoding, numBytes);
+            governor.removeCountedBytes(MemoryUse::decoding, numBytesCounted);
+            numBytesCounted = numBytes;
+        }
+        
+        MemoryGovernor& governor;
+        size_t numBytesCounted { 0 };
+        
+        File file;
+        std::unique_ptr<DecodedAudioCache::DecodeClaim> claim;
+        std::unique_ptr<AudioFormatReader> reader;
+        //what ends up in the cache.  its samples are only filled in by packChunks
+        DecodedAudio::Ptr decoded;
+        AudioBuffer<float> pcm;
+        int64 position { 0 };
+        
+        //offline quality: decoded, converted to the host's rate a chunk at a time once it is complete
+        bool hasCheckedConversion { false };
+        AudioBuffer<float> converted;
+        double convertedSampleRate { 0 };
+        int64 convertPosition { 0 };
+        const ResamplingKernel* kernel { nullptr };
+        
+        //whichever of the above is cached, packed a chunk at a time
+        SampleEncoding encoding { SampleEncoding::float32 };
+        bool allowsLossyEncoding { false };
+        int64 packPosition { 0 };
+        
+        WaveformPyramid::Ptr waveform;
+        int currentRegion { -1 };
+        bool ownsCurrentRegion { false };
+    };
+    struct LoaderJob : ThreadPoolJob
+    {
+        explicit LoaderJob(AudioFormatReaderSourceCreator& c) : ThreadPoolJob("TransportSourceCreator"), creator(c) { }
+        JobStatus runJob() override { return creator.runNextStep(); }
+        AudioFormatReaderSourceCreator& creator;
+    };
+    
+    //decodes one region per run, on the analysis pool, so it never holds up drawing for long
+    struct CacheFillJob : ThreadPoolJob
+    {
+        CacheFillJob(AudioFormatReaderSourceCreator& c, DecodedAudioFill::Ptr f, std::unique_ptr<AudioFormatReader> r, WaveformPyramid::Ptr w) :
+        ThreadPoolJob("DecodedAudioFill"), creator(c), fill(f), reader(std::move(r)), waveform(w), nextRegion(f->getNumRegions() - 1) { }
+        JobStatus runJob() override { return creator.fillNextRegion(*this) ? jobNeedsRunningAgain : jobHasFinished; }
+        
+        AudioFormatReaderSourceCreator& creator;
+        DecodedAudioFill::Ptr fill;
+        std::unique_ptr<AudioFormatReader> reader;
+        WaveformPyramid::Ptr waveform;
+        AudioBuffer<float> buffer;
+        int nextRegion;
+    };
+    
+    struct OwnJobsSelector : ThreadPool::JobSelector
     {
-        startThread();
+        explicit OwnJobsSelector(AudioFormatReaderSourceCreator& c) : creator(c) { }
+        bool isJobSuitable(ThreadPoolJob* job) override
+        {
+            if( auto* loaderJob = dynamic_cast<LoaderJob*>(job) )
+                return &loaderJob->creator == &creator;
+            if( auto* fillJob = dynamic_cast<CacheFillJob*>(job) )
+                return &fillJob->creator == &creator;
+            return false;
+        }
+        AudioFormatReaderSourceCreator& creator;
+    };
+    
+    //runs one step, then goes to the back of the loader pool's queue so other instances get a turn
+    ThreadPoolJob::JobStatus runNextStep()
+    {
+        auto status = runOneStep();
+        updateLoaderQueueDepth();
+        return status;
     }
     
-    ~AudioFormatReaderSourceCreator()
+    ThreadPoolJob::JobStatus runOneStep()
     {
-        stopThread(500);
+        if( shouldStop.get() )
+            return ThreadPoolJob::jobHasFinished;
+        
+        juce::URL audioURL;
+        Array<juce::URL> neighbours;
+        if( takePendingRequest(audioURL, neighbours, workGeneration, workRequestTicks) )
+        {
+            load(audioURL, neighbours);
+            return ThreadPoolJob::jobNeedsRunningAgain;
+        }
+        
+        if( ! isSuperseded(workGeneration) && prefetchNextNeighbour() )
+            return ThreadPoolJob::jobNeedsRunningAgain;
+        
+        //nothing left to do.  a request arriving after this point schedules a new job.
+        jobIsScheduled.set(false);
+        if( hasPendingRequestWaiting() && jobIsScheduled.compareAndSetBool(true, false) )
+            return ThreadPoolJob::jobNeedsRunningAgain;
+        
+        return ThreadPoolJob::jobHasFinished;
     }
     
-    void run() override
+    void load(const juce::URL& audioURL, const Array<juce::URL>& neighbours)
     {
-        //create a referenced transport source if there is a new URL to load
-        while( !threadShouldExit() )
+        neighboursToPrefetch.clear();
+        
+        auto rts = takeWarmSource(audioURL);
+        if( rts == nullptr )
+            rts = createTransportSourceFor(audioURL, workGeneration);
+        
+        //before it is published, so its decoder fills the cache from the first region it reaches
+        auto cacheFill = rts != nullptr ? startFillingCache(*rts) : nullptr;
+        
+        if( rts != nullptr && ! publish(rts, workGeneration) )
+        {
+            //superseded, but it may well be next to the new selection.  it is only cached if it is played
+            if( cacheFill != nullptr )
+                cacheFill->abandon();
+            
+            addWarmSource(rts);
+            return;
+        }
+        
+        //anything that is no longer next to the selection is released right away, outside the lock
+        std::vector<ReferencedTransportSourceData::Ptr> released;
         {
-            if( urlNeedsProcessingFlag.compareAndSetBool(false, true) )
+            const ScopedLock sl(warmLock);
+            auto firstReleased = std::stable_partition(warmSources.begin(),
+                                                       warmSources.end(),
+                                                       [&neighbours](const auto& warm)
+                                                       {
+                                                           return neighbours.contains(warm->currentAudioFile);
+                                                       });
+            released.assign(firstReleased, warmSources.end());
+            warmSources.erase(firstReleased, warmSources.end());
+        }
+        
+        neighboursToPrefetch = neighbours;
+        nextNeighbourToPrefetch = 0;
+    }
+    
+    bool takePendingRequest(juce::URL& url, Array<juce::URL>& neighbours, int& generation, int64& requestTicks)
+    {
+        const ScopedLock sl(requestLock);
+        if( ! hasPendingRequest )
+            return false;
+        
+        url = pendingURL;
+        neighbours = pendingNeighbours;
+        generation = requestGeneration.get();
+        requestTicks = pendingRequestTicks;
+        hasPendingRequest = false;
+        return true;
+    }
+    
+    bool isSuperseded(int generation) const
+    {
+        return shouldStop.get() || generation != requestGeneration.get();
+    }
+    
+    bool hasPendingRequestWaiting() const
+    {
+        const ScopedLock sl(requestLock);
+        return hasPendingRequest;
+    }
+    
+    void updateLoaderQueueDepth()
+    {
+        auto depth = hasPendingRequestWaiting() ? 1 : 0;
+        depth += neighboursToPrefetch.size() - nextNeighbourToPrefetch;
+        telemetry.loaderQueueDepth.store(depth, std::memory_order_relaxed);
+    }
+    
+    ReferencedTransportSourceData::Ptr takeWarmSource(const juce::URL& url)
+    {
+        const ScopedLock sl(warmLock);
+        auto found = std::find_if(warmSources.begin(),
+                                  warmSources.end(),
+                                  [&url](const auto& rts)
+                                  {
+                                      return rts->currentAudioFile == url;
+                                  });
+        
+        if( found == warmSources.end() )
+            return nullptr;
+        
+        auto rts = *found;
+        warmSources.erase(found);
+        return rts;
+    }
+    
+    void addWarmSource(ReferencedTransportSourceData::Ptr rts)
+    {
+        if( rts->readAhead != nullptr )
+            rts->readAhead->setUse(MemoryUse::warmSources);
+        
+        const ScopedLock sl(warmLock);
+        warmSources.push_back(rts);
+    }
+    
+    bool isWarm(const juce::URL& url) const
+    {
+        const ScopedLock sl(warmLock);
+        return std::any_of(warmSources.begin(),
+                           warmSources.end(),
+                           [&url](const auto& rts)
+                           {
+                               return rts->currentAudioFile == url;
+                           });
+    }
+    
+    //starts pre-filling the first few hundred milliseconds of one neighbour's read-ahead
+    bool prefetchNextNeighbour()
+    {
+        //it would only be dropped again
+        if( memoryGovernor->isUnderPressure() )
+            return false;
+        
+        while( nextNeighbourToPrefetch < neighboursToPrefetch.size() )
+        {
+            //a remote stream's read-ahead can't be limited to a prefill, and mostly waits on the network
+            auto url = neighboursToPrefetch[nextNeighbourToPrefetch++];
+            if( ! url.isLocalFile() || isWarm(url) )
+                continue;
+            
+            //a short file is only decoded into the cache once it is actually played
+            if( auto rts = createTransportSourceFor(url, workGeneration, false) )
             {
-                juce::URL audioURL;
-                while( urlFifo.getNumAvailableForReading() > 0 )
-                {
-                    if( urlFifo.pull(audioURL) )
-                    {
-                        //create a new referenced transport source for this
-                        std::unique_ptr<AudioFormatReader> reader;
-                        
-                        if (audioURL.isLocalFile())
-                        {
-                            reader.reset(formatManager.createReaderFor (audioURL.getLocalFile()));
-                        }
-                        else
-                        {
-                            auto options = URL::InputStreamOptions(URL::ParameterHandling::inAddress);
-                            reader.reset(formatManager.createReaderFor (audioURL.createInputStream(options)));
-                        }
-                        
-                        if (reader != nullptr)
-                        {
-                            using RTS = ReferencedTransportSourceData;
-                            RTS::Ptr rts = new ReferencedTransportSourceData();
-                            
-                            rts->audioFileSourceSampleRate = reader->sampleRate;
-                            
-                            rts->currentAudioFileSource.reset (new AudioFormatReaderSource (reader.release(), true));
-                            rts->currentAudioFile = audioURL;
-                            
-                            //add it to the release pool
-                            releasePool.add(rts);
-                            //add it to the transportSourceFifo
-                            transportSourceFifo.push(rts);
-                        }
-                        
-                    }
-                }
+                //nothing but this job can reach it until it is published, so it needs no prepareLock
+                setPrefillOnly(*rts, true);
+                prepare(*rts);
+                addWarmSource(rts);
             }
             
-            wait( 5 );
+            return true;
+        }
+        
+        return false;
+    }
+    
+    /*
+     a prefill only source's read-ahead stops a few hundred milliseconds ahead, and its prepareToPlay
+     doesn't wait for it.  turning that off forgets how it was prepared, so the next prepare() waits
+     for the whole pre-fill.
+     */
+    static void setPrefillOnly(ReferencedTransportSourceData& rts, bool shouldOnlyPrefill)
+    {
+        if( rts.decoderSource != nullptr )
+            rts.decoderSource->setPrefillOnly(shouldOnlyPrefill);
+        if( rts.touchAheadSource != nullptr )
+            rts.touchAheadSource->setPrefillOnly(shouldOnlyPrefill);
+        
+        if( rts.isPrefillOnly && ! shouldOnlyPrefill )
+        {
+            rts.preparedSampleRate = 0;
+            rts.preparedBlockSize = 0;
         }
+        
+        rts.isPrefillOnly = shouldOnlyPrefill;
     }
     
-    bool requestTransportForURL(juce::URL url)
+    ReferencedTransportSourceData::Ptr createTransportSourceFor(const juce::URL& audioURL, int generation, bool mayDecodeIntoCache = true)
     {
-        if( urlFifo.push(url) )
+        std::unique_ptr<AudioFormatReader> reader;
+        MemoryMappedAudioFormatReader* mappedReader = nullptr;
+        
+        WaveformPyramid::Ptr waveform;
+        
+        if (audioURL.isLocalFile())
         {
-            urlNeedsProcessingFlag.set(true);
+            auto file = audioURL.getLocalFile();
+            
+            if( auto decoded = decodedAudioCache.find(file) )
+            {
+                //the waveform is always at the file's rate, even if the cached samples aren't
+                return createTransportSourceForDecodedAudio(audioURL,
+                                                            decoded,
+                                                            createWaveformFor(file,
+                                                                              decoded->samples.getNumChannels(),
+                                                                              decoded->fileLengthInSamples,
+                                                                              decoded->fileSampleRate));
+            }
+            
+            if( mayDecodeIntoCache )
+            {
+                if( auto decode = decodeShortFileNow(file, generation) )
+                    return createTransportSourceForDecodedAudio(audioURL, decode->decoded, decode->waveform);
+            }
+            
+            auto mapped = createMemoryMappedReaderFor (file);
+            mappedReader = mapped.get();
+            reader = std::move (mapped);
+            
+            if (reader == nullptr)
+                reader.reset(formatManager.createReaderFor (file));
+            
+            if (reader != nullptr)
+                waveform = createWaveformFor(file, (int) reader->numChannels, reader->lengthInSamples, reader->sampleRate);
+        }
+        else
+        {
+            auto options = URL::InputStreamOptions(URL::ParameterHandling::inAddress);
+            reader.reset(formatManager.createReaderFor (audioURL.createInputStream(options)));
+        }
+        
+        //the user has already moved on, don't bother building the rest of the chain
+        if (reader == nullptr || isSuperseded(generation))
+            return nullptr;
+        
+        using RTS = ReferencedTransportSourceData;
+        RTS::Ptr rts = new ReferencedTransportSourceData();
+        
+        rts->audioFileSourceSampleRate = reader->sampleRate;
+        rts->currentAudioFile = audioURL;
+        rts->waveform = waveform;
+        
+        auto lengthInSamples = reader->lengthInSamples;
+        rts->currentAudioFileSource.reset (new AudioFormatReaderSource (reader.release(), true));
+        
+        PositionableAudioSource* sourceToPlay = rts->currentAudioFileSource.get();
+        
+        //a mapped file is read straight from the page cache, so it doesn't need a read-ahead copy
+        if( mappedReader != nullptr )
+        {
+            rts->touchAheadSource.reset (new TouchAheadSource (rts->currentAudioFileSource.get(),
+                                                               *mappedReader,
+                                                               ioScheduler.getPlaybackThread()));
+            sourceToPlay = rts->touchAheadSource.get();
+        }
+        else
+        {
+            rts->readAhead = readAheadPlanner->reserve(audioURL,
+                                                       rts->audioFileSourceSampleRate,
+                                                       lengthInSamples,
+                                                       getHostBlockSizeAt(rts->audioFileSourceSampleRate),
+                                                       this);
+            rts->meteringSource.reset (new ThroughputMeteringSource (*rts->currentAudioFileSource,
+                                                                     rts->audioFileSourceSampleRate,
+                                                                     rts->readAhead->stats));
+            
+            //decoding is what takes the time locally.  a remote stream mostly waits on the network,
+            //which would hold up every other source on a decoder thread
+            if( audioURL.isLocalFile() )
+            {
+                rts->decoderSource.reset (new StreamingDecoderSource (rts->meteringSource.get(),
+                                                                      ioScheduler.getDecoderThread(),
+                                                                      rts->readAhead->getNumSamples(),
+                                                                      rts->audioFileSourceSampleRate));
+                //instead of decoding the file a second time for the waveform
+                if( waveform != nullptr )
+                    rts->decoderSource->setWaveformToFeed(waveform, ioScheduler.getThumbnailCache());
+                
+                sourceToPlay = rts->decoderSource.get();
+            }
+            else
+            {
+                rts->bufferingSource.reset (new BufferingAudioSource (rts->meteringSource.get(),
+                                                                      ioScheduler.getPlaybackThread(),
+                                                                      false,
+                                                                      rts->readAhead->getNumSamples()));
+                sourceToPlay = rts->bufferingSource.get();
+            }
+        }
+        
+        rts->resamplingSource.reset (new PolyphaseResamplingSource (sourceToPlay,
+                                                                    rts->audioFileSourceSampleRate,
+                                                                    resamplingQuality.load()));
+        
+        //no read-ahead here: any decoder, buffering or touch-ahead source is owned by rts, not by the transport
+        rts->transportSource.setSource (rts->resamplingSource.get());
+        return rts;
+    }
+    
+    //a cache hit: nothing to open, parse or pre-buffer
+    ReferencedTransportSourceData::Ptr createTransportSourceForDecodedAudio(const juce::URL& audioURL,
+                                                                          DecodedAudio::Ptr decoded,
+                                                                          WaveformPyramid::Ptr waveform)
+    {
+        using RTS = ReferencedTransportSourceData;
+        RTS::Ptr rts = new ReferencedTransportSourceData();
+        
+        rts->audioFileSourceSampleRate = decoded->sampleRate;
+        rts->currentAudioFile = audioURL;
+        rts->decodedAudio = decoded;
+        rts->waveform = waveform;
+        rts->currentAudioFileSource.reset (new DecodedAudioSource (decoded));
+        rts->resamplingSource.reset (new PolyphaseResamplingSource (rts->currentAudioFileSource.get(),
+                                                                    rts->audioFileSourceSampleRate,
+                                                                    resamplingQuality.load()));
+        rts->transportSource.setSource (rts->resamplingSource.get());
+        return rts;
+    }
+    
+    //what the host reads per block, in samples at sampleRate.  a guess until the host has prepared us
+    int getHostBlockSizeAt(double sampleRate) const
+    {
+        auto hostRate = hostSampleRate.get();
+        auto blockSize = hostBlockSize.get();
+        if( hostRate <= 0 || blockSize <= 0 )
+            return defaultHostBlockSize;
+        
+        return (int) std::ceil(blockSize * sampleRate / hostRate);
+    }
+    
+    WaveformPyramid::Ptr createWaveformFor(const File& file, int numChannels, int64 lengthInSamples, double sampleRate)
+    {
+        if( numChannels <= 0 || lengthInSamples <= 0 )
+            return nullptr;
+        
+        return WaveformPyramid::createFor(file, numChannels, lengthInSamples, sampleRate, ioScheduler.getThumbnailCache());
+    }
+    
+    /*
+     returns nullptr if the file is too big, is already cached, or another instance is already
+     decoding it.  the whole file is decoded to floats before it is packed, so too big is more than
+     maxNumBytes or the cache's budget of floats, whichever is smaller, or enough that the floats and
+     the packed copy together would put the process over the governor's cap.
+     the decode feeds a new waveform for the file.
+     */
+    std::unique_ptr<CacheDecode> startDecodingIntoCache(const File& file, size_t maxNumBytes)
+    {
+        std::unique_ptr<AudioFormatReader> reader (formatManager.createReaderFor(file));
+        if( reader == nullptr )
+            return nullptr;
+        
+        auto numChannels = (int) reader->numChannels;
+        auto length = reader->lengthInSamples;
+        auto allowsLossyEncoding = decodedAudioCache.allowsLossyEncoding();
+        auto encoding = CompactAudioBuffer::chooseFor(*reader, allowsLossyEncoding);
+        
+        //maxNumBytes limits how much is decoded, so it is in floats whatever the encoding
+        auto numBytesDecoded = CompactAudioBuffer::getSizeInBytes(numChannels, length, SampleEncoding::float32);
+        auto numBytesCached = CompactAudioBuffer::getSizeInBytes(numChannels, length, encoding);
+        maxNumBytes = jmin(maxNumBytes, decodedAudioCache.getMaxSizeInBytes());
+        
+        if( length <= 0 || length > std::numeric_limits<int>::max() || numBytesDecoded > maxNumBytes || ! decodedAudioCache.canHold(numBytesCached)
+            || ! memoryGovernor->canFit(numBytesDecoded + numBytesCached) )
+            return nullptr;
+        
+        auto claim = decodedAudioCache.claimDecode(file);
+        if( claim == nullptr )
+            return nullptr;
+        
+        auto decode = std::make_unique<CacheDecode>(memoryGovernor.getObject());
+        decode->file = file;
+        decode->claim = std::move(claim);
+        decode->decoded = new DecodedAudio();
+        decode->decoded->sampleRate = reader->sampleRate;
+        decode->decoded->fileSampleRate = reader->sampleRate;
+        decode->decoded->fileLengthInSamples = length;
+        decode->pcm.setSize(numChannels, (int) length);
+        decode->updateCountedBytes();
+        decode->encoding = encoding;
+        decode->allowsLossyEncoding = allowsLossyEncoding;
+        
+        decode->waveform = createWaveformFor(file, numChannels, length, reader->sampleRate);
+        if( decode->waveform != nullptr )
+            decode->waveform->setIsBeingFed(true);
+        
+        decode->reader = std::move(reader);
+        return decode;
+    }
+    
+    //returns true once the whole file has been decoded and added to the cache
+    bool decodeChunks(CacheDecode& decode, uint32 timeLimitMs)
+    {
+        auto& samples = decode.pcm;
+        auto length = decode.decoded->fileLengthInSamples;
+        auto startTime = Time::getMillisecondCounter();
+        auto wasDecoding = decode.position < length;
+        
+        while( decode.position < length )
+        {
+            if( Time::getMillisecondCounter() - startTime >= timeLimitMs )
+                return false;
+            
+            auto pos = decode.position;
+            auto numToRead = (int) jmin((int64) decodeChunkSizeInSamples, length - pos);
+            decode.reader->read(&samples, (int) pos, numToRead, pos, true, true);
+            feedWaveform(decode, pos, numToRead);
+            decode.position += numToRead;
+        }
+        
+        //once, not again on every call it takes to convert and pack it
+        if( wasDecoding && decode.waveform != nullptr )
+            decode.waveform->storeIfComplete(ioScheduler.getThumbnailCache());
+        
+        if( ! convertChunks(decode, startTime, timeLimitMs) || ! packChunks(decode, startTime, timeLimitMs) )
+            return false;
+        
+        decodedAudioCache.add(decode.file, decode.decoded);
+        decode.updateCountedBytes(true);
+        return true;
+    }
+    
+    /*
+     at offline quality, converts the finished decode to the host's rate, to be cached instead of the
+     file-rate samples.  returns false if the time ran out first.
+     */
+    bool convertChunks(CacheDecode& decode, uint32 startTime, uint32 timeLimitMs)
+    {
+        if( ! decode.hasCheckedConversion )
+        {
+            decode.hasCheckedConversion = true;
+            
+            auto hostRate = hostSampleRate.get();
+            auto fileRate = decode.decoded->fileSampleRate;
+            if( resamplingQuality.load() != ResamplingQuality::offline || hostRate <= 0 || hostRate == fileRate )
+                return true;
+            
+            //converted samples aren't the file's integers any more, so they can't be packed back into them exactly
+            auto encoding = decode.allowsLossyEncoding ? SampleEncoding::float16 : SampleEncoding::float32;
+            auto numChannels = decode.pcm.getNumChannels();
+            auto length = (int64) std::ceil(decode.pcm.getNumSamples() * hostRate / fileRate);
+            auto numBytesCached = CompactAudioBuffer::getSizeInBytes(numChannels, length, encoding);
+            if( length > std::numeric_limits<int>::max()
+                || ! decodedAudioCache.canHold(numBytesCached)
+                || ! memoryGovernor->canFit(CompactAudioBuffer::getSizeInBytes(numChannels, length, SampleEncoding::float32) + numBytesCached) )
+                return true;
+            
+            decode.encoding = encoding;
+            decode.converted.setSize(numChannels, (int) length);
+            decode.updateCountedBytes();
+            decode.convertedSampleRate = hostRate;
+            decode.kernel = &kernelCache->getKernel(ResamplingQuality::offline, fileRate, hostRate);
+        }
+        
+        if( decode.kernel == nullptr )
             return true;
+        
+        auto length = (int64) decode.converted.getNumSamples();
+        auto step = decode.decoded->fileSampleRate / decode.convertedSampleRate;
+        
+        while( decode.convertPosition < length )
+        {
+            if( Time::getMillisecondCounter() - startTime >= timeLimitMs )
+                return false;
+            
+            auto numToConvert = (int) jmin((int64) decodeChunkSizeInSamples, length - decode.convertPosition);
+            decode.kernel->resample(decode.pcm, step, decode.converted, (int) decode.convertPosition, numToConvert);
+            decode.convertPosition += numToConvert;
         }
         
-        return false;
+        return true;
     }
-private:
-    Fifo<juce::URL> urlFifo;
-    Fifo<ReferencedTransportSourceData::Ptr>& transportSourceFifo;
-    ReleasePool<ReferencedTransportSourceData>& releasePool;
     
-    TimeSliceThread& directoryScannerBackgroundThread;
+    /*
+     packs the decoded or converted floats into the cache's encoding, then lets go of them.  returns
+     false if the time ran out first.
+     */
+    bool packChunks(CacheDecode& decode, uint32 startTime, uint32 timeLimitMs)
+    {
+        auto isConverted = decode.kernel != nullptr;
+        auto& source = isConverted ? decode.converted : decode.pcm;
+        auto& packed = decode.decoded->samples;
+        auto length = (int64) source.getNumSamples();
+        
+        if( decode.packPosition == 0 && packed.getNumSamples() == 0 )
+        {
+            packed.setSize(source.getNumChannels(), (int) length, decode.encoding);
+            decode.updateCountedBytes();
+            if( isConverted )
+                decode.decoded->sampleRate = decode.convertedSampleRate;
+        }
+        
+        while( decode.packPosition < length )
+        {
+            if( Time::getMillisecondCounter() - startTime >= timeLimitMs )
+                return false;
+            
+            auto numToPack = (int) jmin((int64) decodeChunkSizeInSamples, length - decode.packPosition);
+            packed.write(source, (int) decode.packPosition, (int) decode.packPosition, numToPack);
+            decode.packPosition += numToPack;
+        }
+        
+        decode.pcm.setSize(0, 0);
+        decode.converted.setSize(0, 0);
+        decode.updateCountedBytes();
+        return true;
+    }
+    
+    static_assert(WaveformPyramid::regionSizeInSamples % decodeChunkSizeInSamples == 0
+                  && decodeChunkSizeInSamples % WaveformPyramid::samplesPerPointAtFinestLevel == 0,
+                  "every decoded chunk must lie inside one waveform region");
+    
+    //each region is claimed as the decode reaches it.  one a builder already has is left to it.
+    void feedWaveform(CacheDecode& decode, int64 position, int numSamples)
+    {
+        auto* waveform = decode.waveform.get();
+        if( waveform == nullptr )
+            return;
+        
+        auto region = waveform->getRegionContaining(position);
+        if( region != decode.currentRegion )
+        {
+            decode.currentRegion = region;
+            decode.ownsCurrentRegion = waveform->tryClaimRegion(region);
+        }
+        
+        if( decode.ownsCurrentRegion )
+            waveform->addSamples(decode.pcm, (int) position, position, numSamples);
+    }
     
-    juce::Atomic<bool> urlNeedsProcessingFlag { false };
+    /*
+     short files (click and guide tracks, one-shots) are decoded before they are played, so every
+     instance playing them shares one copy instead of each streaming the file on its own.
+     */
+    std::unique_ptr<CacheDecode> decodeShortFileNow(const File& file, int generation)
+    {
+        shouldAbandonDecode.store(false);
+        auto decode = startDecodingIntoCache(file, maxBytesToDecodeBeforePlaying);
+        if( decode == nullptr )
+            return nullptr;
+        
+        while( ! decodeChunks(*decode, decodeTimeSliceMs) )
+        {
+            if( isSuperseded(generation) || shouldAbandonDecode.load() )
+                return nullptr;
+        }
+        
+        return decode;
+    }
     
-    AudioFormatManager& formatManager;
+    /*
+     hands a long file's decoder the file's DecodedAudioFill, starting one if none is in progress.
+     returns nullptr if the file isn't streamed by a decoder, is already cached or being decoded,
+     or is too big to cache.
+     */
+    DecodedAudioFill::Ptr startFillingCache(ReferencedTransportSourceData& rts)
+    {
+        if( rts.decoderSource == nullptr || memoryGovernor->isUnderPressure() )
+            return nullptr;
+        
+        auto file = rts.currentAudioFile.getLocalFile();
+        auto fill = findCacheFill(file);
+        
+        if( fill == nullptr )
+        {
+            std::unique_ptr<AudioFormatReader> reader (formatManager.createReaderFor(file));
+            if( reader == nullptr )
+                return nullptr;
+            
+            fill = DecodedAudioFill::start(file, *reader, decodedAudioCache, maxBytesToCacheWhilePlaying);
+            if( fill == nullptr )
+                return nullptr;
+            
+            addCacheFill(fill);
+            
+            //decoding backwards through anything else means decoding everything before each region, every time
+            auto* format = formatManager.findFormatForFileExtension(file.getFileExtension());
+            if( format != nullptr && WaveformPyramidBuilder::canSeekCheaply(*format) )
+                ioScheduler.getAnalysisPool().addJob(new CacheFillJob(*this, fill, std::move(reader), rts.waveform), true);
+        }
+        
+        rts.decoderSource->setCacheFillToFeed(fill);
+        return fill;
+    }
+    
+    DecodedAudioFill::Ptr findCacheFill(const File& file) const
+    {
+        const ScopedLock sl(cacheFillLock);
+        auto found = std::find_if(cacheFills.begin(),
+                                  cacheFills.end(),
+                                  [&file](const auto& fill)
+                                  {
+                                      return fill->getFile() == file && ! fill->isAbandoned() && ! fill->isComplete();
+                                  });
+        
+        return found != cacheFills.end() ? *found : nullptr;
+    }
+    
+    //the oldest is abandoned to make room, since it is the least likely to be played again
+    void addCacheFill(DecodedAudioFill::Ptr fill)
+    {
+        const ScopedLock sl(cacheFillLock);
+        cacheFills.erase(std::remove_if(cacheFills.begin(),
+                                        cacheFills.end(),
+                                        [](const auto& f)
+                                        {
+                                            return f->isAbandoned() || f->isComplete();
+                                        }),
+                         cacheFills.end());
+        
+        while( (int) cacheFills.size() >= maxNumCacheFills )
+        {
+            cacheFills.front()->abandon();
+            cacheFills.erase(cacheFills.begin());
+        }
+        
+        cacheFills.push_back(fill);
+    }
+    
+    void abandonCacheFills()
+    {
+        const ScopedLock sl(cacheFillLock);
+        for( auto& fill : cacheFills )
+            fill->abandon();
+        
+        cacheFills.clear();
+    }
+    
+    static_assert(DecodedAudioFill::regionSizeInSamples == WaveformPyramid::regionSizeInSamples,
+                  "a cache fill's regions must be its waveform's");
+    
+    //returns false once every region has been claimed, by the job or the file's decoder, or the fill is abandoned
+    bool fillNextRegion(CacheFillJob& job)
+    {
+        auto& fill = *job.fill;
+        if( shouldStop.get() )
+            return false;
+        
+        while( job.nextRegion >= 0 && ! fill.tryClaimRegion(job.nextRegion) )
+            --job.nextRegion;
+        
+        if( job.nextRegion < 0 )
+            return false;
+        
+        auto region = job.nextRegion--;
+        auto range = fill.getRegionRange(region);
+        auto numSamples = (int) range.getLength();
+        job.buffer.setSize(fill.getNumChannels(), numSamples, false, false, true);
+        job.reader->read(&job.buffer, 0, numSamples, range.getStart(), true, true);
+        fill.addSamples(job.buffer, 0, range.getStart(), numSamples);
+        
+        //so a builder doesn't decode the region a second time to draw it
+        if( job.waveform != nullptr && job.waveform->tryClaimRegion(region) )
+        {
+            job.waveform->addSamples(job.buffer, 0, range.getStart(), numSamples);
+            job.waveform->storeIfComplete(ioScheduler.getThumbnailCache());
+        }
+        
+        return true;
+    }
+    
+    /*
+     returns nullptr for formats that can't be mapped (i.e. compressed ones), so the caller
+     can fall back to a streaming reader.
+     */
+    std::unique_ptr<MemoryMappedAudioFormatReader> createMemoryMappedReaderFor(const File& file)
+    {
+        auto* format = formatManager.findFormatForFileExtension(file.getFileExtension());
+        if( format == nullptr )
+            return nullptr;
+        
+        //the start of the file is faulted in by its TouchAheadSource, as it is prepared
+        std::unique_ptr<MemoryMappedAudioFormatReader> reader (format->createMemoryMappedReader(file));
+        if( reader == nullptr || ! reader->mapEntireFile() )
+            return nullptr;
+        
+        return reader;
+    }
+    
+    //the decoder's, BufferingAudioSource's and TouchAheadSource's prepareToPlay block until the read-ahead has been pre-filled,
+    //unless it is prefill only
+    void prepare(ReferencedTransportSourceData& rts)
+    {
+        auto sampleRate = hostSampleRate.get();
+        auto blockSize = hostBlockSize.get();
+        
+        if( sampleRate <= 0 || blockSize <= 0 )
+            return; //prepareToPlay hasn't been called yet.  setPlaybackSpec will prepare it.
+        
+        if( rts.preparedSampleRate == sampleRate && rts.preparedBlockSize == blockSize )
+            return;
+        
+        rts.transportSource.prepareToPlay(blockSize, sampleRate);
+        rts.preparedSampleRate = sampleRate;
+        rts.preparedBlockSize = blockSize;
+    }
+    
+    bool publish(ReferencedTransportSourceData::Ptr rts, int generation)
+    {
+        const ScopedLock sl(prepareLock);
+        //a prefetched neighbour has to be pre-filled in full now
+        setPrefillOnly(*rts, false);
+        prepare(*rts);
+        
+        //pre-filling the read-ahead takes a while.  a newer request may have arrived meanwhile.
+        if( isSuperseded(generation) )
+            return false;
+        
+        //it may have been warmed up before the quality last changed
+        rts->resamplingSource->setQuality(resamplingQuality.load());
+        if( rts->readAhead != nullptr )
+            rts->readAhead->setUse(MemoryUse::readAhead);
+        
+        //keep playing across the swap, so the audio thread can crossfade old -> new
+        if( transportIsPlaying.get() )
+            rts->transportSource.start();
+        else
+            rts->transportSource.stop();
+        
+        //the audio thread never picked up the previous one.  keep it around in case the user goes back to it.
+        if( auto neverPlayed = sourceMailbox.post(rts) )
+            addWarmSource(neverPlayed);
+        
+        {
+            const ScopedLock lsl(latestSourceLock);
+            latestSource = rts;
+        }
+        
+        telemetry.loadTime.recordTicks(Time::getHighResolutionTicks() - workRequestTicks);
+        playerChanges.sendChangeMessage();
+        return true;
+    }
+    
+    //called by the governor, on the directory scan thread.  neither a warm source nor a decode is worth keeping over the cap
+    void freeMemory(MemoryUse use, size_t) override
+    {
+        if( use == MemoryUse::decoding )
+        {
+            shouldAbandonDecode.store(true);
+            abandonCacheFills();
+        }
+        
+        if( use != MemoryUse::warmSources )
+            return;
+        
+        std::vector<ReferencedTransportSourceData::Ptr> released;
+        const ScopedLock sl(warmLock);
+        released.swap(warmSources);
+    }
 };
 /**
 */
@@ -257,55 +1264,96 @@ public:
     //==============================================================================
     AudioFilePlayerAudioProcessor();
     ~AudioFilePlayerAudioProcessor() override;
-
+    
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
-
+   
    #ifndef JucePlugin_PreferredChannelConfigurations
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
    #endif
-
+   
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
-
+    
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
     bool hasEditor() const override;
-
+    
     //==============================================================================
     const juce::String getName() const override;
-
+    
     bool acceptsMidi() const override;
     bool producesMidi() const override;
     bool isMidiEffect() const override;
     double getTailLengthSeconds() const override;
-
+    
     //==============================================================================
     int getNumPrograms() override;
     int getCurrentProgram() override;
     void setCurrentProgram (int index) override;
     const juce::String getProgramName (int index) override;
     void changeProgramName (int index, const juce::String& newName) override;
-
+    
     //==============================================================================
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
-
+    
     using APVTS = juce::AudioProcessorValueTreeState;
     static APVTS::ParameterLayout createParameterLayout();
     APVTS apvts { *this, nullptr, "Properties", createParameterLayout() };
     juce::Atomic<bool> transportIsPlaying { false };
     
-    TimeSliceThread directoryScannerBackgroundThread  { "audio file preview" };
+    /*
+     source swaps, the transport starting or stopping and position jumps.  listeners are called on
+     the message thread, so the editor only has to redraw when something has actually happened.
+     triggered from the loader as well, but never from the audio thread.
+     */
+    juce::ChangeBroadcaster playerChanges;
     
-    Fifo<ReferencedTransportSourceData::Ptr> fifo;
-    ReleasePool<ReferencedTransportSourceData> pool;
+    juce::SharedResourcePointer<SharedIOScheduler> ioScheduler;
+    
+    LatestObjectMailbox<ReferencedTransportSourceData> sourceMailbox;
+    juce::SharedResourcePointer<ReleasePool<ReferencedTransportSourceData>> pool;
     
-    AudioTransportSource transportSource;
     AudioFormatManager formatManager;
-    AudioFormatReaderSourceCreator transportSourceCreator {fifo, pool, directoryScannerBackgroundThread, formatManager};
     
-    ReferencedTransportSourceData::Ptr activeSource;
+    juce::SharedResourcePointer<ReadAheadPlanner> readAheadPlanner;
+    
+    //caps the audio every instance in the process holds in memory, all together
+    juce::SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    
+    //A/B-ing between files is served from here instead of re-opening them: short files as soon as they are
+    //opened, long ones once they have been decoded in full.  shared with every other instance.
+    juce::SharedResourcePointer<DecodedAudioCache> decodedAudioCache;
+    
+    //written by the audio thread and the loader, readable from anywhere without locking
+    PerformanceTelemetry telemetry;
+    
+    AudioFormatReaderSourceCreator transportSourceCreator {sourceMailbox, ioScheduler.getObject(), formatManager, decodedAudioCache.getObject(), telemetry, transportIsPlaying, playerChanges};
+    
+    //message thread transport controls.  these act on the most recently loaded source.
+    ReferencedTransportSourceData::Ptr getCurrentSource() const { return transportSourceCreator.getLatestSource(); }
+    void startTransport();
+    void stopTransport();
+    bool isTransportPlaying();
+    double getCurrentPosition() const;
+    void setPosition(double newPosition);
+    double getLengthInSeconds() const;
+    
+    //the current source's read-ahead, and the budget all instances share.  sources that don't read
+    //ahead (memory-mapped and cached files) report none
+    ReadAheadPlanner::Status getReadAheadStatus() const;
+    void setReadAheadBudget(size_t maxBytes) { readAheadPlanner->setMaxBytes(maxBytes); }
+    
+    //what this instance holds, or every instance in the process.  the decoded cache and waveforms
+    //are shared, so they only show up in the process's
+    MemoryGovernor::Usage getMemoryUsage(bool wholeProcess) const;
+    void setMemoryCap(size_t maxBytes) { memoryGovernor->setMaxBytes(maxBytes); }
+    size_t getMemoryCap() const { return memoryGovernor->getMaxBytes(); }
+    
+    //message thread.  saved with the plugin's state
+    void setResamplingQuality(ResamplingQuality newQuality);
+    ResamplingQuality getResamplingQuality() const { return transportSourceCreator.getResamplingQuality(); }
     
     template<typename SourceType>
     static void refreshCurrentFileInAPVTS(APVTS& apvts, SourceType& currentAudioFile)
@@ -316,8 +1364,18 @@ public:
             apvts.state.setProperty("CurrentFile", file.getFullPathName(), nullptr);
         }
     }
-    juce::Atomic<bool> sourceHasChanged { false };
 private:
+    //audio thread only.  these are only ever let go of through the pool.
+    ReferencedTransportSourceData::Ptr activeSource, fadingSource;
+    
+    void retire(ReferencedTransportSourceData::Ptr& ptr);
+    AudioBuffer<float> crossfadeBuffer;
+    int crossfadeLengthInSamples { 0 };
+    int crossfadeSamplesRemaining { 0 };
+    static constexpr double crossfadeLengthInSeconds = 0.01;
+    
+    void renderCrossfade(juce::AudioBuffer<float>& buffer);
+    bool readAheadIsReady(const ReferencedTransportSourceData& rts, int numSamples) const;
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioFilePlayerAudioProcessor)
 };
@@ -0,0 +1,401 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.cpp
+
+  ==============================================================================
+*/
+
+#include "PolyphaseResampler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <immintrin.h>
+ #define POLYPHASE_RESAMPLER_USE_SSE 1
+ //the AVX kernel is compiled for AVX and FMA on its own, and only called if the CPU has them
+ #if JUCE_MSVC
+  #define POLYPHASE_RESAMPLER_AVX_FMA
+ #else
+  #define POLYPHASE_RESAMPLER_AVX_FMA __attribute__((target("avx,fma")))
+ #endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+ #include <arm_neon.h>
+ #define POLYPHASE_RESAMPLER_USE_NEON 1
+#endif
+
+namespace
+{
+struct KernelDesign
+{
+    int numTaps, numPhases;
+    bool interpolatesPhases;
+    //the Kaiser window's beta: higher is further down in the stopband, but a wider transition
+    double beta;
+    //where the passband ends, as a fraction of the lower of the two Nyquist frequencies
+    double rolloff;
+};
+
+KernelDesign getDesign(ResamplingQuality quality)
+{
+    switch( quality )
+    {
+        case ResamplingQuality::browsing: return { 16, 256, false, 5.0, 0.85 };
+        case ResamplingQuality::playback: return { 64, 256, true, 9.0, 0.94 };
+        case ResamplingQuality::offline: return { 128, 1024, true, 12.0, 0.97 };
+    }
+    
+    jassertfalse;
+    return { 64, 256, true, 9.0, 0.94 };
+}
+
+//the zeroth order modified Bessel function of the first kind, which the Kaiser window is made of
+double besselI0(double x)
+{
+    double sum = 1, term = 1;
+    for( int k = 1; k < 64 && term > sum * 1.0e-12; ++k )
+    {
+        term *= (x * 0.5 / k) * (x * 0.5 / k);
+        sum += term;
+    }
+    
+    return sum;
+}
+}
+
+//==============================================================================
+ResamplingKernel::ResamplingKernel(ResamplingQuality quality, double inputSampleRate, double outputSampleRate)
+{
+    jassert(inputSampleRate > 0 && outputSampleRate > 0);
+    
+    auto design = getDesign(quality);
+    auto ratio = jmin(1.0, outputSampleRate / inputSampleRate);
+    
+    //converting down narrows the passband, and the kernel widens with it to keep the same
+    //transition band relative to the output's Nyquist, up to maxNumTaps
+    auto wantedTaps = (int) std::ceil(design.numTaps / ratio);
+    numTaps = jmin(maxNumTaps, (wantedTaps + tapGranularity - 1) / tapGranularity * tapGranularity);
+    numPhases = design.numPhases;
+    interpolatesPhases = design.interpolatesPhases;
+    
+    auto cutoff = design.rolloff * ratio;
+    auto halfLength = numTaps / 2;
+    auto windowScale = 1.0 / besselI0(design.beta);
+    
+    coefficients.resize((size_t) (numPhases + 1) * (size_t) numTaps);
+    for( int phase = 0; phase <= numPhases; ++phase )
+    {
+        auto* row = coefficients.data() + (size_t) phase * (size_t) numTaps;
+        auto fraction = (double) phase / numPhases;
+        double sum = 0;
+        
+        for( int k = 0; k < numTaps; ++k )
+        {
+            //how far this tap's input sample is from the output's position
+            auto distance = (k - getNumTapsBefore()) - fraction;
+            auto x = distance / halfLength;
+            auto window = std::abs(x) < 1.0 ? besselI0(design.beta * std::sqrt(1.0 - x * x)) * windowScale : 0.0;
+            auto arg = MathConstants<double>::pi * cutoff * distance;
+            auto sinc = std::abs(arg) < 1.0e-9 ? 1.0 : std::sin(arg) / arg;
+            
+            auto coefficient = cutoff * sinc * window;
+            row[k] = (float) coefficient;
+            sum += coefficient;
+        }
+        
+        //every phase passes DC at exactly unity, so there is no ripple at the phase rate
+        for( int k = 0; k < numTaps; ++k )
+            row[k] = (float) (row[k] / sum);
+    }
+}
+
+#if POLYPHASE_RESAMPLER_USE_SSE
+namespace
+{
+const bool cpuHasAVXAndFMA = SystemStats::hasAVX() && SystemStats::hasFMA3();
+
+POLYPHASE_RESAMPLER_AVX_FMA float dotProductAVX(const float* a, const float* b, int numTaps) noexcept
+{
+    auto sum = _mm256_setzero_ps();
+    for( int i = 0; i < numTaps; i += 8 )
+        sum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum);
+    
+    auto quad = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    auto pair = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+    return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+}
+}
+#endif
+
+float ResamplingKernel::dotProduct(const float* a, const float* b, int numTaps) noexcept
+{
+    jassert(numTaps % tapGranularity == 0);
+   
+   #if POLYPHASE_RESAMPLER_USE_SSE
+    if( cpuHasAVXAndFMA )
+        return dotProductAVX(a, b, numTaps);
+    
+    //two accumulators, so consecutive adds don't wait on each other
+    auto sum0 = _mm_setzero_ps();
+    auto sum1 = _mm_setzero_ps();
+    for( int i = 0; i < numTaps; i += 8 )
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    
+    auto quad = _mm_add_ps(sum0, sum1);
+    auto pair = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+    return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+   #elif POLYPHASE_RESAMPLER_USE_NEON
+    auto sum0 = vdupq_n_f32(0);
+    auto sum1 = vdupq_n_f32(0);
+    for( int i = 0; i < numTaps; i += 8 )
+    {
+        sum0 = vmlaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    
+    auto quad = vaddq_f32(sum0, sum1);
+    auto pair = vadd_f32(vget_low_f32(quad), vget_high_f32(quad));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+   #else
+    float sum = 0;
+    for( int i = 0; i < numTaps; ++i )
+        sum += a[i] * b[i];
+    
+    return sum;
+   #endif
+}
+
+void ResamplingKernel::resample(const AudioBuffer<float>& input, double step, AudioBuffer<float>& output, int startSample, int numSamples) const noexcept
+{
+    auto inputLength = (int64) input.getNumSamples();
+    auto numChannels = jmin(input.getNumChannels(), output.getNumChannels());
+    float edge[maxNumTaps];
+    
+    for( int ch = 0; ch < numChannels; ++ch )
+    {
+        auto* in = input.getReadPointer(ch);
+        auto* out = output.getWritePointer(ch);
+        
+        for( int i = startSample; i < startSample + numSamples; ++i )
+        {
+            auto position = i * step;
+            auto index = (int64) position;
+            auto firstTap = index - getNumTapsBefore();
+            
+            if( firstTap >= 0 && firstTap + numTaps <= inputLength )
+            {
+                out[i] = process(in + firstTap, position - (double) index);
+                continue;
+            }
+            
+            //the first and last few outputs reach past the ends of the input
+            for( int k = 0; k < numTaps; ++k )
+                edge[k] = isPositiveAndBelow(firstTap + k, inputLength) ? in[firstTap + k] : 0.0f;
+            
+            out[i] = process(edge, position - (double) index);
+        }
+    }
+    
+    for( int ch = numChannels; ch < output.getNumChannels(); ++ch )
+        output.clear(ch, startSample, numSamples);
+}
+
+//==============================================================================
+const ResamplingKernel& ResamplingKernelCache::getKernel(ResamplingQuality quality, double inputSampleRate, double outputSampleRate)
+{
+    auto key = std::make_tuple((int) quality, roundToInt64(inputSampleRate * 1000), roundToInt64(outputSampleRate * 1000));
+    
+    const ScopedLock sl(lock);
+    auto& kernel = kernels[key];
+    if( kernel == nullptr )
+        kernel = std::make_unique<ResamplingKernel>(quality, inputSampleRate, outputSampleRate);
+    
+    return *kernel;
+}
+
+//==============================================================================
+PolyphaseResamplingSource::PolyphaseResamplingSource(PositionableAudioSource* sourceToResample,
+                                                     double rateOfSource,
+                                                     ResamplingQuality initialQuality,
+                                                     int channels) :
+source(sourceToResample),
+sourceSampleRate(rateOfSource),
+numChannels(channels),
+quality(initialQuality)
+{
+    jassert(source != nullptr);
+}
+
+void PolyphaseResamplingSource::prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+{
+    auto newStep = sourceSampleRate > 0 && sampleRate > 0 ? sourceSampleRate / sampleRate : 1.0;
+    maxBlockSize = samplesPerBlockExpected;
+    
+    if( newStep == 1.0 )
+    {
+        step.store(1.0);
+        source->prepareToPlay(samplesPerBlockExpected, sampleRate);
+        return;
+    }
+    
+    browsingKernel = &kernelCache->getKernel(ResamplingQuality::browsing, sourceSampleRate, sampleRate);
+    playbackKernel = &kernelCache->getKernel(ResamplingQuality::playback, sourceSampleRate, sampleRate);
+    
+    auto maxNumTaps = jmax(browsingKernel->getNumTaps(), playbackKernel->getNumTaps());
+    maxNumTapsBefore = jmax(browsingKernel->getNumTapsBefore(), playbackKernel->getNumTapsBefore());
+    
+    //one block's worth of input either side of the kernel, and a little slack for the fraction
+    auto maxInputPerBlock = (int) std::ceil(samplesPerBlockExpected * newStep);
+    inputBuffer.setSize(numChannels, maxNumTapsBefore + maxInputPerBlock + maxNumTaps + 4);
+    
+    source->prepareToPlay(maxInputPerBlock + maxNumTaps, sourceSampleRate);
+    
+    //positions are in output samples, so where it was has to be worked out at the new rate
+    auto position = outputPosition.load();
+    step.store(newStep);
+    seek(position);
+}
+
+void PolyphaseResamplingSource::releaseResources()
+{
+    source->releaseResources();
+    inputBuffer.setSize(0, 0);
+    numBuffered = 0;
+}
+
+void PolyphaseResamplingSource::setNextReadPosition(int64 newPosition)
+{
+    outputPosition.store(newPosition);
+    pendingSeek.store(newPosition);
+}
+
+int64 PolyphaseResamplingSource::getNextReadPosition() const
+{
+    auto position = outputPosition.load();
+    auto length = getTotalLength();
+    
+    return isLooping() && length > 0 ? position % length : position;
+}
+
+int64 PolyphaseResamplingSource::getTotalLength() const
+{
+    return (int64) ((double) source->getTotalLength() / step.load());
+}
+
+void PolyphaseResamplingSource::seek(int64 newOutputPosition)
+{
+    outputPosition.store(newOutputPosition);
+    
+    if( step.load() == 1.0 )
+    {
+        source->setNextReadPosition(newOutputPosition);
+        return;
+    }
+    
+    auto sourcePosition = (double) newOutputPosition * step.load();
+    inputIndex = (int64) sourcePosition;
+    fraction = sourcePosition - (double) inputIndex;
+    
+    firstBufferedInput = inputIndex - maxNumTapsBefore;
+    numBuffered = 0;
+    source->setNextReadPosition(jmax((int64) 0, firstBufferedInput));
+}
+
+void PolyphaseResamplingSource::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    auto seekTo = pendingSeek.exchange(-1);
+    if( seekTo >= 0 )
+        seek(seekTo);
+    
+    if( step.load() == 1.0 )
+    {
+        source->getNextAudioBlock(info);
+        outputPosition.fetch_add(info.numSamples);
+        return;
+    }
+    
+    const auto& kernel = quality.load() == ResamplingQuality::browsing ? *browsingKernel : *playbackKernel;
+    
+    //the input buffer only has room for a block of the size it was prepared for
+    for( int done = 0; done < info.numSamples; )
+    {
+        auto numThisTime = jmin(maxBlockSize, info.numSamples - done);
+        resampleBlock(*info.buffer, info.startSample + done, numThisTime, kernel);
+        done += numThisTime;
+    }
+    
+    outputPosition.fetch_add(info.numSamples);
+}
+
+void PolyphaseResamplingSource::resampleBlock(AudioBuffer<float>& output, int startSample, int numSamples, const ResamplingKernel& kernel)
+{
+    auto currentStep = step.load();
+    auto tapsBefore = kernel.getNumTapsBefore();
+    auto numTaps = kernel.getNumTaps();
+    
+    //read whatever the last output's taps reach that hasn't been read yet
+    auto lastIndex = inputIndex + (int64) (fraction + (numSamples - 1) * currentStep);
+    auto numNeeded = (int) (lastIndex - tapsBefore + numTaps - firstBufferedInput);
+    jassert(numNeeded <= inputBuffer.getNumSamples());
+    
+    while( numBuffered < numNeeded )
+    {
+        auto next = firstBufferedInput + numBuffered;
+        
+        //just after a seek to the start, the first taps are before the source's first sample
+        if( next < 0 )
+        {
+            auto numSilent = (int) jmin((int64) (numNeeded - numBuffered), -next);
+            inputBuffer.clear(numBuffered, numSilent);
+            numBuffered += numSilent;
+            continue;
+        }
+        
+        AudioSourceChannelInfo read(&inputBuffer, numBuffered, numNeeded - numBuffered);
+        source->getNextAudioBlock(read);
+        numBuffered = numNeeded;
+    }
+    
+    auto numChannelsToWrite = jmin(numChannels, output.getNumChannels());
+    for( int ch = 0; ch < numChannelsToWrite; ++ch )
+    {
+        auto* in = inputBuffer.getReadPointer(ch);
+        auto* out = output.getWritePointer(ch, startSample);
+        auto index = inputIndex;
+        auto frac = fraction;
+        
+        for( int i = 0; i < numSamples; ++i )
+        {
+            out[i] = kernel.process(in + (index - tapsBefore - firstBufferedInput), frac);
+            
+            frac += currentStep;
+            auto whole = (int64) frac;
+            index += whole;
+            frac -= (double) whole;
+        }
+    }
+    
+    for( int ch = numChannelsToWrite; ch < output.getNumChannels(); ++ch )
+        output.clear(ch, startSample, numSamples);
+    
+    auto advanced = fraction + numSamples * currentStep;
+    auto whole = (int64) advanced;
+    inputIndex += whole;
+    fraction = advanced - (double) whole;
+    
+    //keep just enough history for the next output's first taps
+    auto numToDiscard = (int) (inputIndex - maxNumTapsBefore - firstBufferedInput);
+    if( numToDiscard > 0 )
+    {
+        auto numToKeep = numBuffered - numToDiscard;
+        for( int ch = 0; ch < numChannels; ++ch )
+        {
+            auto* data = inputBuffer.getWritePointer(ch);
+            std::memmove(data, data + numToDiscard, (size_t) jmax(0, numToKeep) * sizeof(float));
+        }
+        
+        firstBufferedInput += numToDiscard;
+        numBuffered = jmax(0, numToKeep);
+    }
+}
@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.h
+    Windowed-sinc sample rate conversion with SIMD kernels, for playing files
+    whose rate differs from the host's.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+//==============================================================================
+enum class ResamplingQuality
+{
+    //a short filter and the nearest phase: a fraction of the CPU, for auditioning while browsing
+    browsing,
+    //flat to within a fraction of a dB up to ~20 kHz at 44.1 kHz, with aliases and images ~90 dB down
+    playback,
+    /*
+     longer still, and too slow to run every block in hundreds of instances.  short files are
+     converted with it once, as they are decoded into the cache.  long files are cached at their own
+     rate, so they are played at playback quality instead, like streamed ones.
+     */
+    offline
+};
+
+/*
+ A Kaiser windowed sinc, sampled at numPhases fractional offsets.  An output sample between two
+ phases is interpolated from both, except at browsing quality, which takes the nearest.
+ When converting down, the cutoff follows the output's Nyquist, so nothing aliases.
+ 
+ Every phase is a straight dot product over numTaps input samples, which is done with AVX and
+ FMA if the CPU has them, and otherwise SSE or NEON, whichever the build targets.  Immutable once
+ built, so any number of threads can use one at once.
+ */
+struct ResamplingKernel
+{
+    ResamplingKernel(ResamplingQuality quality, double inputSampleRate, double outputSampleRate);
+    
+    int getNumTaps() const noexcept { return numTaps; }
+    //how many input samples before an output's position the first tap reads
+    int getNumTapsBefore() const noexcept { return numTaps / 2 - 1; }
+    
+    //firstTap is getNumTapsBefore() samples before the output's position, which is fraction past it
+    float process(const float* firstTap, double fraction) const noexcept
+    {
+        auto position = fraction * numPhases;
+        auto phase = (int) position;
+        
+        if( ! interpolatesPhases )
+            return dotProduct(firstTap, getPhase(position - phase < 0.5 ? phase : phase + 1), numTaps);
+        
+        auto a = dotProduct(firstTap, getPhase(phase), numTaps);
+        auto b = dotProduct(firstTap, getPhase(phase + 1), numTaps);
+        return a + (float) (position - phase) * (b - a);
+    }
+    
+    /*
+     output samples [startSample, startSample + numSamples) of the whole of input, converted at
+     step input samples per output sample.  input before its start or after its end is silence.
+     */
+    void resample(const AudioBuffer<float>& input, double step, AudioBuffer<float>& output, int startSample, int numSamples) const noexcept;
+    
+    static float dotProduct(const float* a, const float* b, int numTaps) noexcept;
+    
+    //a multiple of the widest SIMD register, so the dot product never has a tail
+    static constexpr int tapGranularity = 8;
+    static constexpr int maxNumTaps = 128;
+private:
+    int numTaps { 0 }, numPhases { 0 };
+    bool interpolatesPhases { true };
+    //numPhases + 1 rows of numTaps, so the phase after the last one can be interpolated towards
+    std::vector<float> coefficients;
+    
+    const float* getPhase(int phase) const noexcept { return coefficients.data() + (size_t) phase * (size_t) numTaps; }
+};
+
+/*
+ Use it through a juce::SharedResourcePointer<ResamplingKernelCache>.  Each kernel is built once
+ per quality and pair of rates and kept until the cache goes, so sources can hold plain pointers
+ to them, and use them on the audio thread.
+ */
+struct ResamplingKernelCache
+{
+    const ResamplingKernel& getKernel(ResamplingQuality quality, double inputSampleRate, double outputSampleRate);
+private:
+    CriticalSection lock;
+    //quality, then both rates in mHz
+    std::map<std::tuple<int, int64, int64>, std::unique_ptr<ResamplingKernel>> kernels;
+};
+
+//==============================================================================
+/*
+ Plays source, which runs at sourceSampleRate, at whatever rate it is prepared at.  Its positions
+ and length are in output samples, so the AudioTransportSource playing it is given no source rate
+ to correct for, and doesn't add a ResamplingAudioSource of its own.  At the source's own rate it
+ is a straight pass-through.
+ 
+ Realtime safe: getNextAudioBlock never allocates or locks.  setNextReadPosition and setQuality
+ can be called from any thread, and take effect at the next block.  Offline quality plays at
+ playback quality.
+ */
+struct PolyphaseResamplingSource : PositionableAudioSource
+{
+    PolyphaseResamplingSource(PositionableAudioSource* sourceToResample,
+                              double sourceSampleRate,
+                              ResamplingQuality initialQuality,
+                              int numChannels = 2);
+    
+    void setQuality(ResamplingQuality newQuality) noexcept { quality.store(newQuality); }
+    ResamplingQuality getQuality() const noexcept { return quality.load(); }
+    
+    //false until it has been prepared at a rate other than the source's
+    bool isResampling() const noexcept { return step.load() != 1.0; }
+    
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override;
+    void releaseResources() override;
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+    
+    void setNextReadPosition(int64 newPosition) override;
+    int64 getNextReadPosition() const override;
+    int64 getTotalLength() const override;
+    bool isLooping() const override { return source->isLooping(); }
+    void setLooping(bool shouldLoop) override { source->setLooping(shouldLoop); }
+private:
+    //not owned
+    PositionableAudioSource* const source;
+    const double sourceSampleRate;
+    const int numChannels;
+    
+    SharedResourcePointer<ResamplingKernelCache> kernelCache;
+    std::atomic<ResamplingQuality> quality;
+    const ResamplingKernel* browsingKernel { nullptr };
+    const ResamplingKernel* playbackKernel { nullptr };
+    
+    //input samples per output sample.  exactly 1 passes the source straight through
+    std::atomic<double> step { 1.0 };
+    
+    //everything below is set up by prepareToPlay, and then only touched by the audio thread
+    int maxBlockSize { 0 };
+    //the history kept between blocks, enough for either kernel
+    int maxNumTapsBefore { 0 };
+    
+    //input samples [firstBufferedInput, firstBufferedInput + numBuffered)
+    AudioBuffer<float> inputBuffer;
+    int64 firstBufferedInput { 0 };
+    int numBuffered { 0 };
+    
+    //the next output's position in the input
+    int64 inputIndex { 0 };
+    double fraction { 0 };
+    
+    std::atomic<int64> outputPosition { 0 };
+    std::atomic<int64> pendingSeek { -1 };
+    
+    void seek(int64 newOutputPosition);
+    void resampleBlock(AudioBuffer<float>& output, int startSample, int numSamples, const ResamplingKernel& kernel);
+    
+    JUCE_DECLARE_NON_COPYABLE(PolyphaseResamplingSource)
+};
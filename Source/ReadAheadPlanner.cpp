@@ -0,0 +1,186 @@
+/*
+  ==============================================================================
+
+    ReadAheadPlanner.cpp
+
+  ==============================================================================
+*/
+
+#include "ReadAheadPlanner.h"
+
+void StorageStats::recordRead(int64 numSamples, double sampleRate, int64 ticksSpent) noexcept
+{
+    if( sampleRate <= 0 )
+        return;
+    
+    microsecondsOfAudioRead.fetch_add((uint64) (numSamples * 1.0e6 / sampleRate), std::memory_order_relaxed);
+    microsecondsSpentReading.fetch_add((uint64) (Time::highResolutionTicksToSeconds(ticksSpent) * 1.0e6), std::memory_order_relaxed);
+}
+
+void StorageStats::recordUnderrun() noexcept
+{
+    numUnderruns.fetch_add(1, std::memory_order_relaxed);
+    recentUnderruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+double StorageStats::getRealtimeFactor() const noexcept
+{
+    auto audio = microsecondsOfAudioRead.load(std::memory_order_relaxed);
+    auto spent = microsecondsSpentReading.load(std::memory_order_relaxed);
+    if( audio < minMicrosecondsOfAudioToMeasure )
+        return 0.0;
+    
+    return (double) audio / (double) jmax((uint64) 1, spent);
+}
+
+int StorageStats::takeRecentUnderruns() noexcept
+{
+    auto underruns = recentUnderruns.load(std::memory_order_relaxed);
+    while( ! recentUnderruns.compare_exchange_weak(underruns, underruns / 2, std::memory_order_relaxed) ) {}
+    
+    return underruns;
+}
+
+//==============================================================================
+ThroughputMeteringSource::ThroughputMeteringSource(PositionableAudioSource& sourceToMeter, double sourceSampleRate, std::shared_ptr<StorageStats> statsToUpdate) :
+source(sourceToMeter),
+sampleRate(sourceSampleRate),
+stats(std::move(statsToUpdate))
+{
+    jassert(stats != nullptr);
+}
+
+void ThroughputMeteringSource::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    auto start = Time::getHighResolutionTicks();
+    source.getNextAudioBlock(info);
+    stats->recordRead(info.numSamples, sampleRate, Time::getHighResolutionTicks() - start);
+}
+
+//==============================================================================
+ReadAheadPlanner::Reservation::Reservation(std::shared_ptr<StorageStats> s, int samples, double rate, const void* o) :
+stats(std::move(s)),
+numSamples(samples),
+sampleRate(rate),
+numBytes((size_t) samples * numBufferedChannels * sizeof(float)),
+owner(o)
+{
+}
+
+ReadAheadPlanner::Reservation::~Reservation()
+{
+    planner->release(*this);
+}
+
+//==============================================================================
+ReadAheadPlanner::ReadAheadPlanner()
+{
+    memoryGovernor->addHolder(this);
+}
+
+ReadAheadPlanner::~ReadAheadPlanner()
+{
+    memoryGovernor->removeHolder(this);
+    jassert(reservations.empty());
+}
+
+std::unique_ptr<ReadAheadPlanner::Reservation> ReadAheadPlanner::reserve(const URL& url, double fileSampleRate, int64 fileLengthInSamples, int hostBlockSize, const void* owner)
+{
+    jassert(fileSampleRate > 0);
+    
+    const ScopedLock sl(lock);
+    auto& stats = storage[getStorageKey(url)];
+    if( stats == nullptr )
+        stats = std::make_shared<StorageStats>();
+    
+    auto seconds = defaultSeconds;
+    
+    if( auto realtimeFactor = stats->getRealtimeFactor(); realtimeFactor > 0 )
+        seconds *= targetRealtimeFactor / realtimeFactor;
+    
+    seconds *= (double) (1 << jmin(maxUnderrunDoublings, stats->takeRecentUnderruns()));
+    seconds = jlimit(minSeconds, maxSeconds, seconds);
+    
+    //anything past the end of the file would never be filled
+    auto minSamples = (int64) minBlocksAhead * jmax(1, hostBlockSize);
+    auto numSamples = memoryGovernor->isUnderPressure() ? minSamples : jmax(minSamples, (int64) (seconds * fileSampleRate));
+    if( fileLengthInSamples > 0 )
+        numSamples = jmin(numSamples, jmax(minSamples, fileLengthInSamples));
+    
+    auto bytesPerSample = (int64) (numBufferedChannels * sizeof(float));
+    auto bytesLeft = (int64) maxBytes - (int64) bytesInUse;
+    numSamples = jmax(minSamples, jmin(numSamples, bytesLeft / bytesPerSample));
+    
+    std::unique_ptr<Reservation> reservation (new Reservation(stats, (int) jmin(numSamples, (int64) std::numeric_limits<int>::max()), fileSampleRate, owner));
+    bytesInUse += reservation->getNumBytes();
+    reservations.insert(reservation.get());
+    return reservation;
+}
+
+void ReadAheadPlanner::release(const Reservation& reservation)
+{
+    auto numBytes = reservation.getNumBytes();
+    
+    const ScopedLock sl(lock);
+    jassert(numBytes <= bytesInUse);
+    bytesInUse -= jmin(numBytes, bytesInUse);
+    reservations.erase(&reservation);
+}
+
+void ReadAheadPlanner::addUsage(MemoryGovernor::Report& report) const
+{
+    const ScopedLock sl(lock);
+    for( auto* reservation : reservations )
+        report.add(reservation->getUse(), reservation->getNumBytes(), reservation->owner);
+}
+
+void ReadAheadPlanner::setMaxBytes(size_t newMaxBytes)
+{
+    const ScopedLock sl(lock);
+    maxBytes = newMaxBytes;
+}
+
+size_t ReadAheadPlanner::getMaxBytes() const
+{
+    const ScopedLock sl(lock);
+    return maxBytes;
+}
+
+size_t ReadAheadPlanner::getBytesInUse() const
+{
+    const ScopedLock sl(lock);
+    return bytesInUse;
+}
+
+ReadAheadPlanner::Status ReadAheadPlanner::getStatus(const Reservation* reservation) const
+{
+    Status status;
+    if( reservation != nullptr )
+    {
+        status.numSamples = reservation->getNumSamples();
+        status.seconds = reservation->getSeconds();
+        status.numBytes = reservation->getNumBytes();
+        status.storageRealtimeFactor = reservation->stats->getRealtimeFactor();
+        status.storageUnderruns = reservation->stats->getNumUnderruns();
+    }
+    
+    const ScopedLock sl(lock);
+    status.processBytesInUse = bytesInUse;
+    status.processMaxBytes = maxBytes;
+    return status;
+}
+
+String ReadAheadPlanner::getStorageKey(const URL& url)
+{
+    if( ! url.isLocalFile() )
+        return url.getScheme() + "://" + url.getDomain();
+    
+    //the first two levels of a path are as close as it gets to a mount point, e.g. /Volumes/Samples
+    auto path = url.getLocalFile().getFullPathName();
+    auto components = StringArray::fromTokens(path, File::getSeparatorString(), {});
+    components.removeEmptyStrings();
+    components.removeRange(2, components.size());
+    
+    return (path.startsWith(File::getSeparatorString()) ? File::getSeparatorString() : String())
+           + components.joinIntoString(File::getSeparatorString());
+}
@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+    ReadAheadPlanner.h
+    Sizes each streamed source's read-ahead from how fast its storage has been
+    read and how often it has underrun, within one budget for the process.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MemoryGovernor.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ What has been measured reading from one place: a mounted volume or share, or a remote host.
+ Written by the playback threads and the audio thread without locking.
+ */
+struct StorageStats
+{
+    void recordRead(int64 numSamples, double sampleRate, int64 ticksSpent) noexcept;
+    void recordUnderrun() noexcept;
+    
+    //how many times faster than real time it has been read, or 0 before enough has been read to tell
+    double getRealtimeFactor() const noexcept;
+    uint64 getNumUnderruns() const noexcept { return numUnderruns.load(std::memory_order_relaxed); }
+    
+    //halves the underruns that haven't been acted on yet, and returns how many there were
+    int takeRecentUnderruns() noexcept;
+    
+    static constexpr uint64 minMicrosecondsOfAudioToMeasure = 500000;
+private:
+    std::atomic<uint64> microsecondsOfAudioRead { 0 }, microsecondsSpentReading { 0 };
+    std::atomic<uint64> numUnderruns { 0 };
+    std::atomic<int> recentUnderruns { 0 };
+};
+
+//==============================================================================
+/*
+ Goes between a reader source and the StreamingDecoderSource or BufferingAudioSource reading ahead
+ from it, and times every read the decoder or playback thread makes.  Otherwise a straight
+ pass-through.
+ */
+struct ThroughputMeteringSource : PositionableAudioSource
+{
+    ThroughputMeteringSource(PositionableAudioSource& sourceToMeter, double sourceSampleRate, std::shared_ptr<StorageStats> statsToUpdate);
+    
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override { source.prepareToPlay(samplesPerBlockExpected, sampleRate); }
+    void releaseResources() override { source.releaseResources(); }
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+    
+    void setNextReadPosition(int64 newPosition) override { source.setNextReadPosition(newPosition); }
+    int64 getNextReadPosition() const override { return source.getNextReadPosition(); }
+    int64 getTotalLength() const override { return source.getTotalLength(); }
+    bool isLooping() const override { return source.isLooping(); }
+    void setLooping(bool shouldLoop) override { source.setLooping(shouldLoop); }
+private:
+    PositionableAudioSource& source;
+    const double sampleRate;
+    const std::shared_ptr<StorageStats> stats;
+    
+    JUCE_DECLARE_NON_COPYABLE(ThroughputMeteringSource)
+};
+
+//==============================================================================
+/*
+ Use it through a juce::SharedResourcePointer<ReadAheadPlanner>, so every instance in the process
+ shares one budget and one set of measurements.
+ 
+ A read-ahead is sized in seconds at the file's own rate, so a 192 kHz file gets four times the
+ samples of a 48 kHz one.  It starts at defaultSeconds, and is scaled by:
+ - how fast the storage has been read.  anything slower than targetRealtimeFactor gets more, in
+   proportion, and anything much faster gets less, down to minSeconds
+ - underruns from the same storage since the last source was sized, each doubling it, up to 8 times
+ It is never more than the whole file, nor less than minBlocksAhead host blocks.
+ 
+ What is left of the budget limits it further, down to that minimum: a source always gets enough
+ to play, even if that takes the process over budget.  So does the process being over the
+ MemoryGovernor's cap, which every reservation counts towards.
+ */
+struct ReadAheadPlanner : private MemoryGovernor::Holder
+{
+    ReadAheadPlanner();
+    ~ReadAheadPlanner() override;
+    
+    /*
+     one source's share of the budget, given back when this is deleted.  keep it for as long as the
+     StreamingDecoderSource or BufferingAudioSource it was sized for.
+     */
+    struct Reservation
+    {
+        ~Reservation();
+        
+        int getNumSamples() const noexcept { return numSamples; }
+        double getSeconds() const noexcept { return numSamples / sampleRate; }
+        size_t getNumBytes() const noexcept { return numBytes; }
+        
+        //what the MemoryGovernor counts it as: readAhead while it is playing.  realtime safe
+        void setUse(MemoryUse newUse) noexcept { use.store(newUse, std::memory_order_relaxed); }
+        MemoryUse getUse() const noexcept { return use.load(std::memory_order_relaxed); }
+        
+        //for the ThroughputMeteringSource reading into it, and for reporting its underruns
+        const std::shared_ptr<StorageStats> stats;
+    private:
+        friend struct ReadAheadPlanner;
+        Reservation(std::shared_ptr<StorageStats> stats, int numSamples, double sampleRate, const void* owner);
+        
+        //sources are let go of on the release pool's thread, which can be after every instance has gone
+        SharedResourcePointer<ReadAheadPlanner> planner;
+        const int numSamples;
+        const double sampleRate;
+        const size_t numBytes;
+        const void* const owner;
+        std::atomic<MemoryUse> use { MemoryUse::readAhead };
+        
+        JUCE_DECLARE_NON_COPYABLE(Reservation)
+    };
+    
+    //hostBlockSize is in samples at the file's rate.  owner is the instance the MemoryGovernor reports it under
+    std::unique_ptr<Reservation> reserve(const URL& url, double fileSampleRate, int64 fileLengthInSamples, int hostBlockSize, const void* owner);
+    
+    void setMaxBytes(size_t newMaxBytes);
+    size_t getMaxBytes() const;
+    size_t getBytesInUse() const;
+    
+    //what a source's read-ahead is, and what has been measured for where it reads from
+    struct Status
+    {
+        int numSamples { 0 };
+        double seconds { 0 };
+        size_t numBytes { 0 };
+        double storageRealtimeFactor { 0 };
+        uint64 storageUnderruns { 0 };
+        size_t processBytesInUse { 0 }, processMaxBytes { 0 };
+    };
+    //reservation can be nullptr, for a source that doesn't read ahead
+    Status getStatus(const Reservation* reservation) const;
+    
+    //a mounted volume or share for a local file, the host for a remote one
+    static String getStorageKey(const URL& url);
+    
+    static constexpr size_t defaultMaxBytes = 256 * 1024 * 1024;
+    static constexpr double defaultSeconds = 0.75;
+    static constexpr double minSeconds = 0.25;
+    static constexpr double maxSeconds = 10.0;
+    static constexpr double targetRealtimeFactor = 8.0;
+    static constexpr int minBlocksAhead = 8;
+    static constexpr int maxUnderrunDoublings = 3;
+    //both read-aheads keep two channels, whatever the file has
+    static constexpr int numBufferedChannels = 2;
+private:
+    mutable CriticalSection lock;
+    std::map<String, std::shared_ptr<StorageStats>> storage;
+    size_t maxBytes { defaultMaxBytes }, bytesInUse { 0 };
+    std::set<const Reservation*> reservations;
+    
+    SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    
+    void release(const Reservation& reservation);
+    void addUsage(MemoryGovernor::Report& report) const override;
+};
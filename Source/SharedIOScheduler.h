@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    SharedIOScheduler.h
+    The background threads shared by every plugin instance in the process.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PersistentThumbnailCache.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ Use it through a juce::SharedResourcePointer<SharedIOScheduler>: it is created by the first
+ plugin instance and destroyed with the last, so the number of threads stays the same no matter
+ how many instances the host loads.
+ 
+ Work is split into lanes by priority:
+ - decoding compressed files ahead of playback (StreamingDecoderSource), on a few threads of the
+   highest priority, so a burst of expensive frames doesn't wait behind anything else
+ - playback refills (BufferingAudioSource) of remote streams, and touching the pages of
+   memory-mapped files ahead of playback (TouchAheadSource), on a few high priority threads
+ - thumbnails, on the shared thumbnail cache's thread, which JUCE runs at low priority.  finished
+   thumbnails are also kept on disk, so they survive reloads (see PersistentThumbnailCache)
+ - waveform pyramids (see WaveformPyramid), on a low priority pool with a thread per spare core.
+   files are analysed a region per job step, so the pool is shared fairly between instances.
+   the library index's analysis and the library search's rebuilds share it, a batch at a time
+ - directory scans, on a single background priority thread.  the release pool and the memory
+   governor's checks share it
+ Each TimeSliceThread services its clients round-robin, so no instance can starve another.
+ 
+ Loading new files happens on a bounded ThreadPool.  Loader jobs do one step at a time and then
+ go to the back of the queue, so a session load with hundreds of instances is serviced fairly
+ instead of all at once.
+ */
+struct SharedIOScheduler
+{
+    SharedIOScheduler()
+    {
+        for( int i = 0; i < numPlaybackThreads; ++i )
+        {
+            auto* thread = playbackThreads.add(new TimeSliceThread("audio file playback " + String(i + 1)));
+            thread->startThread(Thread::Priority::high);
+        }
+        
+        for( int i = 0; i < numDecoderThreads; ++i )
+        {
+            auto* thread = decoderThreads.add(new TimeSliceThread("audio file decoder " + String(i + 1)));
+            thread->startThread(Thread::Priority::highest);
+        }
+        
+        directoryScanThread.startThread(Thread::Priority::background);
+    }
+    
+    ~SharedIOScheduler()
+    {
+        loaderPool.removeAllJobs(true, 2000);
+        analysisPool.removeAllJobs(true, 2000);
+    }
+    
+    //the playback lane with the fewest sources attached
+    TimeSliceThread& getPlaybackThread() { return getLeastBusy(playbackThreads); }
+    //the decoder lane with the fewest sources attached
+    TimeSliceThread& getDecoderThread() { return getLeastBusy(decoderThreads); }
+    
+    TimeSliceThread& getDirectoryScanThread() { return directoryScanThread; }
+    PersistentThumbnailCache& getThumbnailCache() { return thumbnailCache; }
+    ThreadPool& getLoaderPool() { return loaderPool; }
+    ThreadPool& getAnalysisPool() { return analysisPool; }
+    
+    static constexpr int numPlaybackThreads = 2;
+    static constexpr int numDecoderThreads = 2;
+    static constexpr int maxNumLoaderThreads = 4;
+    static constexpr int numThumbnailsToCache = 32;
+private:
+    CriticalSection lock;
+    OwnedArray<TimeSliceThread> playbackThreads;
+    OwnedArray<TimeSliceThread> decoderThreads;
+    TimeSliceThread directoryScanThread { "audio file browser" };
+    PersistentThumbnailCache thumbnailCache { numThumbnailsToCache };
+    ThreadPool loaderPool { jlimit(1, maxNumLoaderThreads, SystemStats::getNumCpus() / 2) };
+    //one core is left for the audio and message threads
+    ThreadPool analysisPool { jmax(1, SystemStats::getNumCpus() - 1), 0, Thread::Priority::low };
+    
+    TimeSliceThread& getLeastBusy(OwnedArray<TimeSliceThread>& threads)
+    {
+        const ScopedLock sl(lock);
+        auto* leastBusy = threads.getFirst();
+        for( auto* thread : threads )
+        {
+            if( thread->getNumClients() < leastBusy->getNumClients() )
+                leastBusy = thread;
+        }
+        
+        return *leastBusy;
+    }
+    
+    JUCE_DECLARE_NON_COPYABLE(SharedIOScheduler)
+};
@@ -0,0 +1,389 @@
+/*
+  ==============================================================================
+
+    StreamingDecoderSource.cpp
+
+  ==============================================================================
+*/
+
+#include "StreamingDecoderSource.h"
+
+StreamingDecoderSource::StreamingDecoderSource(PositionableAudioSource* sourceToDecode,
+                                               TimeSliceThread& decoderThread,
+                                               int ringSizeInSamples,
+                                               double rate,
+                                               int numChannels) :
+source(sourceToDecode),
+thread(decoderThread),
+sourceSampleRate(rate),
+ringSize(jmax(4, ringSizeInSamples)),
+chunkSize(jmin(maxChunkSize, ringSize / 4)),
+latencyTarget(jmin(ringSize / 2, (int) (defaultLatencyTargetSeconds * rate))),
+ring(jmax(1, numChannels), ringSize)
+{
+    jassert(source != nullptr);
+    ring.clear();
+}
+
+StreamingDecoderSource::~StreamingDecoderSource()
+{
+    thread.removeTimeSliceClient(this);
+    stopFeeding();
+    stopFillingCache();
+}
+
+void StreamingDecoderSource::setWaveformToFeed(WaveformPyramid::Ptr waveformToFeed, PersistentThumbnailCache& cache)
+{
+    jassert(! isPrepared);
+    if( waveformToFeed == nullptr || waveformToFeed->getNumChannels() > ring.getNumChannels() )
+        return;
+    
+    waveform = waveformToFeed;
+    thumbnailCache = &cache;
+    //a chunk, plus what is left over from the last one that didn't make up a whole point
+    feedBuffer.setSize(waveform->getNumChannels(), chunkSize + WaveformPyramid::samplesPerPointAtFinestLevel);
+}
+
+void StreamingDecoderSource::setCacheFillToFeed(DecodedAudioFill::Ptr fillToFeed)
+{
+    if( fillToFeed != nullptr && fillToFeed->getNumChannels() > ring.getNumChannels() )
+        return;
+    
+    const ScopedLock sl(newCacheFillLock);
+    newCacheFill = fillToFeed;
+    hasNewCacheFill.store(true);
+}
+
+bool StreamingDecoderSource::isReadyFor(int numSamples) const noexcept
+{
+    if( pendingSeek.load() >= 0 || ringGeneration.load(std::memory_order_acquire) != requestGeneration.load(std::memory_order_relaxed) )
+        return false;
+    
+    return writeCount.load(std::memory_order_acquire) - readCount.load(std::memory_order_relaxed) >= numSamples;
+}
+
+void StreamingDecoderSource::prepareToPlay(int, double)
+{
+    //the ring is at the source's rate, so the host's settings don't change anything once it is running
+    if( ! isPrepared )
+    {
+        source->prepareToPlay(chunkSize, sourceSampleRate);
+        thread.addTimeSliceClient(this);
+        isPrepared = true;
+    }
+    
+    //the audio thread isn't running yet, so this can act for it
+    applyPendingSeek();
+    
+    auto startTime = Time::getMillisecondCounter();
+    while( ! prefillOnly.load() && ! isReadyFor(latencyTarget) && Time::getMillisecondCounter() - startTime < (uint32) maxPrefillWaitMs )
+    {
+        thread.moveToFrontOfQueue(this);
+        chunkDecoded.wait(20);
+    }
+}
+
+void StreamingDecoderSource::releaseResources()
+{
+    thread.removeTimeSliceClient(this);
+    source->releaseResources();
+    isPrepared = false;
+}
+
+void StreamingDecoderSource::setNextReadPosition(int64 newPosition)
+{
+    nextPlayPosition.store(newPosition);
+    pendingSeek.store(newPosition);
+}
+
+int64 StreamingDecoderSource::getNextReadPosition() const
+{
+    auto position = nextPlayPosition.load();
+    auto length = getTotalLength();
+    
+    return isLooping() && length > 0 ? position % length : position;
+}
+
+void StreamingDecoderSource::applyPendingSeek() noexcept
+{
+    auto seekTo = pendingSeek.exchange(-1);
+    if( seekTo < 0 )
+        return;
+    
+    auto generation = requestGeneration.load(std::memory_order_relaxed);
+    if( ringGeneration.load(std::memory_order_acquire) == generation )
+    {
+        //already decoded: skip ahead to it, and keep everything after it
+        auto readPosition = readCount.load(std::memory_order_relaxed);
+        auto offset = seekTo - (basePosition.load(std::memory_order_relaxed) + readPosition);
+        if( offset >= 0 && offset <= writeCount.load(std::memory_order_acquire) - readPosition )
+        {
+            readCount.store(readPosition + offset, std::memory_order_release);
+            return;
+        }
+    }
+    
+    //the position is written before the generation, so the decoder never sees one without the other
+    requestedPosition.store(seekTo, std::memory_order_relaxed);
+    requestGeneration.store(generation + 1, std::memory_order_release);
+}
+
+void StreamingDecoderSource::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    applyPendingSeek();
+    
+    auto& dest = *info.buffer;
+    int numCopied = 0;
+    
+    if( ringGeneration.load(std::memory_order_acquire) == requestGeneration.load(std::memory_order_relaxed) )
+    {
+        auto readPosition = readCount.load(std::memory_order_relaxed);
+        auto numAvailable = writeCount.load(std::memory_order_acquire) - readPosition;
+        numCopied = (int) jmin((int64) info.numSamples, numAvailable);
+        
+        //at most two runs: up to the end of the ring, then from its start
+        for( int done = 0; done < numCopied; )
+        {
+            auto slot = (int) ((readPosition + done) % ringSize);
+            auto numThisTime = jmin(numCopied - done, ringSize - slot);
+            for( int ch = 0; ch < dest.getNumChannels(); ++ch )
+                dest.copyFrom(ch, info.startSample + done, ring, jmin(ch, ring.getNumChannels() - 1), slot, numThisTime);
+            
+            done += numThisTime;
+        }
+        
+        readCount.store(readPosition + numCopied, std::memory_order_release);
+        nextPlayPosition.store(basePosition.load(std::memory_order_relaxed) + readPosition + numCopied);
+    }
+    
+    if( numCopied < info.numSamples )
+    {
+        for( int ch = 0; ch < dest.getNumChannels(); ++ch )
+            dest.clear(ch, info.startSample + numCopied, info.numSamples - numCopied);
+    }
+}
+
+int StreamingDecoderSource::useTimeSlice()
+{
+    auto generation = requestGeneration.load(std::memory_order_acquire);
+    if( generation != ringGeneration.load(std::memory_order_relaxed) )
+    {
+        //the audio thread doesn't read while it waits for this, so the read count is the decoder's to reset
+        auto position = requestedPosition.load(std::memory_order_relaxed);
+        auto written = writeCount.load(std::memory_order_relaxed);
+        source->setNextReadPosition(position);
+        readCount.store(written, std::memory_order_relaxed);
+        basePosition.store(position - written, std::memory_order_relaxed);
+        ringGeneration.store(generation, std::memory_order_release);
+    }
+    
+    auto written = writeCount.load(std::memory_order_relaxed);
+    auto numDecoded = (int) (written - readCount.load(std::memory_order_acquire));
+    auto isPrefillOnly = prefillOnly.load();
+    auto numToDecode = jmin(chunkSize, (isPrefillOnly ? latencyTarget : ringSize) - numDecoded);
+    if( numToDecode > 0 )
+    {
+        decodeInto(written, numToDecode);
+        writeCount.store(written + numToDecode, std::memory_order_release);
+        numDecoded += numToDecode;
+        chunkDecoded.signal();
+        //after the audio thread can have it, so drawing and caching never hold up playing
+        feedWaveform(written, numToDecode);
+        fillCache(written, numToDecode);
+    }
+    else if( (feedRegion >= 0 || fillRegion >= 0) && Time::getMillisecondCounter() - lastFeedTime > (uint32) maxFeedStallMs )
+    {
+        //stopped part way through a region.  a builder, or the background decode, can do the rest of it sooner
+        stopFeeding();
+        stopFillingCache();
+    }
+    
+    //below the target: straight back, ahead of every source on the thread that isn't
+    if( numDecoded < latencyTarget )
+        return 0;
+    
+    if( isPrefillOnly )
+        return prefillOnlyIntervalMs;
+    
+    auto numFree = ringSize - numDecoded;
+    if( numFree >= chunkSize )
+        return 1;
+    
+    //until the audio thread has freed a chunk, or played down to the target, whichever comes first
+    auto samplesToWait = jmin(chunkSize - numFree, numDecoded - latencyTarget);
+    return jmax(1, (int) (samplesToWait * 1000.0 / sourceSampleRate));
+}
+
+void StreamingDecoderSource::decodeInto(int64 count, int numSamples)
+{
+    for( int done = 0; done < numSamples; )
+    {
+        auto slot = (int) ((count + done) % ringSize);
+        auto numThisTime = jmin(numSamples - done, ringSize - slot);
+        source->getNextAudioBlock(AudioSourceChannelInfo(&ring, slot, numThisTime));
+        done += numThisTime;
+    }
+}
+
+void StreamingDecoderSource::feedWaveform(int64 count, int numSamples)
+{
+    if( waveform == nullptr )
+        return;
+    
+    constexpr auto regionSize = WaveformPyramid::regionSizeInSamples;
+    constexpr auto samplesPerPoint = WaveformPyramid::samplesPerPointAtFinestLevel;
+    
+    //a region is only fed from start to end, so a seek gives up the one it was in the middle of
+    auto position = basePosition.load(std::memory_order_relaxed) + count;
+    if( feedPosition >= 0 && position != feedPosition + numWaitingToFeed )
+        stopFeeding();
+    
+    if( feedPosition < 0 )
+    {
+        auto region = (int) ((position + regionSize - 1) / regionSize);
+        auto regionStart = (int64) region * regionSize;
+        if( regionStart >= position + numSamples || ! waveform->tryClaimRegion(region) )
+            return;
+        
+        feedRegion = region;
+        feedPosition = regionStart;
+    }
+    
+    lastFeedTime = Time::getMillisecondCounter();
+    
+    //at most two runs: up to the end of the ring, then from its start
+    auto numToSkip = (int) (feedPosition + numWaitingToFeed - position);
+    for( int done = numToSkip; done < numSamples; )
+    {
+        auto slot = (int) ((count + done) % ringSize);
+        auto numThisTime = jmin(numSamples - done, ringSize - slot);
+        for( int ch = 0; ch < feedBuffer.getNumChannels(); ++ch )
+            feedBuffer.copyFrom(ch, numWaitingToFeed, ring, ch, slot, numThisTime);
+        
+        numWaitingToFeed += numThisTime;
+        done += numThisTime;
+    }
+    
+    //whole points only, except for the last one in the file
+    int numFed = 0;
+    while( numFed < numWaitingToFeed )
+    {
+        auto regionEnd = waveform->getRegionRange(feedRegion).getEnd();
+        auto numToFeed = (int) jmin((int64) (numWaitingToFeed - numFed), regionEnd - feedPosition);
+        if( feedPosition + numToFeed < regionEnd )
+            numToFeed -= numToFeed % samplesPerPoint;
+        
+        if( numToFeed <= 0 )
+            break;
+        
+        waveform->addSamples(feedBuffer, numFed, feedPosition, numToFeed);
+        feedPosition += numToFeed;
+        numFed += numToFeed;
+        
+        if( feedPosition == regionEnd )
+        {
+            waveform->storeIfComplete(*thumbnailCache);
+            
+            //carries straight on into the next region, unless someone else already has it
+            if( ! waveform->tryClaimRegion(++feedRegion) )
+            {
+                feedRegion = -1;
+                feedPosition = -1;
+                numWaitingToFeed = 0;
+                return;
+            }
+        }
+    }
+    
+    //less than a point is left, so it never overlaps where it is moved to
+    if( numFed > 0 )
+    {
+        for( int ch = 0; ch < feedBuffer.getNumChannels(); ++ch )
+            FloatVectorOperations::copy(feedBuffer.getWritePointer(ch), feedBuffer.getReadPointer(ch, numFed), numWaitingToFeed - numFed);
+        
+        numWaitingToFeed -= numFed;
+    }
+}
+
+void StreamingDecoderSource::stopFeeding()
+{
+    //a region that was finished isn't affected
+    if( feedRegion >= 0 )
+        waveform->abandonRegion(feedRegion);
+    
+    feedRegion = -1;
+    feedPosition = -1;
+    numWaitingToFeed = 0;
+}
+
+void StreamingDecoderSource::fillCache(int64 count, int numSamples)
+{
+    if( hasNewCacheFill.exchange(false) )
+    {
+        stopFillingCache();
+        const ScopedLock sl(newCacheFillLock);
+        cacheFill = std::move(newCacheFill);
+    }
+    
+    if( cacheFill == nullptr )
+        return;
+    
+    //whoever completed or abandoned it, there is nothing left to add
+    if( cacheFill->isComplete() || cacheFill->isAbandoned() )
+    {
+        stopFillingCache();
+        cacheFill = nullptr;
+        return;
+    }
+    
+    constexpr auto regionSize = DecodedAudioFill::regionSizeInSamples;
+    
+    //a region is only filled from start to end, so a seek gives up the one it was in the middle of
+    auto position = basePosition.load(std::memory_order_relaxed) + count;
+    if( fillPosition >= 0 && position != fillPosition )
+        stopFillingCache();
+    
+    lastFeedTime = Time::getMillisecondCounter();
+    
+    for( int done = 0; done < numSamples; )
+    {
+        if( fillRegion < 0 )
+        {
+            //the first region that starts in what is left of the chunk, unless someone else already has it
+            auto region = cacheFill->getRegionContaining(position + done + regionSize - 1);
+            auto regionStart = (int64) region * regionSize;
+            if( regionStart >= position + numSamples || ! cacheFill->tryClaimRegion(region) )
+                return;
+            
+            fillRegion = region;
+            fillPosition = regionStart;
+            done = (int) (regionStart - position);
+        }
+        
+        //at most up to the end of the ring, and of the region
+        auto slot = (int) ((count + done) % ringSize);
+        auto regionEnd = cacheFill->getRegionRange(fillRegion).getEnd();
+        auto numThisTime = (int) jmin((int64) (numSamples - done), (int64) (ringSize - slot), regionEnd - fillPosition);
+        
+        cacheFill->addSamples(ring, slot, fillPosition, numThisTime);
+        fillPosition += numThisTime;
+        done += numThisTime;
+        
+        //carries straight on into the next region, unless someone else already has it
+        if( fillPosition == regionEnd )
+        {
+            fillRegion = -1;
+            fillPosition = -1;
+        }
+    }
+}
+
+void StreamingDecoderSource::stopFillingCache()
+{
+    //a region that was finished isn't affected
+    if( fillRegion >= 0 )
+        cacheFill->abandonRegion(fillRegion);
+    
+    fillRegion = -1;
+    fillPosition = -1;
+}
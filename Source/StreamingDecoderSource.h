@@ -0,0 +1,140 @@
+/*
+  ==============================================================================
+
+    StreamingDecoderSource.h
+    Decodes a compressed file ahead of the audio thread, on a thread of its
+    own, into a lock-free ring the audio thread only has to copy from.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "WaveformPyramid.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ Stands in for a BufferingAudioSource in front of a decoding reader.  Decoding is done on one of
+ the shared decoder threads (see SharedIOScheduler), up to maxChunkSize samples per time slice, so
+ one expensive stretch of the file doesn't hold up every other source on the thread.
+ 
+ The ring holds ringSizeInSamples of decoded audio at the source's rate.  The decoder keeps at
+ least latencyTarget of it decoded ahead of the audio thread, and is called back as soon as
+ possible while it is below that, ahead of any source that isn't.  Above it, the decoder tops the
+ ring up as the audio thread frees a chunk of it, and sleeps in between.
+ 
+ The ring is single producer (the decoder thread), single consumer (the audio thread): neither
+ ever locks, and getNextAudioBlock never allocates.  A seek is only requested by the consumer, and
+ the ring only ever flushed by the producer, while the consumer waits for it: until the ring has
+ caught up with a seek, or when the decoder falls behind, the missing part of a block is silence
+ and the position doesn't move.  A seek that lands inside what has already been decoded just
+ skips ahead in the ring.
+ 
+ It can also feed a waveform, with every region it decodes from start to end that nobody else has
+ claimed, so playing a file draws it without decoding it a second time.  It can fill a long file's
+ cache entry the same way.
+ 
+ A source that is only warmed up in case it is played can be made prefill only: then it decodes
+ latencyTarget ahead and no further, and prepareToPlay doesn't wait for even that.
+ */
+struct StreamingDecoderSource : PositionableAudioSource,
+                                private TimeSliceClient
+{
+    //the source isn't owned, and must outlive this
+    StreamingDecoderSource(PositionableAudioSource* sourceToDecode,
+                           TimeSliceThread& decoderThread,
+                           int ringSizeInSamples,
+                           double sourceSampleRate,
+                           int numChannels = 2);
+    ~StreamingDecoderSource() override;
+    
+    //audio thread.  whether the next numSamples have already been decoded
+    bool isReadyFor(int numSamples) const noexcept;
+    
+    //before prepareToPlay.  the waveform must be the source's, with no more channels than the ring
+    void setWaveformToFeed(WaveformPyramid::Ptr waveformToFeed, PersistentThumbnailCache& cache);
+    //any thread, and picked up with the next chunk.  the fill must be the source's, with no more channels than the ring
+    void setCacheFillToFeed(DecodedAudioFill::Ptr fillToFeed);
+    int getLatencyTargetInSamples() const noexcept { return latencyTarget; }
+    //any thread.  once it is turned off, the next prepareToPlay waits for the prefill again
+    void setPrefillOnly(bool shouldOnlyPrefill) noexcept { prefillOnly.store(shouldOnlyPrefill); }
+    
+    //blocks until latencyTarget has been decoded, or maxPrefillWaitMs has passed.  unless prefill only
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override;
+    void releaseResources() override;
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+    
+    void setNextReadPosition(int64 newPosition) override;
+    int64 getNextReadPosition() const override;
+    int64 getTotalLength() const override { return source->getTotalLength(); }
+    bool isLooping() const override { return source->isLooping(); }
+    void setLooping(bool shouldLoop) override { source->setLooping(shouldLoop); }
+    
+    static constexpr double defaultLatencyTargetSeconds = 0.2;
+    static constexpr int maxChunkSize = 4096;
+    static constexpr int maxPrefillWaitMs = 2000;
+    //how soon a prefill only source notices it is being played
+    static constexpr int prefillOnlyIntervalMs = 20;
+    //how long a region it is feeding or filling stays claimed while nothing is played
+    static constexpr int maxFeedStallMs = 500;
+private:
+    PositionableAudioSource* const source;
+    TimeSliceThread& thread;
+    const double sourceSampleRate;
+    const int ringSize;
+    //a quarter of the ring at most, so the ring is topped up a few times over before it runs dry
+    const int chunkSize;
+    //never more than half the ring, so there is always room to decode while the audio thread plays the rest
+    const int latencyTarget;
+    AudioBuffer<float> ring;
+    bool isPrepared { false };
+    std::atomic<bool> prefillOnly { false };
+    
+    //samples written and read since the ring was last flushed.  a sample's slot is its count modulo ringSize
+    std::atomic<int64> writeCount { 0 }, readCount { 0 };
+    //the file position of count 0.  only written by the decoder while it flushes the ring
+    std::atomic<int64> basePosition { 0 };
+    
+    //a seek the audio thread is waiting for is requestGeneration != ringGeneration
+    std::atomic<int64> requestedPosition { 0 };
+    std::atomic<uint32> requestGeneration { 0 }, ringGeneration { 0 };
+    
+    //set from any thread, and picked up by the audio thread at its next block
+    std::atomic<int64> pendingSeek { -1 };
+    std::atomic<int64> nextPlayPosition { 0 };
+    
+    WaitableEvent chunkDecoded;
+    
+    //decoder thread only.  feedBuffer holds decoded samples from feedPosition on that haven't been fed yet
+    WaveformPyramid::Ptr waveform;
+    PersistentThumbnailCache* thumbnailCache { nullptr };
+    AudioBuffer<float> feedBuffer;
+    int numWaitingToFeed { 0 };
+    //-1 until the decoder reaches the start of a region it can claim
+    int64 feedPosition { -1 };
+    int feedRegion { -1 };
+    uint32 lastFeedTime { 0 };
+    
+    //handed over under newCacheFillLock, since it can be set while the decoder is running
+    CriticalSection newCacheFillLock;
+    DecodedAudioFill::Ptr newCacheFill;
+    std::atomic<bool> hasNewCacheFill { false };
+    //decoder thread only.  fillPosition is where the next sample of fillRegion goes
+    DecodedAudioFill::Ptr cacheFill;
+    int64 fillPosition { -1 };
+    int fillRegion { -1 };
+    
+    //consumer side
+    void applyPendingSeek() noexcept;
+    //producer side
+    int useTimeSlice() override;
+    void decodeInto(int64 count, int numSamples);
+    void feedWaveform(int64 count, int numSamples);
+    void stopFeeding();
+    void fillCache(int64 count, int numSamples);
+    void stopFillingCache();
+    
+    JUCE_DECLARE_NON_COPYABLE(StreamingDecoderSource)
+};
@@ -0,0 +1,112 @@
+/*
+  ==============================================================================
+
+    TouchAheadSource.cpp
+
+  ==============================================================================
+*/
+
+#include "TouchAheadSource.h"
+
+TouchAheadSource::TouchAheadSource(PositionableAudioSource* sourceToPlay,
+                                   MemoryMappedAudioFormatReader& mappedReader,
+                                   TimeSliceThread& touchingThread) :
+source(sourceToPlay),
+reader(mappedReader),
+thread(touchingThread),
+samplesPerPage(jmax(1, pageSizeInBytes / jmax(1, (int) (mappedReader.numChannels * mappedReader.bitsPerSample) / 8))),
+touchAheadSamples((int64) (touchAheadSeconds * mappedReader.sampleRate)),
+prefillOnlySamples((int64) (prefillOnlySeconds * mappedReader.sampleRate))
+{
+    jassert(source != nullptr);
+}
+
+TouchAheadSource::~TouchAheadSource()
+{
+    thread.removeTimeSliceClient(this);
+}
+
+bool TouchAheadSource::isReadyFor(int numSamples) const noexcept
+{
+    auto position = playPosition.load();
+    auto end = jmin(position + numSamples, reader.lengthInSamples);
+    
+    //the start is read first: a seek empties the range before moving it, so this can't see the old end with the new start
+    return position >= touchedStart.load(std::memory_order_acquire) && end <= touchedEnd.load(std::memory_order_acquire);
+}
+
+void TouchAheadSource::prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+{
+    source->prepareToPlay(samplesPerBlockExpected, sampleRate);
+    
+    if( ! isPrepared )
+    {
+        thread.addTimeSliceClient(this);
+        isPrepared = true;
+    }
+    
+    //only the thread touches, so this just waits for it
+    auto startTime = Time::getMillisecondCounter();
+    while( ! prefillOnly.load()
+           && ! isReadyFor((int) jmin(touchAheadSamples, (int64) std::numeric_limits<int>::max()))
+           && Time::getMillisecondCounter() - startTime < (uint32) maxPrefaultWaitMs )
+    {
+        thread.moveToFrontOfQueue(this);
+        pagesTouched.wait(20);
+    }
+}
+
+void TouchAheadSource::releaseResources()
+{
+    thread.removeTimeSliceClient(this);
+    source->releaseResources();
+    isPrepared = false;
+}
+
+void TouchAheadSource::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    source->getNextAudioBlock(info);
+    playPosition.store(source->getNextReadPosition());
+}
+
+void TouchAheadSource::setNextReadPosition(int64 newPosition)
+{
+    //called on the audio thread too, when the resampler seeks, so the thread only finds out at its next slice
+    source->setNextReadPosition(newPosition);
+    playPosition.store(newPosition);
+}
+
+int TouchAheadSource::useTimeSlice()
+{
+    auto hasMoreToTouch = touchAhead(maxPagesPerSlice);
+    pagesTouched.signal();
+    return hasMoreToTouch ? 1 : idleIntervalMs;
+}
+
+bool TouchAheadSource::touchAhead(int maxNumPages) noexcept
+{
+    auto length = reader.lengthInSamples;
+    auto position = jlimit((int64) 0, length, playPosition.load());
+    auto start = touchedStart.load(std::memory_order_relaxed);
+    auto end = touchedEnd.load(std::memory_order_relaxed);
+    
+    if( position < start || position > end )
+    {
+        //a seek.  whatever was touched before it may be paged out by the time it is played again
+        touchedEnd.store(position, std::memory_order_release);
+        touchedStart.store(position, std::memory_order_release);
+        start = end = position;
+    }
+    
+    auto target = jmin(length, position + (prefillOnly.load() ? prefillOnlySamples : touchAheadSamples));
+    for( int i = 0; i < maxNumPages && end < target; ++i )
+    {
+        //at most a page past the last sample touched, so every page in between has been touched too
+        auto sample = end > start ? jmin(end - 1 + samplesPerPage, target - 1) : end;
+        reader.touchSample(sample);
+        end = sample + 1;
+        touchedEnd.store(end, std::memory_order_release);
+    }
+    
+    return end < target;
+}
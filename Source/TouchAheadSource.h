@@ -0,0 +1,86 @@
+/*
+  ==============================================================================
+
+    TouchAheadSource.h
+    Keeps the pages of a memory-mapped file that are about to be played
+    resident, so the audio thread doesn't page-fault on them.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+//==============================================================================
+/*
+ Stands in front of the source playing a memory-mapped reader.  Nothing is copied: the page cache
+ is the read-ahead.  On one of the shared playback threads (see SharedIOScheduler), every page
+ from the play position to touchAheadSeconds past it is touched, up to maxPagesPerSlice per time
+ slice, so anything that has been paged out is faulted back in there instead of in processBlock.
+ A seek anywhere outside what has already been touched starts again from where it landed.
+ 
+ The audio thread only does atomic loads and stores here, and isReadyFor() tells it whether the
+ pages it is about to read have been touched.
+ */
+struct TouchAheadSource : PositionableAudioSource,
+                          private TimeSliceClient
+{
+    //neither is owned, and both must outlive this.  sourceToPlay must be reading mappedReader
+    TouchAheadSource(PositionableAudioSource* sourceToPlay,
+                     MemoryMappedAudioFormatReader& mappedReader,
+                     TimeSliceThread& touchingThread);
+    ~TouchAheadSource() override;
+    
+    //audio thread.  whether the pages of the next numSamples have been touched
+    bool isReadyFor(int numSamples) const noexcept;
+    
+    /*
+     any thread.  while set, only prefillOnlySeconds are touched ahead, and prepareToPlay doesn't wait
+     for them: for a source that is only warmed up in case it is played.  once it is turned off, the
+     next prepareToPlay waits again
+     */
+    void setPrefillOnly(bool shouldOnlyPrefill) noexcept { prefillOnly.store(shouldOnlyPrefill); }
+    
+    //touches the first touchAheadSeconds from the play position before returning.  unless prefill only
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override;
+    void releaseResources() override;
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+    
+    void setNextReadPosition(int64 newPosition) override;
+    int64 getNextReadPosition() const override { return source->getNextReadPosition(); }
+    int64 getTotalLength() const override { return source->getTotalLength(); }
+    bool isLooping() const override { return source->isLooping(); }
+    void setLooping(bool shouldLoop) override { source->setLooping(shouldLoop); }
+    
+    static constexpr double touchAheadSeconds = 4.0;
+    static constexpr double prefillOnlySeconds = 0.25;
+    static constexpr int pageSizeInBytes = 4096;
+    //a few MB at most, so one source catching up after a seek doesn't hold up the others on the thread
+    static constexpr int maxPagesPerSlice = 512;
+    //how soon a seek is noticed once everything ahead has been touched
+    static constexpr int idleIntervalMs = 20;
+    static constexpr int maxPrefaultWaitMs = 2000;
+private:
+    PositionableAudioSource* const source;
+    MemoryMappedAudioFormatReader& reader;
+    TimeSliceThread& thread;
+    //no more than a page's worth of samples
+    const int64 samplesPerPage;
+    const int64 touchAheadSamples, prefillOnlySamples;
+    bool isPrepared { false };
+    std::atomic<bool> prefillOnly { false };
+    
+    //where the audio thread reads next, in the file's samples
+    std::atomic<int64> playPosition { 0 };
+    //the pages of [touchedStart, touchedEnd) have been touched since the last seek.  only written by touchAhead
+    std::atomic<int64> touchedStart { 0 }, touchedEnd { 0 };
+    WaitableEvent pagesTouched;
+    
+    int useTimeSlice() override;
+    //returns true if there is still more to touch
+    bool touchAhead(int maxNumPages) noexcept;
+    
+    JUCE_DECLARE_NON_COPYABLE(TouchAheadSource)
+};
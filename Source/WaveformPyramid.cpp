@@ -0,0 +1,477 @@
+/*
+  ==============================================================================
+
+    WaveformPyramid.cpp
+
+  ==============================================================================
+*/
+
+#include "WaveformPyramid.h"
+
+WaveformPyramid::WaveformPyramid(int channels, int64 length, double rate) :
+numChannels(channels),
+lengthInSamples(length),
+sampleRate(rate),
+numRegions((int) ((length + regionSizeInSamples - 1) / regionSizeInSamples))
+{
+    auto numPoints = (length + samplesPerPointAtFinestLevel - 1) / samplesPerPointAtFinestLevel;
+    for( ;; )
+    {
+        levels.emplace_back((size_t) numChannels, std::vector<Point>((size_t) numPoints));
+        if( numPoints <= maxPointsAtCoarsestLevel )
+            break;
+        
+        numPoints = (numPoints + levelRatio - 1) / levelRatio;
+    }
+    
+    regionIsClaimed.reset(new std::atomic<bool>[(size_t) numRegions]);
+    regionSamplesAdded.reset(new std::atomic<int>[(size_t) numRegions]);
+    regionIsReady.reset(new std::atomic<bool>[(size_t) numRegions]);
+    for( int r = 0; r < numRegions; ++r )
+    {
+        regionIsClaimed[(size_t) r].store(false);
+        regionSamplesAdded[(size_t) r].store(0);
+        regionIsReady[(size_t) r].store(false);
+    }
+    
+    memoryGovernor->addCountedBytes(MemoryUse::waveforms, getSizeInBytes());
+}
+
+WaveformPyramid::~WaveformPyramid()
+{
+    memoryGovernor->removeCountedBytes(MemoryUse::waveforms, getSizeInBytes());
+}
+
+WaveformPyramid::Ptr WaveformPyramid::createFor(const File& file,
+                                                int numChannels,
+                                                int64 lengthInSamples,
+                                                double sampleRate,
+                                                PersistentThumbnailCache& cache)
+{
+    Ptr pyramid = new WaveformPyramid(numChannels, lengthInSamples, sampleRate);
+    pyramid->cacheKey = PersistentThumbnailCache::getHashFor(file);
+    pyramid->hasCacheKey = true;
+    
+    //a file that has been seen before draws at the persisted levels straight away
+    if( auto in = cache.openCachedData(pyramid->cacheKey, persistedFileExtension) )
+        pyramid->loadPersistedLevels(*in);
+    
+    return pyramid;
+}
+
+int64 WaveformPyramid::getSamplesPerPoint(int level) const noexcept
+{
+    int64 samplesPerPoint = samplesPerPointAtFinestLevel;
+    for( int i = 0; i < level; ++i )
+        samplesPerPoint *= levelRatio;
+    
+    return samplesPerPoint;
+}
+
+Range<int64> WaveformPyramid::getRegionRange(int region) const noexcept
+{
+    auto start = (int64) region * regionSizeInSamples;
+    return { start, jmin(start + regionSizeInSamples, lengthInSamples) };
+}
+
+bool WaveformPyramid::tryClaimRegion(int region) noexcept
+{
+    if( ! isPositiveAndBelow(region, numRegions) )
+        return false;
+    
+    return ! regionIsClaimed[(size_t) region].exchange(true);
+}
+
+bool WaveformPyramid::hasUnclaimedRegions() const noexcept
+{
+    for( int r = 0; r < numRegions; ++r )
+    {
+        if( ! regionIsClaimed[(size_t) r].load() )
+            return true;
+    }
+    
+    return false;
+}
+
+void WaveformPyramid::abandonRegion(int region) noexcept
+{
+    if( ! isPositiveAndBelow(region, numRegions) || regionIsReady[(size_t) region].load() )
+        return;
+    
+    //only the claimant writes to it, so nobody else can be adding to it while this resets it
+    regionSamplesAdded[(size_t) region].store(0);
+    regionIsClaimed[(size_t) region].store(false);
+}
+
+void WaveformPyramid::addSamples(const AudioBuffer<float>& source, int sourceStartSample, int64 startSample, int numSamples)
+{
+    jassert(source.getNumChannels() >= numChannels);
+    jassert(startSample % samplesPerPointAtFinestLevel == 0);
+    jassert(numSamples % samplesPerPointAtFinestLevel == 0 || startSample + numSamples >= lengthInSamples);
+    
+    auto endSample = jmin(startSample + numSamples, lengthInSamples);
+    auto pos = startSample;
+    
+    while( pos < endSample )
+    {
+        auto region = getRegionContaining(pos);
+        jassert(regionIsClaimed[(size_t) region].load());
+        auto pieceEnd = jmin(endSample, getRegionRange(region).getEnd());
+        
+        auto firstPoint = pos / samplesPerPointAtFinestLevel;
+        auto endPoint = (pieceEnd + samplesPerPointAtFinestLevel - 1) / samplesPerPointAtFinestLevel;
+        
+        for( int ch = 0; ch < numChannels; ++ch )
+        {
+            auto& points = levels[0][(size_t) ch];
+            auto* samples = source.getReadPointer(ch, sourceStartSample + (int) (pos - startSample));
+            for( auto p = firstPoint; p < endPoint; ++p )
+            {
+                auto offset = (int) ((p - firstPoint) * samplesPerPointAtFinestLevel);
+                points[(size_t) p] = summarise(samples + offset,
+                                               (int) jmin((int64) samplesPerPointAtFinestLevel, pieceEnd - pos - offset));
+            }
+        }
+        
+        //whoever adds the last of a region's samples finishes it, having seen everyone else's points
+        auto pieceLength = (int) (pieceEnd - pos);
+        auto numAdded = regionSamplesAdded[(size_t) region].fetch_add(pieceLength, std::memory_order_acq_rel) + pieceLength;
+        if( numAdded == (int) getRegionRange(region).getLength() )
+            finishRegion(region);
+        
+        pos = pieceEnd;
+    }
+}
+
+void WaveformPyramid::finishRegion(int region)
+{
+    const ScopedLock sl(finishLock);
+    
+    auto range = getRegionRange(region);
+    auto firstChild = range.getStart() / samplesPerPointAtFinestLevel;
+    auto endChild = (range.getEnd() + samplesPerPointAtFinestLevel - 1) / samplesPerPointAtFinestLevel;
+    
+    //above regionLevel a parent also covers other regions.  it is redone as each of them finishes,
+    //and readers ignore it until the last one has.
+    for( int level = 1; level < jmin(getNumLevels(), firstPreloadedLevel); ++level )
+    {
+        auto parentFirst = firstChild / levelRatio;
+        auto parentEnd = (endChild + levelRatio - 1) / levelRatio;
+        
+        for( int ch = 0; ch < numChannels; ++ch )
+        {
+            auto& children = levels[(size_t) level - 1][(size_t) ch];
+            auto& parents = levels[(size_t) level][(size_t) ch];
+            
+            for( auto p = parentFirst; p < parentEnd; ++p )
+            {
+                auto first = p * levelRatio;
+                auto numChildren = (int) jmin((int64) levelRatio, (int64) children.size() - first);
+                parents[(size_t) p] = combine(children.data() + first, numChildren);
+            }
+        }
+        
+        firstChild = parentFirst;
+        endChild = parentEnd;
+    }
+    
+    regionIsReady[(size_t) region].store(true, std::memory_order_release);
+    numRegionsReady.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool WaveformPyramid::isPointReady(int level, int64 point) const noexcept
+{
+    if( level >= firstPreloadedLevel )
+        return true;
+    
+    auto samplesPerPoint = getSamplesPerPoint(level);
+    auto firstRegion = (int) (point * samplesPerPoint / regionSizeInSamples);
+    auto lastRegion = (int) ((jmin((point + 1) * samplesPerPoint, lengthInSamples) - 1) / regionSizeInSamples);
+    
+    for( auto r = firstRegion; r <= lastRegion; ++r )
+    {
+        if( ! regionIsReady[(size_t) r].load(std::memory_order_acquire) )
+            return false;
+    }
+    
+    return true;
+}
+
+int WaveformPyramid::chooseLevelFor(double samplesPerPixel) const noexcept
+{
+    int level = -1;
+    while( level + 1 < getNumLevels() && (double) getSamplesPerPoint(level + 1) <= samplesPerPixel )
+        ++level;
+    
+    return level;
+}
+
+WaveformPyramid::Column WaveformPyramid::getColumn(int channel, int level, int64 startSample, int64 endSample) const noexcept
+{
+    if( ! isPositiveAndBelow(channel, numChannels) || getNumLevels() == 0 )
+        return {};
+    
+    auto summariseLevel = [&](int levelToUse)
+    {
+        Column column;
+        auto samplesPerPoint = getSamplesPerPoint(levelToUse);
+        auto& points = levels[(size_t) levelToUse][(size_t) channel];
+        
+        auto firstPoint = jmax((int64) 0, startSample / samplesPerPoint);
+        auto endPoint = jmin((int64) points.size(), (endSample + samplesPerPoint - 1) / samplesPerPoint);
+        
+        int min = 127, max = -128, numPoints = 0;
+        double sumOfSquares = 0;
+        
+        for( auto p = firstPoint; p < endPoint; ++p )
+        {
+            if( ! isPointReady(levelToUse, p) )
+                continue;
+            
+            auto& point = points[(size_t) p];
+            min = jmin(min, (int) point.min);
+            max = jmax(max, (int) point.max);
+            sumOfSquares += (double) point.rms * point.rms;
+            ++numPoints;
+        }
+        
+        if( numPoints > 0 )
+        {
+            column.min = (float) min / 127.0f;
+            column.max = (float) max / 127.0f;
+            column.rms = (float) std::sqrt(sumOfSquares / numPoints) / 255.0f;
+            column.isEmpty = false;
+        }
+        
+        return column;
+    };
+    
+    level = jlimit(0, getNumLevels() - 1, level);
+    auto column = summariseLevel(level);
+    
+    if( column.isEmpty && level < firstPreloadedLevel && hasPersistedLevels() )
+        column = summariseLevel(firstPreloadedLevel);
+    
+    return column;
+}
+
+size_t WaveformPyramid::getSizeInBytes() const noexcept
+{
+    size_t numPoints = 0;
+    for( auto& level : levels )
+        for( auto& channel : level )
+            numPoints += channel.size();
+    
+    return numPoints * sizeof(Point);
+}
+
+//==============================================================================
+namespace
+{
+constexpr int pyramidFileMagic = 0x79506657; //"WfPy"
+constexpr int pyramidFileVersion = 1;
+}
+
+bool WaveformPyramid::loadPersistedLevels(InputStream& in)
+{
+    jassert(getNumRegionsReady() == 0);
+    
+    if( getNumLevels() <= firstPersistedLevel )
+        return false;
+    
+    if( in.readInt() != pyramidFileMagic
+       || in.readInt() != pyramidFileVersion
+       || in.readInt() != numChannels
+       || in.readInt64() != lengthInSamples
+       || in.readDouble() != sampleRate
+       || in.readInt() != getNumLevels()
+       || in.readInt() != firstPersistedLevel )
+        return false;
+    
+    for( int level = firstPersistedLevel; level < getNumLevels(); ++level )
+    {
+        for( auto& points : levels[(size_t) level] )
+        {
+            auto numBytes = (int) (points.size() * sizeof(Point));
+            if( in.read(points.data(), numBytes) != numBytes )
+                return false;
+        }
+    }
+    
+    firstPreloadedLevel = firstPersistedLevel;
+    return true;
+}
+
+void WaveformPyramid::savePersistedLevels(OutputStream& out) const
+{
+    jassert(isComplete());
+    
+    out.writeInt(pyramidFileMagic);
+    out.writeInt(pyramidFileVersion);
+    out.writeInt(numChannels);
+    out.writeInt64(lengthInSamples);
+    out.writeDouble(sampleRate);
+    out.writeInt(getNumLevels());
+    out.writeInt(firstPersistedLevel);
+    
+    for( int level = firstPersistedLevel; level < getNumLevels(); ++level )
+        for( auto& points : levels[(size_t) level] )
+            out.write(points.data(), points.size() * sizeof(Point));
+}
+
+void WaveformPyramid::storeIfComplete(PersistentThumbnailCache& cache)
+{
+    //one that was loaded from the cache is already there
+    if( ! hasCacheKey || ! isComplete() || hasPersistedLevels() || getNumLevels() <= firstPersistedLevel )
+        return;
+    
+    if( ! hasBeenStored.exchange(true) )
+        cache.storeCachedData(cacheKey, persistedFileExtension, [this](OutputStream& out) { savePersistedLevels(out); });
+}
+
+//==============================================================================
+WaveformPyramid::Point WaveformPyramid::summarise(const float* samples, int numSamples) noexcept
+{
+    Point point;
+    if( numSamples <= 0 )
+        return point;
+    
+    auto range = FloatVectorOperations::findMinAndMax(samples, numSamples);
+    
+    double sumOfSquares = 0;
+    for( int i = 0; i < numSamples; ++i )
+        sumOfSquares += (double) samples[i] * samples[i];
+    
+    auto rms = std::sqrt(sumOfSquares / numSamples);
+    
+    //rounded outwards, so quiet peaks don't disappear
+    point.min = (int8) jlimit(-127, 127, (int) std::floor(range.getStart() * 127.0f));
+    point.max = (int8) jlimit(-127, 127, (int) std::ceil(range.getEnd() * 127.0f));
+    point.rms = (uint8) jlimit(0, 255, roundToInt(rms * 255.0));
+    return point;
+}
+
+WaveformPyramid::Point WaveformPyramid::combine(const Point* points, int numPoints) noexcept
+{
+    Point result;
+    if( numPoints <= 0 )
+        return result;
+    
+    int min = 127, max = -128;
+    double sumOfSquares = 0;
+    for( int i = 0; i < numPoints; ++i )
+    {
+        min = jmin(min, (int) points[i].min);
+        max = jmax(max, (int) points[i].max);
+        sumOfSquares += (double) points[i].rms * points[i].rms;
+    }
+    
+    result.min = (int8) min;
+    result.max = (int8) max;
+    result.rms = (uint8) jlimit(0, 255, roundToInt(std::sqrt(sumOfSquares / numPoints)));
+    return result;
+}
+//==============================================================================
+struct WaveformPyramidBuilder::RegionJob : ThreadPoolJob
+{
+    explicit RegionJob(WaveformPyramidBuilder& b) : ThreadPoolJob("WaveformPyramid"), builder(b) { }
+    
+    //one region per run, then to the back of the queue
+    JobStatus runJob() override
+    {
+        if( shouldExit() || ! builder.buildNextRegion(reader, buffer) )
+            return jobHasFinished;
+        
+        return jobNeedsRunningAgain;
+    }
+    
+    WaveformPyramidBuilder& builder;
+    //opened on the worker, the first time it runs
+    std::unique_ptr<AudioFormatReader> reader;
+    AudioBuffer<float> buffer;
+};
+
+struct WaveformPyramidBuilder::OwnJobsSelector : ThreadPool::JobSelector
+{
+    explicit OwnJobsSelector(WaveformPyramidBuilder& b) : builder(b) { }
+    bool isJobSuitable(ThreadPoolJob* job) override
+    {
+        auto* regionJob = dynamic_cast<RegionJob*>(job);
+        return regionJob != nullptr && &regionJob->builder == &builder;
+    }
+    WaveformPyramidBuilder& builder;
+};
+
+WaveformPyramidBuilder::WaveformPyramidBuilder(WaveformPyramid::Ptr pyramidToFill,
+                                               const File& sourceFile,
+                                               DecodedAudio::Ptr alreadyDecoded,
+                                               AudioFormatManager& afm,
+                                               ThreadPool& pool,
+                                               PersistentThumbnailCache& cache) :
+pyramid(pyramidToFill),
+file(sourceFile),
+decoded(alreadyDecoded),
+formatManager(afm),
+analysisPool(pool),
+thumbnailCache(cache)
+{
+    jassert(decoded == nullptr || decoded->samples.getNumSamples() == pyramid->getLengthInSamples());
+    
+    auto* format = formatManager.findFormatForFileExtension(file.getFileExtension());
+    auto canSeek = decoded != nullptr || (format != nullptr && canSeekCheaply(*format));
+    auto numWorkers = canSeek ? jmin(analysisPool.getNumThreads(), pyramid->getNumRegions()) : 1;
+    
+    for( int i = 0; i < numWorkers; ++i )
+        analysisPool.addJob(new RegionJob(*this), true);
+}
+
+WaveformPyramidBuilder::~WaveformPyramidBuilder()
+{
+    nextRegion.store(std::numeric_limits<int>::max());
+    
+    OwnJobsSelector ownJobs { *this };
+    auto allStopped = analysisPool.removeAllJobs(true, 10000, &ownJobs);
+    jassertquiet(allStopped);
+}
+
+//formats whose readers can jump to any sample without decoding everything before it
+bool WaveformPyramidBuilder::canSeekCheaply(const AudioFormat& format)
+{
+    auto name = format.getFormatName();
+    return ! format.isCompressed() || name.containsIgnoreCase("flac") || name.containsIgnoreCase("ogg");
+}
+
+bool WaveformPyramidBuilder::buildNextRegion(std::unique_ptr<AudioFormatReader>& reader, AudioBuffer<float>& buffer)
+{
+    if( decoded == nullptr && reader == nullptr )
+    {
+        reader.reset(formatManager.createReaderFor(file));
+        if( reader == nullptr )
+            return false;
+    }
+    
+    //regions someone else has claimed (a decode feeding the pyramid as it goes) are skipped
+    int region;
+    do
+    {
+        region = nextRegion.fetch_add(1);
+        if( region < 0 || region >= pyramid->getNumRegions() )
+            return false;
+    }
+    while( ! pyramid->tryClaimRegion(region) );
+    
+    auto range = pyramid->getRegionRange(region);
+    auto numSamples = (int) range.getLength();
+    
+    buffer.setSize(pyramid->getNumChannels(), numSamples, false, false, true);
+    
+    if( decoded != nullptr )
+        decoded->samples.read(buffer, 0, (int) range.getStart(), numSamples);
+    else
+        reader->read(&buffer, 0, numSamples, range.getStart(), true, true);
+    
+    pyramid->addSamples(buffer, 0, range.getStart(), numSamples);
+    
+    pyramid->storeIfComplete(thumbnailCache);
+    return true;
+}
@@ -0,0 +1,209 @@
+/*
+  ==============================================================================
+
+    WaveformPyramid.h
+    Min/max/RMS summaries of a file at a range of resolutions, for drawing its
+    waveform at any zoom without touching more than a few points per pixel.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PersistentThumbnailCache.h"
+#include "DecodedAudioCache.h"
+#include "MemoryGovernor.h"
+
+using namespace juce;
+//==============================================================================
+/*
+ Level 0 summarises every samplesPerPointAtFinestLevel samples of each channel, and every level
+ above it is levelRatio times coarser, up to the first level with no more than
+ maxPointsAtCoarsestLevel points.  Anything finer than level 0 is drawn from the file's samples.
+ 
+ Points are stored as 8 bit min, max and RMS, which is more resolution than a waveform a few
+ hundred pixels high can show, and keeps a multi-hour file's pyramid to tens of megabytes.
+ 
+ The file is split into regions of regionSizeInSamples, which can be filled in any order and from
+ any number of threads.  Each region is filled by whichever writer claims it first, so whatever
+ decodes the file to play it and a WaveformPyramidBuilder can work on the same pyramid without
+ either of them decoding a region the other has done.  Readers only look at points whose regions are complete,
+ so a partly built pyramid can be drawn while the rest of it is still being worked on, and nobody
+ locks except writers finishing a region.
+ 
+ The coarser levels can be saved, and loaded into a new pyramid for the same file, which then
+ draws immediately at those levels while the finer ones are rebuilt.
+ */
+struct WaveformPyramid : juce::ReferenceCountedObject
+{
+    using Ptr = juce::ReferenceCountedObjectPtr<WaveformPyramid>;
+    
+    WaveformPyramid(int numChannels, int64 lengthInSamples, double sampleRate);
+    ~WaveformPyramid() override;
+    
+    //a pyramid for file, with its persisted levels already loaded if the cache has them
+    static Ptr createFor(const File& file,
+                         int numChannels,
+                         int64 lengthInSamples,
+                         double sampleRate,
+                         PersistentThumbnailCache& cache);
+    
+    static constexpr int samplesPerPointAtFinestLevel = 64;
+    static constexpr int levelRatio = 4;
+    static constexpr int64 maxPointsAtCoarsestLevel = 512;
+    //a region is one point at this level, so everything below it can be built one region at a time
+    static constexpr int regionLevel = 6;
+    static constexpr int64 regionSizeInSamples = samplesPerPointAtFinestLevel * 4096;
+    //roughly the resolution of an AudioThumbnail, at a fraction of the size of the whole pyramid
+    static constexpr int firstPersistedLevel = 2;
+    
+    struct Point
+    {
+        int8 min { 0 }, max { 0 };
+        uint8 rms { 0 };
+    };
+    
+    //what a pixel column shows, in the range -1..1
+    struct Column
+    {
+        float min { 0 }, max { 0 }, rms { 0 };
+        bool isEmpty { true };
+    };
+    
+    int getNumChannels() const noexcept { return numChannels; }
+    int64 getLengthInSamples() const noexcept { return lengthInSamples; }
+    double getSampleRate() const noexcept { return sampleRate; }
+    int getNumLevels() const noexcept { return (int) levels.size(); }
+    int64 getSamplesPerPoint(int level) const noexcept;
+    
+    int getNumRegions() const noexcept { return numRegions; }
+    Range<int64> getRegionRange(int region) const noexcept;
+    int getRegionContaining(int64 sample) const noexcept { return (int) (sample / regionSizeInSamples); }
+    
+    //---------- writers ----------
+    //only the writer that claimed a region may add its samples
+    bool tryClaimRegion(int region) noexcept;
+    bool hasUnclaimedRegions() const noexcept;
+    //for a writer that stops part way through a region, so someone else can start it again
+    void abandonRegion(int region) noexcept;
+    
+    /*
+     adds numSamples of source, starting at sourceStartSample, as the file's samples from startSample.
+     startSample must be a multiple of samplesPerPointAtFinestLevel, and so must numSamples, unless
+     the block ends the file.  Different threads may add different regions at the same time.
+     */
+    void addSamples(const AudioBuffer<float>& source, int sourceStartSample, int64 startSample, int numSamples);
+    
+    //set while the loader is decoding the whole file and feeding it in as it goes, so builders hold off
+    void setIsBeingFed(bool isFed) noexcept { beingFed.store(isFed); }
+    bool isBeingFed() const noexcept { return beingFed.load(); }
+    
+    //---------- readers ----------
+    int getNumRegionsReady() const noexcept { return numRegionsReady.load(std::memory_order_acquire); }
+    bool isComplete() const noexcept { return getNumRegionsReady() >= numRegions; }
+    
+    //the coarsest level that still has at least one point per pixel, or -1 if even level 0 is too coarse
+    int chooseLevelFor(double samplesPerPixel) const noexcept;
+    
+    /*
+     summarises [startSample, endSample) at the given level, leaving out points that aren't ready.
+     while the finer levels are still being rebuilt after a load, it falls back to the persisted ones.
+     */
+    Column getColumn(int channel, int level, int64 startSample, int64 endSample) const noexcept;
+    
+    //counted by the MemoryGovernor for as long as the pyramid exists
+    size_t getSizeInBytes() const noexcept;
+    
+    //---------- persistence ----------
+    //only valid on a fresh pyramid, before anything has been added or read
+    bool loadPersistedLevels(InputStream& in);
+    //only valid once the pyramid is complete
+    void savePersistedLevels(OutputStream& out) const;
+    bool hasPersistedLevels() const noexcept { return firstPreloadedLevel < getNumLevels(); }
+    
+    //stores the persisted levels under the key createFor() took, the first time it is called once the pyramid is complete
+    void storeIfComplete(PersistentThumbnailCache& cache);
+    
+    static constexpr const char* persistedFileExtension = ".pyramid";
+private:
+    const int numChannels;
+    const int64 lengthInSamples;
+    const double sampleRate;
+    const int numRegions;
+    
+    //levels[level][channel][point]
+    std::vector<std::vector<std::vector<Point>>> levels;
+    //levels from here up were loaded, are always ready and are never written again
+    int firstPreloadedLevel { std::numeric_limits<int>::max() };
+    
+    std::unique_ptr<std::atomic<bool>[]> regionIsClaimed;
+    std::unique_ptr<std::atomic<int>[]> regionSamplesAdded;
+    std::unique_ptr<std::atomic<bool>[]> regionIsReady;
+    std::atomic<int> numRegionsReady { 0 };
+    std::atomic<bool> beingFed { false };
+    
+    //taken by createFor(), so a file that changes while it is being read isn't stored under its new key
+    int64 cacheKey { 0 };
+    bool hasCacheKey { false };
+    std::atomic<bool> hasBeenStored { false };
+    //finishing a region rewrites the levels above it, which span several regions
+    CriticalSection finishLock;
+    
+    SharedResourcePointer<MemoryGovernor> memoryGovernor;
+    
+    void finishRegion(int region);
+    bool isPointReady(int level, int64 point) const noexcept;
+    
+    static Point summarise(const float* samples, int numSamples) noexcept;
+    static Point combine(const Point* points, int numPoints) noexcept;
+    
+    JUCE_DECLARE_NON_COPYABLE(WaveformPyramid)
+};
+
+//==============================================================================
+/*
+ Fills whatever regions of a pyramid nobody else has claimed, on the shared analysis pool, one
+ region per job step, so it scales with the number of cores and other instances' files get a turn.
+ 
+ Samples come from alreadyDecoded if it is given, and nothing is decoded at all.  Otherwise every
+ worker opens its own reader on the file.  Formats that can't seek cheaply are read by a single
+ worker, front to back.
+ 
+ Once the pyramid is complete its persisted levels are written to the thumbnail cache, so the next
+ visit to the file draws straight away.
+ */
+struct WaveformPyramidBuilder
+{
+    WaveformPyramidBuilder(WaveformPyramid::Ptr pyramidToFill,
+                           const File& sourceFile,
+                           DecodedAudio::Ptr alreadyDecoded,
+                           AudioFormatManager& formatManager,
+                           ThreadPool& pool,
+                           PersistentThumbnailCache& cache);
+    
+    //stops the workers, waiting for any that are in the middle of a region
+    ~WaveformPyramidBuilder();
+    
+    const WaveformPyramid::Ptr pyramid;
+    
+    //true once every region has been either built or skipped.  one given back since then is left for a new builder
+    bool hasRunOutOfRegions() const noexcept { return nextRegion.load() >= pyramid->getNumRegions(); }
+    
+    static bool canSeekCheaply(const AudioFormat& format);
+private:
+    const File file;
+    const DecodedAudio::Ptr decoded;
+    AudioFormatManager& formatManager;
+    ThreadPool& analysisPool;
+    PersistentThumbnailCache& thumbnailCache;
+    
+    std::atomic<int> nextRegion { 0 };
+    
+    struct RegionJob;
+    struct OwnJobsSelector;
+    
+    bool buildNextRegion(std::unique_ptr<AudioFormatReader>& reader, AudioBuffer<float>& buffer);
+    
+    JUCE_DECLARE_NON_COPYABLE(WaveformPyramidBuilder)
+};